@@ -1,5 +1,8 @@
 import sys
+import os
 import time
+import json
+import zlib                 # CRC32計算用
 import atexit               # 終了時処理用
 
 # bluetooth操作用
@@ -23,12 +26,53 @@ class PARAM_CONFIG() :
     CHARACTERISTIC_UUID_SSID_NAME   = bluepy.btle.UUID('ea7542b1-bfae-7587-dc60-45dbf29ca088')
     CHARACTERISTIC_UUID_SSID_PASS   = bluepy.btle.UUID('ea7542b2-bfae-7587-dc60-45dbf29ca088')
     CHARACTERISTIC_UUID_LOOP_ITVL   = bluepy.btle.UUID('ea7542b3-bfae-7587-dc60-45dbf29ca088')
+    CHARACTERISTIC_UUID_PARAM_BLOB  = bluepy.btle.UUID('ea7542b4-bfae-7587-dc60-45dbf29ca088')
+    CHARACTERISTIC_UUID_PARAM_GEN   = bluepy.btle.UUID('ea7542b5-bfae-7587-dc60-45dbf29ca088')
+    CHARACTERISTIC_UUID_CTRL        = bluepy.btle.UUID('ea7542b6-bfae-7587-dc60-45dbf29ca088')
+    CHARACTERISTIC_UUID_WIFI_STATS  = bluepy.btle.UUID('ea7542b7-bfae-7587-dc60-45dbf29ca088')
+    CHARACTERISTIC_UUID_BOOT_PROF   = bluepy.btle.UUID('ea7542b8-bfae-7587-dc60-45dbf29ca088')
 
     # 有効なデータ長(こちらから調べる方法はある?)
-    CHARACTERISTIC_LEN_SSID_NAME   = 15
-    CHARACTERISTIC_LEN_SSID_PASS   = 15
+    CHARACTERISTIC_LEN_SSID_NAME   = 32
+    CHARACTERISTIC_LEN_SSID_PASS   = 64
     CHARACTERISTIC_LEN_LOOP_ITVL   = 4
     
+    # パラメータブロブのフォーマット (src/param_blob.h と合わせること)
+    PARAM_BLOB_VERSION              = 0x01
+    PARAM_BLOB_TAG_SSID_NAME        = 0x01
+    PARAM_BLOB_TAG_SSID_PASS        = 0x02
+    PARAM_BLOB_TAG_LOOP_ITVL        = 0x03
+    PARAM_BLOB_TAG_AP_PROFILE       = 0x04
+    AP_PROFILE_NUM                  = 4             # src/app_param.h の AP_PROFILE_NUM と合わせること
+    AP_PROFILE_PRIO_DEFAULT         = 128
+    
+    # コントロールポイント (src/param_ctrl.h と合わせること)
+    CTRL_OP_COMMIT                  = 0x01
+    CTRL_OP_REVERT                  = 0x02
+    CTRL_OP_FACTORY_RESET           = 0x03
+    CTRL_OP_REBOOT                  = 0x04
+    CTRL_RSP_CODE                   = 0x80
+    CTRL_STATUS_SUCCESS             = 0x01
+    CTRL_TIMEOUT                    = 5             # 結果待ちタイムアウト(秒)
+    
+    # マニファクチャデータ (src/ble_main.h と合わせること)
+    MANUFACTURER_COMPANY            = b'ES'
+    MANUFACTURER_VERSION            = 0x02
+    MANUFACTURER_POS_VERSION        = 2
+    MANUFACTURER_POS_FLAGS          = 3
+    MANUFACTURER_POS_REASON         = 4
+    MANUFACTURER_POS_GEN            = 5
+    MANUFACTURER_POS_CRC            = 9
+    MANUFACTURER_POS_ID             = 13
+    MANUFACTURER_ID_LEN             = 3
+    MANUFACTURER_FLAG_PROVISIONED   = 0x01
+    MANUFACTURER_FLAG_WIFI_CONNECTED= 0x02
+    MANUFACTURER_FLAG_WIFI_FAILED   = 0x04
+    MANUFACTURER_FLAG_SAVED         = 0x08
+    
+    # ブロブを1回で読み書きするためのMTU (ファームウェアの PARAM_CONFIG_LOCAL_MTU と合わせる)
+    REQUEST_MTU                     = 247
+    
     # ==== 初期化 ============================================================================================
     def __init__(self, dev_name, device) :
         print(f'**** PARAM_CONFIG constructor  {dev_name}   addr : {device.addr},   addrType : {device.addrType}')
@@ -81,6 +125,16 @@ class PARAM_CONFIG() :
         
         # サービス内のディスクリプタを取得
         self.descs = self.service.getDescriptors()
+        
+        # MTUを大きくしておく(ブロブを1回で読み書きするため)
+        try:
+            self.peri.setMTU(self.REQUEST_MTU)
+        except:
+            print("**WARNING** setMTU failed")
+    
+    # ==== ブロブ対応? ==============================================================================================
+    def hasBlob(self) :
+        return self.searchDescriptor(self.CHARACTERISTIC_UUID_PARAM_BLOB) is not None
     
     # ==== 読み出し(共通) ==============================================================================================
     def read(self, uuid) :
@@ -143,6 +197,184 @@ class PARAM_CONFIG() :
         len  = self.CHARACTERISTIC_LEN_LOOP_ITVL
         self.write(uuid, data, len)
 
+    # ==== 読み出し(パラメータ一括) ==============================================================================================
+    def readBlob(self) :
+        data = self.read(self.CHARACTERISTIC_UUID_PARAM_BLOB)
+        if data[0] != self.PARAM_BLOB_VERSION :
+            raise ValueError(f"unsupported blob version {data[0]}")
+        vals = {}
+        pos  = 1
+        while pos + 2 <= len(data) :
+            tag = data[pos]
+            length = data[pos + 1]
+            value  = data[pos + 2 : pos + 2 + length]
+            pos += 2 + length
+            if tag == self.PARAM_BLOB_TAG_SSID_NAME :
+                vals['name'] = value.decode('ascii')
+            elif tag == self.PARAM_BLOB_TAG_SSID_PASS :
+                vals['pswd'] = value.decode('ascii')
+            elif tag == self.PARAM_BLOB_TAG_LOOP_ITVL :
+                vals['itvl'] = int.from_bytes(value, byteorder='little', signed=False)
+            elif tag == self.PARAM_BLOB_TAG_AP_PROFILE :
+                name_len = value[2]
+                vals.setdefault('profiles', []).append((value[3 : 3 + name_len].decode('ascii'),
+                                                        value[3 + name_len :].decode('ascii'), value[1]))
+        return vals
+
+    # ==== ブロブの作成 ==============================================================================================
+    # ファームウェアの param_blob_encode() と同じ並びにすること(CRCの比較に使うため)
+    @classmethod
+    # profiles は (SSID名, パスワード, 優先度) のリスト。clear=True なら未使用のプロファイルを削除するTLVも付ける
+    @classmethod
+    def encodeBlob(cls, name, pswd, itvl, profiles=[], clear=False) :
+        def tlv(tag, value) :
+            return bytes([tag, len(value)]) + value
+        data  = bytes([cls.PARAM_BLOB_VERSION])
+        data += tlv(cls.PARAM_BLOB_TAG_SSID_NAME, name.encode())
+        data += tlv(cls.PARAM_BLOB_TAG_SSID_PASS, pswd.encode())
+        data += tlv(cls.PARAM_BLOB_TAG_LOOP_ITVL, itvl.to_bytes(cls.CHARACTERISTIC_LEN_LOOP_ITVL, byteorder="little"))
+        for idx in range(cls.AP_PROFILE_NUM) :
+            if idx < len(profiles) :
+                (p_name, p_pswd, p_prio) = profiles[idx]
+                data += tlv(cls.PARAM_BLOB_TAG_AP_PROFILE, bytes([idx, p_prio, len(p_name.encode())]) + p_name.encode() + p_pswd.encode())
+            elif clear :
+                data += tlv(cls.PARAM_BLOB_TAG_AP_PROFILE, bytes([idx, 0, 0]))
+        return data
+
+    # ==== 書き込み(パラメータ一括) ==============================================================================================
+    def writeBlob(self, name, pswd, itvl, profiles=[]) :
+        data = self.encodeBlob(name, pswd, itvl, profiles, clear=True)
+        self.write(self.CHARACTERISTIC_UUID_PARAM_BLOB, data, withResponse=True)    # 検証結果を受け取るためWrite Requestを使う
+
+    # ==== 読み出し(Wi-Fi接続統計情報) ==============================================================================================
+    # フォーマットは src/wifi_common.h 参照
+    WIFI_STATS_VERSION              = 0x01
+    WIFI_RETRY_HIST_NUM             = 5
+    def readWifiStats(self) :
+        if self.searchDescriptor(self.CHARACTERISTIC_UUID_WIFI_STATS) is None :
+            return None
+        data = self.read(self.CHARACTERISTIC_UUID_WIFI_STATS)
+        if data[0] != self.WIFI_STATS_VERSION :
+            raise ValueError(f"unsupported wifi stats version {data[0]}")
+        pos = 1
+        def get(length) :
+            nonlocal pos
+            val = int.from_bytes(data[pos : pos + length], byteorder='little', signed=False)
+            pos += length
+            return val
+        stats = {}
+        for key in ('connect', 'disconnect', 'retry', 'sta_start_ms', 'first_ip_ms') :
+            stats[key] = get(4)
+        stats['last_reason'] = get(1)
+        stats['retry_hist']  = [get(2) for i in range(self.WIFI_RETRY_HIST_NUM)]
+        stats['reasons']     = [(get(1), get(2)) for i in range(get(1))]
+        stats['attempts']    = [dict(start_ms=get(4), scan_ms=get(2), assoc_ms=get(2), dhcp_ms=get(2),
+                                     reason=get(1), retry=get(1), channel=get(1), flags=get(1)) for i in range(get(1))]
+        return stats
+
+    # ==== 読み出し(起動時間の内訳) ==============================================================================================
+    # フォーマットは src/boot_prof.h 参照。(チェックポイント名, 時刻[us]) のリストを返す
+    BOOT_PROF_VERSION               = 0x01
+    def readBootProf(self) :
+        if self.searchDescriptor(self.CHARACTERISTIC_UUID_BOOT_PROF) is None :
+            return None
+        data = self.read(self.CHARACTERISTIC_UUID_BOOT_PROF)
+        if data[0] != self.BOOT_PROF_VERSION :
+            raise ValueError(f"unsupported boot profile version {data[0]}")
+        points = []
+        pos = 2
+        for i in range(data[1]) :
+            time_us  = int.from_bytes(data[pos : pos + 4], byteorder='little', signed=False)
+            name_len = data[pos + 4]
+            points.append((data[pos + 5 : pos + 5 + name_len].decode('ascii'), time_us))
+            pos += 5 + name_len
+        return points
+
+    # ==== 読み出し(世代番号/CRC) ==============================================================================================
+    def readGen(self) :
+        if self.searchDescriptor(self.CHARACTERISTIC_UUID_PARAM_GEN) is None :
+            return None
+        data = self.read(self.CHARACTERISTIC_UUID_PARAM_GEN)
+        gen = int.from_bytes(data[0:4], byteorder='little', signed=False)
+        crc = int.from_bytes(data[4:8], byteorder='little', signed=False)
+        return (gen, crc)
+
+    # ==== コントロールポイント ==============================================================================================
+    # 結果(Indication)を待って、成功ならTrueを返す
+    def control(self, opcode) :
+        if not self.isConnected :
+            return False
+        desc = self.searchDescriptor(self.CHARACTERISTIC_UUID_CTRL)
+        if desc is None :
+            print("**WARNING** control point not supported")
+            return False
+        
+        # Indicationの受け取り設定
+        class CtrlDelegate(bluepy.btle.DefaultDelegate) :
+            def __init__(self) :
+                bluepy.btle.DefaultDelegate.__init__(self)
+                self.rsp = None
+            def handleNotification(self, handle, data) :
+                if handle == desc.handle :
+                    self.rsp = data
+        delegate = CtrlDelegate()
+        self.peri.withDelegate(delegate)
+        self.peri.writeCharacteristic(desc.handle + 1, b'\x02\x00', True)    # CCCは値の直後のハンドル
+        
+        print(f"CONTROL  opcode 0x{opcode:02x}")
+        self.peri.writeCharacteristic(desc.handle, bytes([opcode]), True)
+        
+        # 結果待ち
+        timeout = time.time() + self.CTRL_TIMEOUT
+        while delegate.rsp is None and time.time() < timeout :
+            self.peri.waitForNotifications(1.0)
+        rsp = delegate.rsp
+        if rsp is None or len(rsp) < 3 or rsp[0] != self.CTRL_RSP_CODE or rsp[1] != opcode :
+            print("**WARNING** control point response timeout")
+            return False
+        print(f"CONTROL  status 0x{rsp[2]:02x}")
+        return rsp[2] == self.CTRL_STATUS_SUCCESS
+
+    # ==== advertisingの状態レコード (接続せずに取得) ==============================================================================================
+    def advertisedStatus(self) :
+        text = self.device.getValueText(bluepy.btle.ScanEntry.MANUFACTURER)
+        if text is None :
+            return None
+        data = bytes.fromhex(text)
+        if not data.startswith(self.MANUFACTURER_COMPANY) or len(data) < self.MANUFACTURER_POS_ID + self.MANUFACTURER_ID_LEN \
+                or data[self.MANUFACTURER_POS_VERSION] != self.MANUFACTURER_VERSION :
+            return None         # 状態レコード非対応ファームウェア
+        flags = data[self.MANUFACTURER_POS_FLAGS]
+        if flags & self.MANUFACTURER_FLAG_WIFI_CONNECTED :
+            wifi = 'connected'
+        elif flags & self.MANUFACTURER_FLAG_WIFI_FAILED :
+            wifi = 'failed'
+        else :
+            wifi = 'connecting'
+        return {
+            'provisioned' : (flags & self.MANUFACTURER_FLAG_PROVISIONED) != 0,
+            'saved'       : (flags & self.MANUFACTURER_FLAG_SAVED) != 0,
+            'wifi'        : wifi,
+            'reason'      : data[self.MANUFACTURER_POS_REASON],
+            'gen'         : int.from_bytes(data[self.MANUFACTURER_POS_GEN : self.MANUFACTURER_POS_GEN + 4], byteorder='little', signed=False),
+            'crc'         : int.from_bytes(data[self.MANUFACTURER_POS_CRC : self.MANUFACTURER_POS_CRC + 4], byteorder='little', signed=False),
+            'id'          : data[self.MANUFACTURER_POS_ID : self.MANUFACTURER_POS_ID + self.MANUFACTURER_ID_LEN].hex(),
+        }
+
+    # ==== advertisingの世代番号/CRC (接続せずに取得) ==============================================================================================
+    def advertisedGen(self) :
+        status = self.advertisedStatus()
+        if status is None :
+            return None
+        return (status['gen'], status['crc'])
+
+    # ==== キャッシュのキー (BLEはランダムアドレスで変わるので、デバイスIDがあればそちらを使う) ==============================================
+    def cacheKey(self) :
+        status = self.advertisedStatus()
+        if status is None :
+            return self.device.addr
+        return status['id']
+
     # ==== 切断 ==============================================================================================
     def disconnect(self) :
         if self.isConnected :
@@ -152,21 +384,52 @@ class PARAM_CONFIG() :
             self.isConnected = False
 # ======================================================================================================================================
 
+# ==== 読み出し結果のキャッシュ (BD_ADDR毎に 世代番号/CRC と値を保存) ==============================================
+CACHE_FILE = os.path.join(os.path.expanduser('~'), '.SetAppParram_cache.json')
+
+def loadCache() :
+    try :
+        with open(CACHE_FILE) as f :
+            return json.load(f)
+    except :
+        return {}
+
+def saveCache(cache) :
+    try :
+        with open(CACHE_FILE, 'w') as f :
+            json.dump(cache, f, indent=2)
+    except :
+        print("**WARNING** cache save failed")
+
 def main() :
     # コマンドラインパラメータの処理   ... なんて やっつけな実装なんだ....
     write_flag = False          # 書き込みフラグは落としておく
+    stats_flag = False          # Wi-Fi接続統計情報の表示
+    boot_flag  = False          # 起動時間の内訳の表示
     num_arg = len(sys.argv)
+    name = pswd = itvl = None
+    profiles = []
     if num_arg == 1 :
         # パラメータなし
         pass
-    elif num_arg == 4 :
-        # パラメータ3個
+    elif num_arg == 2 and sys.argv[1] == 'wifi' :
+        # Wi-Fi接続統計情報の表示
+        stats_flag = True
+    elif num_arg == 2 and sys.argv[1] == 'boot' :
+        # 起動時間の内訳の表示
+        boot_flag = True
+    elif 4 <= num_arg <= 4 + PARAM_CONFIG.AP_PROFILE_NUM :
+        # パラメータ3個 + 追加の接続先 "SSID名:パスワード[:優先度]" (最大 AP_PROFILE_NUM 個)
         name = str(sys.argv[1])
         pswd = str(sys.argv[2])
         itvl = int(sys.argv[3])
+        for arg in sys.argv[4:] :
+            fields = arg.split(':')
+            prio = int(fields[2]) if len(fields) > 2 else PARAM_CONFIG.AP_PROFILE_PRIO_DEFAULT
+            profiles.append((fields[0], fields[1] if len(fields) > 1 else '', prio))
         write_flag = True       # 書き込みフラグを立てる
     else :
-        print("**** ERROR **** Must have 3 parameters")
+        print(f"**** ERROR **** Must have 3 parameters (+ up to {PARAM_CONFIG.AP_PROFILE_NUM} 'ssid:pass[:priority]')")
         sys.exit(1)
     
     # デバイスのスキャン
@@ -212,6 +475,10 @@ def main() :
             # 見つかった
             # PARAM_CONFIG のインスタンス生成
             param_configs.append(PARAM_CONFIG(dev_name, device))
+            # 接続せずに分かる状態を表示 (作業が必要なデバイスの見分け用)
+            status = param_configs[-1].advertisedStatus()
+            if status is not None :
+                print(f"    id: {status['id']}    provisioned: {status['provisioned']}    wifi: {status['wifi']} (last reason {status['reason']})    gen: {status['gen']}")
     
     if len(param_configs) == 0 :
         # PARAM_CONFIG が見つからなかった
@@ -220,38 +487,61 @@ def main() :
     
     param_config = param_configs[0]        # とりあえず最初の1個だけ使う
     
+    # advertisingの世代番号/CRCで変更の有無を確認 (変更がなければ接続しない)
+    cache  = loadCache()
+    cached = cache.get(param_config.cacheKey())
+    adv_status = param_config.advertisedStatus()
+    if adv_status is not None :
+        gen, crc = adv_status['gen'], adv_status['crc']
+        print(f'advertised generation : {gen}    crc : 0x{crc:08x}    saved : {adv_status["saved"]}')
+        if write_flag :
+            # 確定済みでもNVSへの保存に失敗していれば、接続して保存し直す
+            if adv_status['saved'] and zlib.crc32(PARAM_CONFIG.encodeBlob(name, pswd, itvl, profiles)) == crc :
+                print('==== already up to date (skip connect) ====')
+                sys.exit(0)
+        elif not stats_flag and not boot_flag and cached and cached.get('gen') == gen and cached.get('crc') == crc :
+            print('==== not changed since last read (skip connect) ====')
+            printParam(cached['name'], cached['pswd'], cached['itvl'], cached.get('profiles', []))
+            sys.exit(0)
+    
     # 接続
     print('==== connect ====')
     param_config.connect()
     
     try :
-        if write_flag :
-            # ==== 書き込み(SSID name) ==============================================================================================
-            param_config.writeSsidName(name)
-            time.sleep(1)                           # アクセスの間隔は少しあけたほうがよさそう
-            # ==== 書き込み(SSID pass) ==============================================================================================
-            param_config.writeSsidPass(pswd)
-            time.sleep(1)                           # アクセスの間隔は少しあけたほうがよさそう
-            # ==== 書き込み(Loop interval) ==============================================================================================
-            param_config.writeLoopItvl(itvl)
-            time.sleep(1)                           # アクセスの間隔は少しあけたほうがよさそう
+        if stats_flag :
+            stats = param_config.readWifiStats()
+            if stats is None :
+                print("**WARNING** wifi statistics not supported")
+            else :
+                printWifiStats(stats)
+        elif boot_flag :
+            points = param_config.readBootProf()
+            if points is None :
+                print("**WARNING** boot profile not supported")
+            else :
+                printBootProf(points)
+        elif param_config.hasBlob() :
+            # ブロブ対応ファームウェアなら1回ずつの読み書きで済ませる
+            if write_flag :
+                param_config.writeBlob(name, pswd, itvl, profiles)
+                # 確定してNVSに保存 (コンソール操作不要)
+                if not param_config.control(PARAM_CONFIG.CTRL_OP_COMMIT) :
+                    print("**WARNING** parameters not saved")
+            vals = param_config.readBlob()
+            name = vals.get('name')
+            pswd = vals.get('pswd')
+            itvl = vals.get('itvl')
+            profiles = vals.get('profiles', [])
+            # 世代番号/CRCと一緒にキャッシュしておく
+            dev_gen = param_config.readGen()
+            if dev_gen is not None :
+                cache[param_config.cacheKey()] = {'gen': dev_gen[0], 'crc': dev_gen[1], 'name': name, 'pswd': pswd, 'itvl': itvl, 'profiles': profiles}
+                saveCache(cache)
+        else :
+            name, pswd, itvl = readWriteEach(param_config, write_flag, name, pswd, itvl)
         
-        # read
-        # ==== 読み出し(SSID name) ==============================================================================================
-        name = param_config.readSsidName()
-        time.sleep(1)                               # アクセスの間隔は少しあけたほうがよさそう
-        # ==== 読み出し(SSID pass) ==============================================================================================
-        pswd = param_config.readSsidPass()
-        time.sleep(1)                               # アクセスの間隔は少しあけたほうがよさそう
-        # ==== 読み出し(Loop interval) ==============================================================================================
-        itvl = param_config.readLoopItvl()
-        time.sleep(1)                               # アクセスの間隔は少しあけたほうがよさそう
-        
-        print('====================================================')
-        print(f'SSID name     : "{name}"')
-        print(f'SSID pass     : "{pswd}"')
-        print(f'Loop Interval : {itvl}')
-        print('====================================================')
+        printParam(name, pswd, itvl, profiles)
     
     except Exception as e:
         print("******** Read/Write Error ********")
@@ -261,4 +551,63 @@ def main() :
     print("==== disconnect ====")
     param_config.disconnect()
 
+# ==== 設定値の表示 ==============================================
+def printParam(name, pswd, itvl, profiles=[]) :
+    print('====================================================')
+    print(f'SSID name     : "{name}"')
+    print(f'SSID pass     : "{pswd}"')
+    print(f'Loop Interval : {itvl}')
+    for (p_name, p_pswd, p_prio) in profiles :
+        print(f'AP profile    : "{p_name}" / "{p_pswd}"  (priority {p_prio})')
+    print('====================================================')
+
+# ==== Wi-Fi接続統計情報の表示 ==============================================
+def printWifiStats(stats) :
+    print('====================================================')
+    print(f"connect : {stats['connect']}   disconnect : {stats['disconnect']}   retry : {stats['retry']}   last reason : {stats['last_reason']}")
+    print(f"sta start : {stats['sta_start_ms']} ms   first ip : {stats['first_ip_ms']} ms")
+    print(f"retries before connect : {stats['retry_hist']}")
+    print(f"disconnect reason      : {dict(stats['reasons'])}")
+    print(' start[ms]  scan  assoc   dhcp  ch  retry  reason  flags')
+    for a in stats['attempts'] :
+        assoc = -1 if a['assoc_ms'] == 0xffff else a['assoc_ms']
+        dhcp  = -1 if a['dhcp_ms']  == 0xffff else a['dhcp_ms']
+        print(f"{a['start_ms']:10}  {a['scan_ms']:4}  {assoc:5}  {dhcp:5}  {a['channel']:2}  {a['retry']:5}  {a['reason']:6}  {a['flags']:#04x}")
+    print('====================================================')
+
+# ==== 起動時間の内訳の表示 ==============================================
+def printBootProf(points) :
+    print('====================================================')
+    print(f"{'checkpoint':15}  {'time[ms]':>10}  {'delta[ms]':>10}")
+    prev = 0
+    for (name, time_us) in points :
+        print(f"{name:15}  {time_us / 1000:10.3f}  {(time_us - prev) / 1000:10.3f}")
+        prev = time_us
+    print('====================================================')
+
+# ==== 個別characteristicでの読み書き(ブロブ非対応ファームウェア用) ==============================================
+def readWriteEach(param_config, write_flag, name, pswd, itvl) :
+    if write_flag :
+        # ==== 書き込み(SSID name) ==============================================================================================
+        param_config.writeSsidName(name)
+        time.sleep(1)                           # アクセスの間隔は少しあけたほうがよさそう
+        # ==== 書き込み(SSID pass) ==============================================================================================
+        param_config.writeSsidPass(pswd)
+        time.sleep(1)                           # アクセスの間隔は少しあけたほうがよさそう
+        # ==== 書き込み(Loop interval) ==============================================================================================
+        param_config.writeLoopItvl(itvl)
+        time.sleep(1)                           # アクセスの間隔は少しあけたほうがよさそう
+    
+    # read
+    # ==== 読み出し(SSID name) ==============================================================================================
+    name = param_config.readSsidName()
+    time.sleep(1)                               # アクセスの間隔は少しあけたほうがよさそう
+    # ==== 読み出し(SSID pass) ==============================================================================================
+    pswd = param_config.readSsidPass()
+    time.sleep(1)                               # アクセスの間隔は少しあけたほうがよさそう
+    # ==== 読み出し(Loop interval) ==============================================================================================
+    itvl = param_config.readLoopItvl()
+    time.sleep(1)                               # アクセスの間隔は少しあけたほうがよさそう
+    return name, pswd, itvl
+
 main()
@@ -14,40 +14,105 @@
 
 #include    "freertos/FreeRTOS.h"
 #include    "freertos/task.h"
+#include    "freertos/semphr.h"
+#include    "freertos/queue.h"
 #include    "esp_log.h"
 #include    "esp_err.h"
 
 #include    "nvs_flash.h"
+#include    "esp_rom_crc.h"
 
 #include    "uart_console.h"
 #include    "app_param.h"
+#include    "param_blob.h"
+#include    "param_rec.h"
+#include    "param_seqlock.h"
+#include    "param_subscriber.h"
 
 // LOG表示用TAG(関数名にしておく)
 #define     TAG             __func__
 
 // 設定パラメータ
 struct app_param            AppParam;
+struct app_param            AppParamStage;
 
-// 設定パラメータのロード
+// AppParam 更新/参照用 seqlock (param_seqlock.h)
+//   書き込み側 : param_mux のクリティカルセクション内で書き換える
+//                (クリティカルセクション内なので、同じコアの読み出し側タスクに割り込まれて止まることはない)
+//   読み出し側 : ロックを取らずにコピーし、途中で書き込みがあればやり直す
+//                (BLEの書き込みなどでブロックされることはない)
+static portMUX_TYPE         param_mux = portMUX_INITIALIZER_UNLOCKED;
+static struct param_seqlock param_lock;
+
+// 確定時に呼び出す関数
+static void                 (*param_change_hook)(uint32_t generation) = NULL;
+
+// NVSへの保存/消去時に呼び出す関数
+static void                 (*param_save_hook)(void) = NULL;
+
+// 変更通知先 (param_subscriber.h)
+static struct param_subscriber  param_subscribers[PARAM_SUBSCRIBER_MAX];
+static portMUX_TYPE             subscriber_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// NVS書き込みの排他用 (書き込み中にリブートしないよう、WaitParamSaved()で完了を待つ)
+// 最初のLoadParam()はタスク起動前に呼ばれるので、その時点で生成する
+static SemaphoreHandle_t    save_lock = NULL;
+static StaticSemaphore_t    save_lock_buf;
+
+// A/Bスロット
+static const char*          param_slot_keys[PARAM_SLOT_NUM] = { NVS_KEY_PARAM_SLOT_A, NVS_KEY_PARAM_SLOT_B };
+static int                  active_slot    = -1;        // 使用中のスロット (-1:なし)
+static uint32_t             active_seq     = 0;         // 使用中のスロットのシーケンス番号
+static bool                 active_pending = false;     // 使用中のスロットが未確認(IPアドレス取得前)
+static bool                 boot_counted   = false;     // 起動回数を数えた(起動後最初のLoadParam()だけ数える)
+
+// 最後にNVSに書き込んだ(またはNVSから読んだ)レコードの内容 (変更がなければ書き込まない)
+// IsParamSaved()で他タスクからも参照するので、更新は param_mux 内で行う
+static bool                 saved_valid = false;
+static uint32_t             saved_crc;
+static uint32_t             saved_generation;
+
+// AppParamStage 編集の排他用 (StageParam()で生成)
+static SemaphoreHandle_t    stage_lock = NULL;
+static StaticSemaphore_t    stage_lock_buf;
+
+// NVS書き込みのロック/アンロック
+static void lock_save(void)
+{
+    if (save_lock == NULL) {
+        save_lock = xSemaphoreCreateMutexStatic(&save_lock_buf);
+    }
+    xSemaphoreTake(save_lock, portMAX_DELAY);
+}
+
+static void unlock_save(void)
+{
+    xSemaphoreGive(save_lock);
+}
+
+// 書き込み済みレコードの内容を記録
+static void set_saved(const struct app_param* pParam)
+{
+    uint32_t    crc = CalcParamCrc(pParam);
+
+    portENTER_CRITICAL(&param_mux);
+    saved_valid      = true;
+    saved_crc        = crc;
+    saved_generation = pParam->generation;
+    portEXIT_CRITICAL(&param_mux);
+}
+
+// 旧形式(項目毎のキー)で保存された設定パラメータのロード
 // return : ture  ロードできた   false   ロードできなかった
-bool LoadParam(struct app_param* pParam)
+static bool load_legacy(nvs_handle handle, struct app_param* pParam)
 {
     bool        ret = true;
     esp_err_t   err;
-    nvs_handle  handle_1;
     size_t      buf_len;
 
-    // NVS オープン
-    err = nvs_open(NVS_NAMESPACE_INFO, NVS_READWRITE, &handle_1);
-    if (err != ESP_OK) {
-        // NVS オープン失敗
-        ESP_LOGE(TAG, "nvs_open() failed.(%d)\n", err);
-        return false;
-    }
-
     // SSID名称
     buf_len = sizeof(pParam->ssid_name);
-    err = nvs_get_str(handle_1, NVS_KEY_SSID_NAME, pParam->ssid_name, &buf_len);
+    err = nvs_get_str(handle, NVS_KEY_SSID_NAME, pParam->ssid_name, &buf_len);
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "nvs_get_str(ssid_name) failed.(%d)\n", err);
         ret = false;
@@ -62,7 +127,7 @@ bool LoadParam(struct app_param* pParam)
 
     // SSIDパスワード
     buf_len = sizeof(pParam->ssid_pass);
-    err = nvs_get_str(handle_1, NVS_KEY_SSID_PASS, pParam->ssid_pass, &buf_len);
+    err = nvs_get_str(handle, NVS_KEY_SSID_PASS, pParam->ssid_pass, &buf_len);
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "nvs_get_str(ssid_pass) failed.(%d)\n", err);
         ret = false;
@@ -77,7 +142,7 @@ bool LoadParam(struct app_param* pParam)
 #if 0
     // サーバ アドレス
     buf_len = sizeof(pParam->server_address);
-    err = nvs_get_str(handle_1, NVS_KEY_SVR_ADDR, pParam->server_address, &buf_len);
+    err = nvs_get_str(handle, NVS_KEY_SVR_ADDR, pParam->server_address, &buf_len);
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "nvs_get_str(svr_addr) failed.(%d)\n", err);
         ret = false;
@@ -85,7 +150,7 @@ bool LoadParam(struct app_param* pParam)
     }
 
     // サーバ ポート番号
-    err = nvs_get_u16(handle_1, NVS_KEY_SVR_PORT, &pParam->server_port);
+    err = nvs_get_u16(handle, NVS_KEY_SVR_PORT, &pParam->server_port);
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "nvs_get_i32(svr_port) failed.(%d)\n", err);
         ret = false;
@@ -93,7 +158,7 @@ bool LoadParam(struct app_param* pParam)
     }
 #endif
     // LOOP INTERVAL
-    err = nvs_get_u32(handle_1, NVS_KEY_SVR_PORT, &pParam->loop_interval);
+    err = nvs_get_u32(handle, NVS_KEY_SVR_PORT, &pParam->loop_interval);
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "nvs_get_i32(loop_interval) failed.(%d)\n", err);
         ret = false;
@@ -106,64 +171,279 @@ bool LoadParam(struct app_param* pParam)
         }
     }
 
+    // 世代番号 (古いファームウェアで保存したものには無いので、無くてもエラーにしない)
+    err = nvs_get_u32(handle, NVS_KEY_PARAM_GEN, &pParam->generation);
+    if (err != ESP_OK) {
+        pParam->generation = 0;
+    }
+    return ret;
+}
+
+// 旧形式のキーを削除 (移行完了後)
+static void erase_legacy(nvs_handle handle)
+{
+    static const char*  keys[] = { NVS_KEY_SSID_NAME, NVS_KEY_SSID_PASS, NVS_KEY_SVR_ADDR, NVS_KEY_SVR_PORT, NVS_KEY_PARAM_GEN };
+
+    for (int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        esp_err_t   err = nvs_erase_key(handle, keys[i]);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "nvs_erase_key(%s) failed.(%d)\n", keys[i], err);
+        }
+    }
+}
+
+// 設定パラメータレコード(スロット)のロード
+// return : ESP_OK                  ロードできた
+//          ESP_ERR_NVS_NOT_FOUND   レコードがない
+//          上記以外                 レコードが壊れている/未対応のバージョン
+static esp_err_t load_record(nvs_handle handle, int slot, struct app_param* pParam, struct param_rec_hdr* pHdr)
+{
+    static uint8_t          buf[PARAM_REC_MAX_LEN];     // スタック節約のためstatic (save_lock で排他済み)
+    size_t                  len = sizeof(buf);
+    esp_err_t               err;
+
+    err = nvs_get_blob(handle, param_slot_keys[slot], buf, &len);
+    if (err != ESP_OK) {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "nvs_get_blob(%s) failed.(%d)\n", param_slot_keys[slot], err);
+        }
+        return err;
+    }
+
+    // ヘッダ/CRCのチェックと本体のデコード (失敗したら pParam は変更されない)
+    err = param_rec_decode(buf, len, pParam, pHdr);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "%s invalid record.(%d)\n", param_slot_keys[slot], err);
+    }
+    return err;
+}
+
+// 設定パラメータレコード(スロット)のセーブ
+static esp_err_t save_record(nvs_handle handle, int slot, const struct app_param* pParam, uint32_t seq, uint8_t state)
+{
+    static uint8_t          buf[PARAM_REC_MAX_LEN];     // スタック節約のためstatic (save_lock で排他済み)
+    esp_err_t               err;
+
+    int     len = param_rec_encode(pParam, seq, state, buf, sizeof(buf));
+    if (len < 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    err = nvs_set_blob(handle, param_slot_keys[slot], buf, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs_set_blob(%s) failed.(%d)\n", param_slot_keys[slot], err);
+    }
+    return err;
+}
+
+// 起動試行回数の更新
+// 未確認のスロットで起動した回数を数え、上限に達していたらロールバックする
+// もう一方のスロットが無効ならロールバックできないので数えない(毎回の書き込みとカウンタの一周を避ける)
+// return : 使用するスロット
+static int check_boot_try(nvs_handle handle, int slot, const bool* valid)
+{
+    uint8_t     try_count = 0;
+    int         other = 1 - slot;
+
+    nvs_get_u8(handle, NVS_KEY_PARAM_TRY, &try_count);     // 無ければ0回
+    if (!valid[other]) {
+        if (try_count != 0) {
+            nvs_erase_key(handle, NVS_KEY_PARAM_TRY);       // 残っていれば1回だけ消す
+            nvs_commit(handle);
+        }
+        ESP_LOGI(TAG, "%s not confirmed yet (no slot to roll back)\n", param_slot_keys[slot]);
+        return slot;
+    }
+    if (param_rec_boot_slot(slot, valid, try_count) != slot) {
+        // 規定回数起動してもIPアドレスを取得できなかった → 前のスロットに戻す
+        ESP_LOGW(TAG, "%s not confirmed after %d boots. roll back to %s\n",
+                 param_slot_keys[slot], try_count, param_slot_keys[other]);
+        nvs_erase_key(handle, param_slot_keys[slot]);
+        nvs_erase_key(handle, NVS_KEY_PARAM_TRY);
+        nvs_commit(handle);
+        return other;
+    }
+
+    try_count++;
+    nvs_set_u8(handle, NVS_KEY_PARAM_TRY, try_count);
+    nvs_commit(handle);
+    ESP_LOGI(TAG, "%s not confirmed yet (boot %d/%d)\n", param_slot_keys[slot], try_count, PARAM_BOOT_TRY_MAX);
+    return slot;
+}
+
+// 設定パラメータのロード
+// A/B 2つのスロットのうち、有効でシーケンス番号の新しい方を使う
+// スロットがなければ旧形式で読んでスロットに移行する
+// NVSの内容はゼロクリアした領域にデコードする(メモリ上の未保存の値がロード結果に混ざらないように)
+// ロードできなかった場合は pParam は変更しない
+// return : ture  ロードできた   false   ロードできなかった
+bool LoadParam(struct app_param* pParam)
+{
+    static struct app_param slot_param[PARAM_SLOT_NUM];     // スタック節約のためstatic (save_lock で排他済み)
+    struct param_rec_hdr    hdr[PARAM_SLOT_NUM];
+    bool                    valid[PARAM_SLOT_NUM];
+    int                     sel;
+    bool                    ret = false;
+    esp_err_t               err;
+    nvs_handle              handle_1;
+
+    lock_save();
+
+    // NVS オープン
+    err = nvs_open(NVS_NAMESPACE_INFO, NVS_READWRITE, &handle_1);
+    if (err != ESP_OK) {
+        // NVS オープン失敗
+        ESP_LOGE(TAG, "nvs_open() failed.(%d)\n", err);
+        unlock_save();
+        return false;
+    }
+
+    // 両方のスロットを読んで、有効なもののうち新しい方を選ぶ
+    for (int i = 0; i < PARAM_SLOT_NUM; i++) {
+        memset(&slot_param[i], 0x00, sizeof(slot_param[i]));
+        valid[i] = (load_record(handle_1, i, &slot_param[i], &hdr[i]) == ESP_OK);
+    }
+    sel = param_rec_select(valid, hdr);
+
+    if (sel >= 0) {
+        // 起動後最初のロードで、未確認のスロットなら起動回数を数える(ロールバックするかもしれない)
+        if (!boot_counted && hdr[sel].state == PARAM_REC_STATE_PENDING) {
+            sel = check_boot_try(handle_1, sel, valid);
+        }
+        memcpy(pParam, &slot_param[sel], sizeof(*pParam));
+        active_slot    = sel;
+        active_seq     = hdr[sel].seq;
+        active_pending = (hdr[sel].state == PARAM_REC_STATE_PENDING);
+        set_saved(pParam);
+        ret = true;
+    }
+    else {
+        // スロットがない → 旧形式で読んでみる
+        memset(&slot_param[0], 0x00, sizeof(slot_param[0]));
+        ret = load_legacy(handle_1, &slot_param[0]);
+        if (ret) {
+            memcpy(pParam, &slot_param[0], sizeof(*pParam));
+            // 全項目読めたらスロットAに移行 (これまで使えていた値なので確認済みとする)
+            ESP_LOGI(TAG, "migrating parameters to %s\n", param_slot_keys[0]);
+            if (save_record(handle_1, 0, pParam, 1, PARAM_REC_STATE_CONFIRMED) == ESP_OK) {
+                erase_legacy(handle_1);
+                if (nvs_commit(handle_1) == ESP_OK) {
+                    active_slot    = 0;
+                    active_seq     = 1;
+                    active_pending = false;
+                    set_saved(pParam);
+                }
+            }
+        }
+    }
+    boot_counted = true;
+    pParam->crc = CalcParamCrc(pParam);
+
     // NVS クローズ
     nvs_close(handle_1);
+    unlock_save();
     return ret;
 }
 
 // 設定パラメータのセーブ
-void SaveParam(struct app_param* pParam)
+// 使用中でない方のスロットに新しいシーケンス番号で書き込む(書き込み中に電源が落ちても使用中のスロットは壊れない)
+// 書き込んだスロットは GOT_IP で確認されるまで未確認扱い
+// 使用中のスロットが未確認なら、そのスロットを上書きする(確認済みのスロットはロールバック先として残す)
+// NVSの内容から変更がなければ書き込まない(フラッシュの書き換え回数を減らすため)
+// nvs_commit()まで完了してから戻る
+// return : ture  セーブできた   false   セーブできなかった
+bool SaveParam(struct app_param* pParam)
 {
     esp_err_t   err;
     nvs_handle handle_1;
 
+    lock_save();
+
+    if (saved_valid && saved_crc == CalcParamCrc(pParam) && saved_generation == pParam->generation) {
+        ESP_LOGI(TAG, "parameters not changed (skip)\n");
+        unlock_save();
+        return true;
+    }
+
     // NVS オープン
     err = nvs_open(NVS_NAMESPACE_INFO, NVS_READWRITE, &handle_1);
     if (err != ESP_OK) {
         // NVS オープン失敗
         ESP_LOGE(TAG, "nvs_open() failed.(%d)\n", err);
-        return;
+        unlock_save();
+        return false;
     }
 
-    // SSID NAME
-    err = nvs_set_str(handle_1, NVS_KEY_SSID_NAME, pParam->ssid_name);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "nvs_set_str(ssid_name) failed.(%d)\n", err);
-        // とりあえず続ける
+    // 使用中でない方(未確認なら使用中)のスロットに書き込む
+    int         slot = param_rec_save_slot(active_slot, active_pending);
+    uint32_t    seq  = active_seq + 1;
+    err = save_record(handle_1, slot, pParam, seq, PARAM_REC_STATE_PENDING);
+    if (err == ESP_OK) {
+        nvs_erase_key(handle_1, NVS_KEY_PARAM_TRY);         // 新しいスロットの起動回数は0から
+        err = nvs_commit(handle_1);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "nvs_commit() failed.(%d)\n", err);
+        }
     }
-
-    // SSIDパスワード
-    err = nvs_set_str(handle_1, NVS_KEY_SSID_PASS, pParam->ssid_pass);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "nvs_set_str(ssid_pass) failed.(%d)\n", err);
-        // とりあえず続ける
+    if (err == ESP_OK) {
+        active_slot    = slot;
+        active_seq     = seq;
+        active_pending = true;
+        set_saved(pParam);
+        ESP_LOGI(TAG, "parameters saved to %s (seq %u)\n", param_slot_keys[slot], seq);
     }
-#if 0
-    // サーバ アドレス
-    err = nvs_set_str(handle_1, NVS_KEY_SVR_ADDR, pParam->server_address);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "nvs_set_str(svr_addr) failed.(%d)\n", err);
-        // とりあえず続ける
+    else {
+        saved_valid = false;        // NVSの内容が不明になったので次回は必ず書き込む
     }
 
-    // サーバ ポート番号
-    err = nvs_set_u16(handle_1, NVS_KEY_SVR_PORT, pParam->server_port);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "nvs_set_i32(svr_port) failed.(%d)\n", err);
-        // とりあえず続ける
+    // NVS クローズ
+    nvs_close(handle_1);
+    unlock_save();
+
+    if (err == ESP_OK && param_save_hook) {
+        param_save_hook();
     }
-#endif
-    // LOOP INTERVAL
-    err = nvs_set_u32(handle_1, NVS_KEY_SVR_PORT, pParam->loop_interval);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "nvs_set_i32(loop_interval) failed.(%d)\n", err);
-        // とりあえず続ける
+    return (err == ESP_OK);
+}
+
+// 使用中のスロットを確認済みにする (IPアドレスを取得できたら呼ぶ)
+// 確認済みになったスロットはロールバックの対象外
+void ConfirmParam(void)
+{
+    static struct app_param param;      // スタック節約のためstatic (save_lock で排他済み)
+    struct param_rec_hdr    hdr;
+    nvs_handle              handle_1;
+
+    lock_save();
+    if (active_slot < 0 || !active_pending) {
+        unlock_save();
+        return;
     }
 
-    // NVS クローズ
+    if (nvs_open(NVS_NAMESPACE_INFO, NVS_READWRITE, &handle_1) != ESP_OK) {
+        unlock_save();
+        return;
+    }
+    // スロットの内容はそのままで状態だけ書き換える
+    memset(&param, 0x00, sizeof(param));
+    if (load_record(handle_1, active_slot, &param, &hdr) == ESP_OK &&
+        save_record(handle_1, active_slot, &param, hdr.seq, PARAM_REC_STATE_CONFIRMED) == ESP_OK) {
+        nvs_erase_key(handle_1, NVS_KEY_PARAM_TRY);
+        if (nvs_commit(handle_1) == ESP_OK) {
+            active_pending = false;
+            ESP_LOGI(TAG, "%s confirmed (seq %u)\n", param_slot_keys[active_slot], hdr.seq);
+        }
+    }
     nvs_close(handle_1);
+    unlock_save();
+}
 
-    return;
+// NVS書き込みの完了待ち (リブート前に呼ぶ)
+// 書き込み中なら完了するまで待つ。SaveParam()は nvs_commit() まで行うので、戻った時点で書き込みは完了している
+void WaitParamSaved(void)
+{
+    lock_save();
+    unlock_save();
 }
 
 // 設定パラメータの消去
@@ -171,22 +451,61 @@ void ClearParam(void)
 {
     esp_err_t   err;
 
+    lock_save();
+
     nvs_handle handle_1;
     err = nvs_open(NVS_NAMESPACE_INFO, NVS_READWRITE, &handle_1);
     if (err != ESP_OK) {
         // NVS オープン失敗
         ESP_LOGE(TAG, "nvs_open() failed.(%d)\n", err);
+        unlock_save();
         return;
     }
 
-    // serverinfoの下すべてを消去する
-    err = nvs_erase_all(handle_1);
+    // 設定パラメータのキーだけを消去する
+    // (同じnamespaceにある Wi-Fi接続キャッシュや連続起動回数は設定パラメータではないので残す)
+    for (int i = 0; i < PARAM_SLOT_NUM; i++) {
+        err = nvs_erase_key(handle_1, param_slot_keys[i]);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "nvs_erase_key(%s) failed.(%d)\n", param_slot_keys[i], err);
+            // とりあえず続ける
+        }
+    }
+    nvs_erase_key(handle_1, NVS_KEY_PARAM_TRY);
+    erase_legacy(handle_1);
+    err = nvs_commit(handle_1);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "nvs_erase_all() failed.(%d)\n", err);
-        // とりあえず続ける
+        ESP_LOGE(TAG, "nvs_commit() failed.(%d)\n", err);
     }
+    saved_valid    = false;         // 消去したので次回は必ず書き込む
+    active_slot    = -1;
+    active_seq     = 0;
+    active_pending = false;
 
     nvs_close(handle_1);
+    unlock_save();
+
+    if (param_save_hook) {
+        param_save_hook();
+    }
+    return;
+}
+
+// 設定パラメータを工場出荷状態に戻す
+// NVSを消去し、確定済みの値も未設定(空)にする。世代番号は継続して進める
+void ResetParam(void)
+{
+    ClearParam();
+
+    LockParamStage();
+    memset(AppParamStage.ssid_name,      0x00, sizeof(AppParamStage.ssid_name));
+    memset(AppParamStage.ssid_pass,      0x00, sizeof(AppParamStage.ssid_pass));
+    memset(AppParamStage.server_address, 0x00, sizeof(AppParamStage.server_address));
+    AppParamStage.server_port   = 0;
+    AppParamStage.loop_interval = 0;
+    memset(AppParamStage.ap_profile,     0x00, sizeof(AppParamStage.ap_profile));
+    CommitParam();
+    UnlockParamStage();
 
     return;
 }
@@ -198,7 +517,270 @@ void DispParam(struct app_param* pParam)
     printf("    ssid_name     : %s\n", pParam->ssid_name);
     printf("    ssid_pass     : %s\n", pParam->ssid_pass);
     printf("    loop_interval : 0x%08x  (%d)\n", pParam->loop_interval, pParam->loop_interval);
+    for (int i = 0; i < AP_PROFILE_NUM; i++) {
+        const struct ap_profile*    prof = &pParam->ap_profile[i];
+        if (strlen(prof->ssid_name) > 0) {
+            printf("    ap_profile[%d] : %s / %s  (priority %d)\n", i, prof->ssid_name, prof->ssid_pass, prof->priority);
+        }
+    }
+    printf("    generation    : %u  (crc : 0x%08x)\n", pParam->generation, pParam->crc);
     printf("---------------------------------------\n");
 
     return;
-}
\ No newline at end of file
+}
+
+// 編集用バッファに確定済みの値をコピー(編集開始)
+void StageParam(void)
+{
+    if (stage_lock == NULL) {
+        stage_lock = xSemaphoreCreateMutexStatic(&stage_lock_buf);
+    }
+
+    LockParamStage();
+    GetParam(&AppParamStage);
+    UnlockParamStage();
+
+    return;
+}
+
+// 編集用バッファのロック/アンロック
+void LockParamStage(void)
+{
+    if (stage_lock) {
+        xSemaphoreTake(stage_lock, portMAX_DELAY);
+    }
+}
+
+void UnlockParamStage(void)
+{
+    if (stage_lock) {
+        xSemaphoreGive(stage_lock);
+    }
+}
+
+// 設定値のCRC32計算
+// ホストが同じ値を計算できるよう、パラメータブロブに変換した内容に対して計算する
+// (zlib.crc32() と同じ値になる)
+uint32_t CalcParamCrc(const struct app_param* pParam)
+{
+    uint8_t     buf[PARAM_BLOB_MAX_LEN];
+    int         len = param_blob_encode(pParam, buf, sizeof(buf));
+    if (len < 0) {
+        return 0;
+    }
+    return esp_rom_crc32_le(0, buf, len);
+}
+
+// 変更された項目の取得
+// return : PARAM_FIELD_xxx の論理和
+static uint32_t changed_fields(const struct app_param* pOld, const struct app_param* pNew)
+{
+    uint32_t    fields = 0;
+
+    if (strcmp(pOld->ssid_name, pNew->ssid_name) != 0) {
+        fields |= PARAM_FIELD_SSID_NAME;
+    }
+    if (strcmp(pOld->ssid_pass, pNew->ssid_pass) != 0) {
+        fields |= PARAM_FIELD_SSID_PASS;
+    }
+    if (pOld->loop_interval != pNew->loop_interval) {
+        fields |= PARAM_FIELD_LOOP_INTERVAL;
+    }
+    if (memcmp(pOld->ap_profile, pNew->ap_profile, sizeof(pNew->ap_profile)) != 0) {
+        fields |= PARAM_FIELD_AP_PROFILE;
+    }
+    return fields;
+}
+
+// 変更通知先への通知
+// 登録テーブルをコピーしてから通知する(クリティカルセクション内でキュー操作しないため)
+// キューが一杯の場合、その通知先への通知は捨てる(確定処理を止めない)
+static void notify_subscribers(uint32_t fields, uint32_t generation)
+{
+    struct param_subscriber     subs[PARAM_SUBSCRIBER_MAX];
+    struct app_param_event      event = { .fields = 0, .generation = generation };
+    int                         num;
+
+    // 通知先の選択だけクリティカルセクション内で行い、通知はその外で行う
+    portENTER_CRITICAL(&subscriber_mux);
+    num = param_subscriber_collect(param_subscribers, fields, subs);
+    portEXIT_CRITICAL(&subscriber_mux);
+
+    for (int i = 0; i < num; i++) {
+        event.fields = subs[i].fields;
+        if (subs[i].queue) {
+            if (xQueueSend(subs[i].queue, &event, 0) != pdTRUE) {
+                ESP_LOGW(TAG, "subscriber queue full\n");
+            }
+        }
+        else if (subs[i].task) {
+            xTaskNotify(subs[i].task, event.fields, eSetBits);
+        }
+    }
+}
+
+// 編集用バッファの値を確定 (LockParamStage()した状態で呼ぶこと)
+// 他タスクからは更新前か更新後のどちらかの値だけが見える
+// 内容が変わっていなければ世代番号は進めず、変更通知も行わない
+// 書き込み側は LockParamStage() で直列化されているので、ここでの AppParam の参照はロック不要
+void CommitParam(void)
+{
+    bool        changed;
+    uint32_t    fields;
+    uint32_t    generation;
+
+    AppParamStage.crc = CalcParamCrc(&AppParamStage);
+    changed = (AppParamStage.crc != AppParam.crc);
+    fields  = changed ? changed_fields(&AppParam, &AppParamStage) : 0;
+    AppParamStage.generation = AppParam.generation + (changed ? 1 : 0);
+    generation = AppParamStage.generation;
+
+    portENTER_CRITICAL(&param_mux);
+    param_seqlock_write_begin(&param_lock);
+    memcpy(&AppParam, &AppParamStage, sizeof(AppParam));
+    param_seqlock_write_end(&param_lock);
+    portEXIT_CRITICAL(&param_mux);
+
+    // 変更を通知
+    if (changed && param_change_hook) {
+        param_change_hook(generation);
+    }
+    if (fields) {
+        notify_subscribers(fields, generation);
+    }
+
+    return;
+}
+
+// NVSから読み直して確定 (コンソールからの消去/再読み込み用)
+bool ReloadParam(void)
+{
+    bool    ret;
+
+    LockParamStage();
+    GetParam(&AppParamStage);
+    ret = LoadParam(&AppParamStage);
+    CommitParam();
+    UnlockParamStage();
+
+    return ret;
+}
+
+// 世代番号の取得
+uint32_t GetParamGeneration(void)
+{
+    uint32_t    generation;
+    uint32_t    seq;
+
+    do {
+        seq = param_seqlock_read_begin(&param_lock);
+        generation = AppParam.generation;
+    } while (param_seqlock_read_retry(&param_lock, seq));
+
+    return generation;
+}
+
+// 世代番号/CRCの取得 (GetParam()と違い構造体全体をコピーしないので、スタックの小さいタスクからも呼べる)
+void GetParamGenCrc(uint32_t* pGeneration, uint32_t* pCrc)
+{
+    uint32_t    seq;
+
+    do {
+        seq = param_seqlock_read_begin(&param_lock);
+        *pGeneration = AppParam.generation;
+        *pCrc        = AppParam.crc;
+    } while (param_seqlock_read_retry(&param_lock, seq));
+}
+
+// 接続先(SSID)が設定済みか (GetParam()と違い構造体全体をコピーしない)
+bool IsParamProvisioned(void)
+{
+    uint32_t    seq;
+    bool        provisioned;
+
+    do {
+        seq = param_seqlock_read_begin(&param_lock);
+        provisioned = (AppParam.ssid_name[0] != '\0');
+    } while (param_seqlock_read_retry(&param_lock, seq));
+    return provisioned;
+}
+
+// NVSに保存済みか (確定済みの値が最後に書き込んだ/読んだレコードと一致するか)
+bool IsParamSaved(void)
+{
+    uint32_t    generation;
+    uint32_t    crc;
+    bool        saved;
+
+    GetParamGenCrc(&generation, &crc);
+    portENTER_CRITICAL(&param_mux);
+    saved = saved_valid && saved_crc == crc && saved_generation == generation;
+    portEXIT_CRITICAL(&param_mux);
+    return saved;
+}
+
+// NVSへの保存/消去時に呼び出す関数の登録
+void SetParamSaveHook(void (*hook)(void))
+{
+    param_save_hook = hook;
+}
+
+// 確定時に呼び出す関数の登録
+void SetParamChangeHook(void (*hook)(uint32_t generation))
+{
+    param_change_hook = hook;
+}
+
+// 変更通知先の登録(共通)
+// return : 登録ID (UnsubscribeParam()で使う)   空きがなければ -1
+static int add_subscriber(uint32_t fields, QueueHandle_t queue, TaskHandle_t task)
+{
+    int     id;
+
+    portENTER_CRITICAL(&subscriber_mux);
+    id = param_subscriber_add(param_subscribers, fields, queue, task);
+    portEXIT_CRITICAL(&subscriber_mux);
+
+    if (id < 0) {
+        ESP_LOGE(TAG, "no free subscriber slot\n");
+    }
+    return id;
+}
+
+// 変更通知先の登録 (キューで通知)
+// 確定時に fields の項目が変わっていたら struct app_param_event をキューに送る
+// return : 登録ID   空きがなければ -1
+int SubscribeParam(uint32_t fields, QueueHandle_t queue)
+{
+    if (queue == NULL) {
+        return -1;
+    }
+    return add_subscriber(fields, queue, NULL);
+}
+
+// 変更通知先の登録 (タスク通知で通知)
+// 確定時に fields の項目が変わっていたら、変更項目のビットを通知値にセットする (xTaskNotifyWait()で受け取る)
+// return : 登録ID   空きがなければ -1
+int SubscribeParamNotify(uint32_t fields, TaskHandle_t task)
+{
+    if (task == NULL) {
+        return -1;
+    }
+    return add_subscriber(fields, NULL, task);
+}
+
+// 変更通知先の登録解除
+void UnsubscribeParam(int id)
+{
+    portENTER_CRITICAL(&subscriber_mux);
+    param_subscriber_remove(param_subscribers, id);
+    portEXIT_CRITICAL(&subscriber_mux);
+}
+
+// 確定済みの値を取得 (どのタスクから呼んでもよい。ロックは取らない)
+// 更新途中の値が見えることはない
+void GetParam(struct app_param* pParam)
+{
+    param_seqlock_read(&param_lock, pParam, &AppParam, sizeof(*pParam));
+    return;
+}
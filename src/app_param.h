@@ -6,12 +6,25 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include    "freertos/FreeRTOS.h"
+#include    "freertos/task.h"
+#include    "freertos/queue.h"
+
 
 // 文字列最大長
-#define     SSID_NAME_SIZE      16
-#define     SSID_PASS_SIZE      16
+#define     SSID_NAME_SIZE      33          // SSID最大32文字 + NULL文字
+#define     SSID_PASS_SIZE      65          // WPA2パスフレーズ最大63文字(PSKなら64桁) + NULL文字
 #define     SVR_ADDR_SIZE       64
 
+// 接続先(AP)プロファイル
+#define     AP_PROFILE_NUM          4           // ssid_name/ssid_pass 以外に登録できる接続先の数
+#define     AP_PROFILE_PRIO_PRIMARY 128         // ssid_name/ssid_pass の優先度 (大きい方を優先する)
+struct ap_profile {
+    char        ssid_name[SSID_NAME_SIZE];      // 空文字列なら未使用
+    char        ssid_pass[SSID_PASS_SIZE];
+    uint8_t     priority;                   // 優先度 (優先度が同じならRSSIの強い方を優先する)
+};
+
 
 // NVS namespave/key
 #define     NVS_NAMESPACE_INFO      "app_param"
@@ -20,6 +33,34 @@
 #define     NVS_KEY_SVR_ADDR        "svr_addr"
 #define     NVS_KEY_SVR_PORT        "svr_port"
 #define     NVS_KEY_FWSVR_ADDR      "loop_itvl"
+#define     NVS_KEY_PARAM_GEN       "param_gen"
+#define     NVS_KEY_PARAM_SLOT_A    "param_a"           // 全項目をまとめたレコード スロットA (これ以外のキーは旧形式)
+#define     NVS_KEY_PARAM_SLOT_B    "param_b"           // 全項目をまとめたレコード スロットB
+#define     NVS_KEY_PARAM_TRY       "param_try"         // 未確認スロットでの起動回数
+
+// 設定パラメータレコード
+/*
+    NVSには struct param_rec_hdr + パラメータブロブ(param_blob.h) を1個のblobとして保存する
+    A/B 2つのスロットを交互に使い、有効でシーケンス番号の新しい方を使用する
+    新しく書き込んだスロットは未確認(PENDING)で、IPアドレスを取得できたら確認済み(CONFIRMED)にする
+    確認前にもう一度書き込む場合は未確認のスロットを上書きし、確認済みのスロットはロールバック先として残す
+    未確認のまま PARAM_BOOT_TRY_MAX 回起動したら、もう一方のスロットに戻す(ロールバック)
+    crc はヘッダのcrcより前の部分とパラメータブロブ部分のCRC32
+*/
+#define     PARAM_SLOT_NUM              2
+#define     PARAM_REC_VERSION           2
+#define     PARAM_REC_MAX_LEN           (sizeof(struct param_rec_hdr) + PARAM_BLOB_MAX_LEN)
+#define     PARAM_REC_STATE_PENDING     0x00            // 未確認
+#define     PARAM_REC_STATE_CONFIRMED   0x01            // 確認済み(この設定でIPアドレスを取得できた)
+#define     PARAM_BOOT_TRY_MAX          3               // 未確認スロットで起動できる回数
+struct param_rec_hdr {
+    uint8_t     version;                    // レコードのバージョン (PARAM_REC_VERSION)
+    uint8_t     state;                      // PARAM_REC_STATE_xxx
+    uint16_t    length;                     // パラメータブロブ部分の長さ
+    uint32_t    seq;                        // シーケンス番号(書き込む度にインクリメント)
+    uint32_t    generation;                 // 世代番号
+    uint32_t    crc;                        // CRC32
+};
 
 
 // 設定パラメータ構造体
@@ -29,15 +70,55 @@ struct app_param {
     char        server_address[SVR_ADDR_SIZE];
     uint16_t    server_port;
     uint32_t    loop_interval;
+    struct ap_profile   ap_profile[AP_PROFILE_NUM];     // 追加の接続先 (移動先の建物のAPなど)
+    // ---- ここから下は設定値ではなく管理情報 ----
+    uint32_t    generation;                 // 世代番号(内容が変わって確定する度にインクリメント)
+    uint32_t    crc;                        // 設定値のCRC32 (パラメータブロブに変換した内容に対して計算)
 };
 
 
 
+// 変更通知
+// 項目ビット (SubscribeParam()の対象指定/通知される変更項目)
+#define     PARAM_FIELD_SSID_NAME       (1 << 0)
+#define     PARAM_FIELD_SSID_PASS       (1 << 1)
+#define     PARAM_FIELD_LOOP_INTERVAL   (1 << 2)
+#define     PARAM_FIELD_AP_PROFILE      (1 << 3)
+#define     PARAM_FIELD_ALL             (PARAM_FIELD_SSID_NAME | PARAM_FIELD_SSID_PASS | PARAM_FIELD_LOOP_INTERVAL | PARAM_FIELD_AP_PROFILE)
+
+#define     PARAM_SUBSCRIBER_MAX        8           // 登録できる通知先の数
+
+// キューで通知する場合のイベント (キューのアイテムサイズは sizeof(struct app_param_event) にすること)
+struct app_param_event {
+    uint32_t    fields;                     // 変更された項目 (PARAM_FIELD_xxx の論理和)
+    uint32_t    generation;                 // 変更後の世代番号
+};
+
 // 設定パラメータ
-extern struct app_param            AppParam;
+extern struct app_param            AppParam;            // 確定済みの値(参照は GetParam() で行うこと。直接参照すると更新途中の値が見えることがある)
+extern struct app_param            AppParamStage;       // 編集中の値(BLEからの書き込みはこちらに行う)
 
 extern bool LoadParam(struct app_param* pParam);
-extern void SaveParam(struct app_param* pParam);
+extern bool SaveParam(struct app_param* pParam);
+extern void WaitParamSaved(void);
+extern void ConfirmParam(void);
 extern void ClearParam(void);
+extern void ResetParam(void);
 extern void DispParam(struct app_param* pParam);
+extern void StageParam(void);
+extern void CommitParam(void);
+extern void GetParam(struct app_param* pParam);
+extern void LockParamStage(void);
+extern void UnlockParamStage(void);
+extern bool ReloadParam(void);
+extern uint32_t GetParamGeneration(void);
+extern void GetParamGenCrc(uint32_t* pGeneration, uint32_t* pCrc);
+extern uint32_t CalcParamCrc(const struct app_param* pParam);
+extern void SetParamChangeHook(void (*hook)(uint32_t generation));
+extern bool IsParamProvisioned(void);
+extern bool IsParamSaved(void);
+extern void SetParamSaveHook(void (*hook)(void));
+extern int  SubscribeParam(uint32_t fields, QueueHandle_t queue);
+extern int  SubscribeParamNotify(uint32_t fields, TaskHandle_t task);
+extern void UnsubscribeParam(int id);
 
@@ -13,6 +13,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -22,17 +23,22 @@
 #include "esp_gatts_api.h"
 #include "esp_bt_defs.h"
 #include "esp_bt_main.h"
+#include "esp_gatt_common_api.h"
+#include "esp_coexist.h"
 
 #include "BLE_PARAM_CONFIG.h"
 
 #include    "uart_console.h"
+#include    "boot_prof.h"
 
 // LOG表示用TAG(関数名にしておく)
 #define     TAG             __func__
 
 // マニファクチャデータ
-uint8_t   manufacturer_data[3] = {'E', 'S', 'P'};   // 最初の2バイトがCompanyId。以下マニファクチャ固有データ
-                                                    // この設定値は例としてあまり良くないかも。
+uint8_t   manufacturer_data[MANUFACTURER_DATA_LEN] = {'E', 'S', MANUFACTURER_DATA_VERSION};
+                                                                        // 最初の2バイトがCompanyId。以下マニファクチャ固有データ
+                                                                        // この設定値は例としてあまり良くないかも。
+                                                                        // 状態フラグ以降は update_manufacturer_data() で設定
 
 // GATTインタフェース-コールバック関数対応付け用テーブル
 struct gatts_profile_inst profile_tab[PROFILE_NUM] = {
@@ -43,66 +49,117 @@ struct gatts_profile_inst profile_tab[PROFILE_NUM] = {
     },
 };
 
+// サービスタスク
+static TaskHandle_t         ble_service_task_handle = NULL;
+static StaticSemaphore_t    ble_service_done_buf;
+static SemaphoreHandle_t    ble_service_done = NULL;        // 開始/停止処理の完了通知
+static StaticEventGroup_t   ble_service_evt_buf;
+static EventGroupHandle_t   ble_service_evt  = NULL;        // 切断/advertising停止の完了通知 (BLE_SERVICE_EVT_xxx)
+static bool                 ble_initialized  = false;       // BLEスタック初期化済み
+static volatile bool        ble_running      = false;       // サービス動作中 (advertising/接続受付中)
+static bool                 ble_classic_released = false;   // Bluetooth classic用メモリ解放済み (2回解放するとエラーになる)
+static bool                 ble_mem_released = false;       // BTのメモリを全て解放済み (このブート中はもう初期化できない)
+
+// ================================================================================================
+// BLEスタック初期化失敗時の巻き戻し
+// 途中で失敗したまま残すと、次の ble_init() が ESP_ERR_INVALID_STATE で失敗し続けるので、
+// 成功した段階まで逆順に無効化/解放する
+// ================================================================================================
+static void ble_init_unwind(int stage)
+{
+    if (stage >= BLE_INIT_STAGE_BLUEDROID_ENABLE) {
+        esp_bluedroid_disable();
+    }
+    if (stage >= BLE_INIT_STAGE_BLUEDROID_INIT) {
+        esp_bluedroid_deinit();
+    }
+    if (stage >= BLE_INIT_STAGE_CTRL_ENABLE) {
+        esp_bt_controller_disable();
+    }
+    if (stage >= BLE_INIT_STAGE_CTRL_INIT) {
+        esp_bt_controller_deinit();
+    }
+    for (int i = 0; i < PROFILE_NUM; i++) {
+        profile_tab[i].gatts_if = ESP_GATT_IF_NONE;
+    }
+}
+
 // ================================================================================================
-// メインルーチン
+// BLEスタックの初期化
+// 失敗した場合はスタックを初期化前の状態に戻してから返る(再度 ble_init() できる)
 // ================================================================================================
-void ble_main(void)
+static esp_err_t ble_init(void)
 {
     esp_err_t ret;
 
     ESP_LOGI(TAG, "==== init bluetooth ====================");
 
-    // Bluetooth classicモードのメモリ解放
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+    // Bluetooth classicモードのメモリ解放 (停止後の再初期化では解放済み)
+    if (!ble_classic_released) {
+        ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+        ble_classic_released = true;
+    }
 
     // コントローラ初期化
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();        // コンフィグレーション構造体の初期化
     ret = esp_bt_controller_init(&bt_cfg);
     if (ret) {
         ESP_LOGE(TAG, "%s init controller failed: %s", __func__, esp_err_to_name(ret));
-        return;
+        return ret;
     }
 
     // コントローラの有効化
     ret = esp_bt_controller_enable(ESP_BT_MODE_BLE);
     if (ret) {
         ESP_LOGE(TAG, "%s enable controller failed: %s", __func__, esp_err_to_name(ret));
-        return;
+        ble_init_unwind(BLE_INIT_STAGE_CTRL_INIT);
+        return ret;
     }
 
     // プロトコルスタックの初期化
     ret = esp_bluedroid_init();
     if (ret) {
         ESP_LOGE(TAG, "%s init bluetooth failed: %s", __func__, esp_err_to_name(ret));
-        return;
+        ble_init_unwind(BLE_INIT_STAGE_CTRL_ENABLE);
+        return ret;
     }
 
     // プロトコルスタックの有効化
     ret = esp_bluedroid_enable();
     if (ret) {
         ESP_LOGE(TAG, "%s enable bluetooth failed: %s", __func__, esp_err_to_name(ret));
-        return;
+        ble_init_unwind(BLE_INIT_STAGE_BLUEDROID_INIT);
+        return ret;
     }
 
     // GATTサーバのコールバックの登録
     ret = esp_ble_gatts_register_callback(gatts_event_handler);
     if (ret){
         ESP_LOGE(TAG, "gatts register error, error code = %x", ret);
-        return;
+        ble_init_unwind(BLE_INIT_STAGE_BLUEDROID_ENABLE);
+        return ret;
     }
 
     // GAPのコールバックの登録
     ret = esp_ble_gap_register_callback(gap_event_handler);
     if (ret){
         ESP_LOGE(TAG, "gap register error, error code = %x", ret);
-        return;
+        ble_init_unwind(BLE_INIT_STAGE_BLUEDROID_ENABLE);
+        return ret;
     }
 
     // アプリケーションIDの登録
     ret = esp_ble_gatts_app_register(ESP_PARAM_CONFIG_APP_ID);
     if (ret){
         ESP_LOGE(TAG, "gatts app register error, error code = %x", ret);
-        return;
+        ble_init_unwind(BLE_INIT_STAGE_BLUEDROID_ENABLE);
+        return ret;
+    }
+
+    // ローカルMTUの設定 (実際のMTUは接続後のMTU交換で決まる)
+    ret = esp_ble_gatt_set_local_mtu(PARAM_CONFIG_LOCAL_MTU);
+    if (ret){
+        ESP_LOGE(TAG, "set local MTU failed, error code = %x", ret);
     }
 
     // ============================================================================================
@@ -118,7 +175,11 @@ void ble_main(void)
           ESP_LE_AUTH_REQ_SC_MITM:      Secure Connections with MITM Protection and no bonding enabled.     暗号化はするが、鍵の保存はしない
           ESP_LE_AUTH_REQ_SC_MITM_BOND  Secure Connections with MITM Protection and bonding enabled.        デフォルト？
     */
+#if BLE_BONDED_MODE
+    esp_ble_auth_req_t auth_req = ESP_LE_AUTH_REQ_SC_MITM_BOND;     // 鍵を保存して、次回からはペアリングを省略する
+#else
     esp_ble_auth_req_t auth_req = ESP_LE_AUTH_REQ_SC_MITM;
+#endif
     esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(esp_ble_auth_req_t));
 
     // ペアリング時の動作＝入力なし、出力なし
@@ -175,84 +236,210 @@ void ble_main(void)
     // ここまで secure connection の設定
     // ============================================================================================
     ESP_LOGI(TAG, "==== end of BLE setting ====================");
+    return ESP_OK;
+}
+
+// ================================================================================================
+// BLEスタックの停止
+// 初期化の逆順に無効化/解放する。停止後は ble_init() で再初期化できる
+// ================================================================================================
+static void ble_deinit(void)
+{
+    uint32_t    heap_before = esp_get_free_heap_size();
+    esp_err_t   ret;
+
+    ESP_LOGI(TAG, "==== deinit bluetooth ====================");
+
+    // プロトコルスタックの無効化/解放 (接続中のリンクもここで切れる)
+    ret = esp_bluedroid_disable();
+    if (ret) {
+        ESP_LOGE(TAG, "%s disable bluetooth failed: %s", __func__, esp_err_to_name(ret));
+    }
+    ret = esp_bluedroid_deinit();
+    if (ret) {
+        ESP_LOGE(TAG, "%s deinit bluetooth failed: %s", __func__, esp_err_to_name(ret));
+    }
+
+    // コントローラの無効化/解放
+    ret = esp_bt_controller_disable();
+    if (ret) {
+        ESP_LOGE(TAG, "%s disable controller failed: %s", __func__, esp_err_to_name(ret));
+    }
+    ret = esp_bt_controller_deinit();
+    if (ret) {
+        ESP_LOGE(TAG, "%s deinit controller failed: %s", __func__, esp_err_to_name(ret));
+    }
+
+    // 再初期化に備えて状態を戻す
+    for (int i = 0; i < PROFILE_NUM; i++) {
+        profile_tab[i].gatts_if = ESP_GATT_IF_NONE;
+    }
+    param_config_deinit();
+    reset_advertising_state();
+    ble_initialized = false;
+
+    ESP_LOGI(TAG, "    free heap %d -> %d (+%d bytes)",
+             (int)heap_before, (int)esp_get_free_heap_size(), (int)(esp_get_free_heap_size() - heap_before));
+}
+
+// ================================================================================================
+// サービスタスク
+// 開始/停止要求(タスク通知)を受けて処理する。BLEの処理自体はBTCタスクのコールバックで行われるので、
+// このタスクは要求待ちで止まっているだけで、メイン処理やWi-Fiの動作を妨げない
+// ================================================================================================
+static void ble_service_task(void* arg)
+{
+    uint32_t    req;
 
     while (1) {
-        vTaskDelay(1000 / portTICK_PERIOD_MS);          // 1秒待つ
-        int in_key = uart_getchar_nowait();
-        if (in_key == 'q') {
-            // qが入力されたらループを抜ける
-            break;
+        xTaskNotifyWait(0, UINT32_MAX, &req, portMAX_DELAY);
+
+        if ((req & BLE_SERVICE_REQ_START) && ble_running && advertising_is_idle()) {
+            // タイムアウトで止まっているadvertisingを再開
+            resume_advertising();
         }
-        else if (in_key == 'd') {
-            // dが入力されたら切断する(接続されているかはcall先でチェック)
-            param_config_disconnect();
+        else if ((req & BLE_SERVICE_REQ_START) && !ble_running) {
+            // Wi-Fiと同時に動かすので、どちらかに偏らないようにする
+            esp_coex_preference_set(ESP_COEX_PREFER_BALANCE);
+            if (!ble_initialized) {
+                // 初回はスタックを初期化する (advertisingはGATTの登録完了後に開始される)
+                if (ble_init() == ESP_OK) {
+                    ble_initialized = true;
+                    ble_running     = true;
+                    BOOT_PROF_MARK("ble_init");
+                }
+            }
+            else {
+                StageParam();                       // 停止中に変わった値を編集用バッファに反映
+                resume_advertising();
+                ble_running = true;
+            }
         }
-        else if (in_key == 'p') {
-            // pが入力されたら変数一覧を表示
-            DispParam(&AppParam);
+        else if ((req & BLE_SERVICE_REQ_STOP) && ble_running) {
+            EventBits_t     wait_bits = 0;
+            xEventGroupClearBits(ble_service_evt, BLE_SERVICE_EVT_DISCONNECTED | BLE_SERVICE_EVT_ADV_STOPPED);
+
+            // Advertising 停止 (切断後に再開しないよう、切断より先にフラグを落とす)
+            ESP_LOGI(TAG, "==== Stop advertising ====================");
+            if (stop_advertising() == ESP_OK) {
+                wait_bits |= BLE_SERVICE_EVT_ADV_STOPPED;
+            }
+            ble_running = false;
+
+            // 切断する(接続されているかはcall先でチェック)
+            if (param_config_disconnect()) {
+                wait_bits |= BLE_SERVICE_EVT_DISCONNECTED;
+            }
+
+            // 未確定の書き込みがあれば確定する
+            param_config_commit();
+
+            // 切断/advertising停止の完了を待ってからスタックを止める (BTCタスクで処理中のイベントを残さないため)
+            if (wait_bits != 0) {
+                EventBits_t bits = xEventGroupWaitBits(ble_service_evt, wait_bits, pdFALSE, pdTRUE,
+                                                       pdMS_TO_TICKS(BLE_SERVICE_STOP_TIMEOUT_MS));
+                if ((bits & wait_bits) != wait_bits) {
+                    ESP_LOGW(TAG, "stop timeout (0x%x). deinit anyway", (unsigned)(wait_bits & ~bits));
+                }
+            }
+
+            // スタックを止めてメモリを返す
+            ble_deinit();
+            esp_coex_preference_set(ESP_COEX_PREFER_WIFI);
         }
+        xSemaphoreGive(ble_service_done);
     }
-    ESP_LOGI(TAG, "==== Escaped from the loop ====================");
+}
 
-    // 切断する(接続されているかはcall先でチェック)
-    param_config_disconnect();
+// ================================================================================================
+// 要求を送って完了を待つ
+// ================================================================================================
+static esp_err_t ble_service_request(uint32_t req)
+{
+    if (ble_service_task_handle == NULL) {
+        ble_service_done = xSemaphoreCreateBinaryStatic(&ble_service_done_buf);
+        ble_service_evt  = xEventGroupCreateStatic(&ble_service_evt_buf);
+        if (xTaskCreate(ble_service_task, "ble_service", BLE_SERVICE_TASK_STACK_SIZE, NULL,
+                        BLE_SERVICE_TASK_PRIORITY, &ble_service_task_handle) != pdPASS) {
+            ESP_LOGE(TAG, "xTaskCreate failed.");
+            ble_service_task_handle = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    xTaskNotify(ble_service_task_handle, req, eSetBits);
+    xSemaphoreTake(ble_service_done, portMAX_DELAY);
+    return ESP_OK;
+}
 
-    // Advertising 停止
-    ESP_LOGI(TAG, "==== Stop advertising ====================");
-    stop_advertising();
+// ================================================================================================
+// BLEによる設定サービスの開始
+// 戻った時点でBLEスタックの初期化は終わっている(advertisingは少し後に始まる)。呼び出し元はそのまま処理を続けてよい
+// ================================================================================================
+esp_err_t ble_service_start(void)
+{
+    if (ble_mem_released) {
+        return ESP_ERR_INVALID_STATE;   // メモリ解放済み (設定モードでリブートする必要がある)
+    }
+    esp_err_t   ret = ble_service_request(BLE_SERVICE_REQ_START);
+    if (ret == ESP_OK && !ble_running) {
+        ret = ESP_FAIL;             // BLEスタックの初期化失敗
+    }
+    return ret;
+}
+
+// ================================================================================================
+// BLEによる設定サービスの停止 (接続中なら切断し、未確定の書き込みは確定する)
+// ================================================================================================
+void ble_service_stop(void)
+{
+    if (ble_service_task_handle == NULL) {
+        return;                     // 開始していない
+    }
+    ble_service_request(BLE_SERVICE_REQ_STOP);
+#if BLE_SERVICE_RELEASE_MEM_ON_STOP
+    ble_service_release_mem();
+#endif
+}
 
-    // 後処理
-    printf("Hit 'L' key for list bonded devices, \n");
-    printf("Hit 'C' key for clear bonded devices, \n");
-    printf("Hit 'p' key for print AppParam, \n");
-    printf("Hit 's' key for Save  AppParam, \n");
-    printf("Hit 'c' key for Clear AppParam, \n");
-    printf("Hit 'r' key for system reboot... \n");
-    printf("Hit 'q' key for go to main processing \n");
+// ================================================================================================
+// BTコントローラ/Bluedroidのメモリ解放
+// このブート中に設定を行わない場合に呼ぶ(通常起動時や設定完了後)。解放後は ble_service_start() できない
+// ================================================================================================
+esp_err_t ble_service_release_mem(void)
+{
+    if (ble_mem_released) {
+        return ESP_OK;
+    }
+    if (ble_running || esp_bt_controller_get_status() != ESP_BT_CONTROLLER_STATUS_IDLE) {
+        return ESP_ERR_INVALID_STATE;   // 動作中 (先に ble_service_stop() する)
+    }
 
-    bool    term_flag = false;
-    while (1) {
-        // 終了後の無限ループ
-        int in_key = uart_getchar_nowait();
-        switch (in_key) {
-          case 'q' :
-            // qが入力されたらループを抜ける
-            term_flag = true;
-            break;
-          case 'r' :
-            // rが入力されたらreboot
-            esp_restart();
-            break;
-          case 'p' :
-            // pが入力されたら変数一覧を表示
-            DispParam(&AppParam);
-            break;
-          case 's' :
-            // sが入力されたら変数をnvsに保存
-            SaveParam(&AppParam);
-            break;
-          case 'c' :
-            // cが入力されたらnvs上の変数を削除
-            ClearParam();
-            LoadParam(&AppParam);
-            break;
-          case 'L' :
-            // ボンディング済みデバイスを表示
-            show_bonded_devices();
-            break;
-          case 'C' :
-            // ボンディング済みデバイスをすべて削除
-            remove_all_bonded_devices();
-            break;
-        }
-        if (term_flag) {
-            // 終了フラグ
-            break;
-        }
+    uint32_t    heap_before = esp_get_free_heap_size();
+    esp_err_t   ret = esp_bt_mem_release(ESP_BT_MODE_BTDM);     // コントローラとBluedroid両方のメモリを解放
+    if (ret) {
+        ESP_LOGE(TAG, "esp_bt_mem_release failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    ble_mem_released = true;
+    ESP_LOGI(TAG, "==== BT memory released: free heap %d -> %d (+%d bytes)",
+             (int)heap_before, (int)esp_get_free_heap_size(), (int)(esp_get_free_heap_size() - heap_before));
+    return ESP_OK;
+}
 
-        // Task watchdog のトリガを防止するため、vTaskDelay()をコールしておく
-        vTaskDelay(1000 / portTICK_PERIOD_MS);          // 1秒待つ
+// ================================================================================================
+// 切断/advertising停止の完了通知 (BTCタスクのコールバックから呼ぶ。evt : BLE_SERVICE_EVT_xxx)
+// ================================================================================================
+void ble_service_notify(uint32_t evt)
+{
+    if (ble_service_evt) {
+        xEventGroupSetBits(ble_service_evt, evt);
     }
+}
 
-    return;
+// ================================================================================================
+// BLEによる設定サービスが動作中か
+// ================================================================================================
+bool ble_service_is_running(void)
+{
+    return ble_running;
 }
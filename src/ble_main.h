@@ -50,12 +50,63 @@ struct gatts_profile_inst {
 #endif
 };
 
+// マニファクチャデータ (デバイスの状態レコード)
+/*
+    [0-1]   CompanyId ('E', 'S')
+    [2]     フォーマットバージョン (MANUFACTURER_DATA_VERSION。旧フォーマットはここが 'P')
+    [3]     状態フラグ (MANUFACTURER_FLAG_xxx)
+    [4]     Wi-Fiの最後の切断理由 (wifi_err_reason_t。切断されたことがなければ0)
+    [5-8]   設定パラメータの世代番号 (リトルエンディアン)
+    [9-12]  設定パラメータのCRC32   (リトルエンディアン)
+    [13-15] デバイスID (Wi-Fi STAのMACアドレスの下位3バイト。BLEはランダムアドレスなのでこちらで個体を識別する)
+    ホストは接続せずに状態を確認でき、キャッシュしている世代番号/CRCと一致すれば接続を省略できる
+    状態が変わったときだけ scan response を設定し直す
+    scan response には先頭にこのデータを入れ、残りにデバイス名を入れる(入りきらなければ短縮名になる)
+*/
+#define MANUFACTURER_DATA_LEN           16
+#define MANUFACTURER_DATA_VERSION       0x02
+#define MANUFACTURER_DATA_POS_VERSION   2
+#define MANUFACTURER_DATA_POS_FLAGS     3
+#define MANUFACTURER_DATA_POS_REASON    4
+#define MANUFACTURER_DATA_POS_GEN       5
+#define MANUFACTURER_DATA_POS_CRC       9
+#define MANUFACTURER_DATA_POS_ID        13
+#define MANUFACTURER_DATA_ID_LEN        3
+
+#define MANUFACTURER_FLAG_PROVISIONED       0x01    // 接続先(SSID)が設定されている
+#define MANUFACTURER_FLAG_WIFI_CONNECTED    0x02    // Wi-Fi接続中(IPアドレス取得済み)
+#define MANUFACTURER_FLAG_WIFI_FAILED       0x04    // Wi-Fi接続がリトライ回数に達した(再接続は続けている)
+#define MANUFACTURER_FLAG_SAVED             0x08    // 確定済みの設定パラメータがNVSに保存されている(世代番号/CRCが保存内容と一致)
+
+// 設定サービスタスク
+#define BLE_SERVICE_TASK_STACK_SIZE     4096            // BLEスタック初期化を行うので大きめ
+#define BLE_SERVICE_TASK_PRIORITY       5
+#define BLE_SERVICE_REQ_START           (1 << 0)        // 開始要求 (タスク通知のビット)
+#define BLE_SERVICE_REQ_STOP            (1 << 1)        // 停止要求
+#define BLE_SERVICE_EVT_DISCONNECTED    (1 << 0)        // 切断完了 (停止処理の完了待ち用イベントビット)
+#define BLE_SERVICE_EVT_ADV_STOPPED     (1 << 1)        // advertising停止完了
+#define BLE_SERVICE_STOP_TIMEOUT_MS     3000            // 停止処理で切断/advertising停止の完了を待つ時間
+#define BLE_BONDED_MODE                 0               // 1: ボンディングモード (ペアリングしたホストを記憶し、以降はそのホストからの接続だけ受け付ける)
+                                                        //    新しいホストをペアリングするときは open_pairing() (コンソールの'O')で受付を開く
+#define BLE_SERVICE_RELEASE_MEM_ON_STOP 1               // 1: 停止時にBTのメモリを解放する(以降このブート中は再開できない。再開するには設定モードでリブート)
+                                                        // 0: 解放せずに残す(停止後も ble_service_start() で再初期化できる)
+
+// BLEスタックの初期化段階 (初期化失敗時にどこまで巻き戻すか。その段階まで成功している)
+#define BLE_INIT_STAGE_CTRL_INIT        1               // esp_bt_controller_init()
+#define BLE_INIT_STAGE_CTRL_ENABLE      2               // esp_bt_controller_enable()
+#define BLE_INIT_STAGE_BLUEDROID_INIT   3               // esp_bluedroid_init()
+#define BLE_INIT_STAGE_BLUEDROID_ENABLE 4               // esp_bluedroid_enable()
+
 // ==== extern宣言 ======================================================================================
-extern uint8_t      manufacturer_data[3];                  // 参照先でsizeof()を使いたいのでサイズも指定
+extern uint8_t      manufacturer_data[MANUFACTURER_DATA_LEN];  // 参照先でsizeof()を使いたいのでサイズも指定
 extern struct       gatts_profile_inst profile_tab[];
 
 
-extern void ble_main(void);
+extern esp_err_t    ble_service_start(void);
+extern void         ble_service_stop(void);
+extern bool         ble_service_is_running(void);
+extern esp_err_t    ble_service_release_mem(void);
+extern void         ble_service_notify(uint32_t evt);
 
 
 // プロファイル関連設定
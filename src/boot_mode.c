@@ -0,0 +1,130 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    "freertos/FreeRTOS.h"
+#include    "freertos/task.h"
+#include    "freertos/timers.h"
+#include    "esp_log.h"
+#include    "esp_err.h"
+#include    "esp_attr.h"
+#include    "esp_system.h"
+#include    "nvs_flash.h"
+#include    "driver/gpio.h"
+
+#include    "app_param.h"
+#include    "boot_mode.h"
+
+// LOG表示用TAG(関数名にしておく)
+#define     TAG             __func__
+
+// 設定モード要求フラグ (ソフトウェアリセットでは消えないRTCメモリに置く)
+#define     SETTING_REQUEST_MAGIC       0x53455454          // "SETT"
+static RTC_NOINIT_ATTR uint32_t     setting_request;
+
+// 連続起動回数クリア用タイマ
+static TimerHandle_t                quick_boot_timer = NULL;
+
+// ================================================================================================
+// 連続起動回数のクリア (起動後 BOOT_MODE_QUICK_BOOT_WINDOW_MS 経過したら呼ばれる)
+// ================================================================================================
+static void quick_boot_timer_cb(TimerHandle_t timer)
+{
+    nvs_handle_t    handle;
+
+    if (nvs_open(NVS_NAMESPACE_INFO, NVS_READWRITE, &handle) == ESP_OK) {
+        nvs_erase_key(handle, NVS_KEY_QUICK_BOOT);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+    xTimerDelete(timer, 0);
+    quick_boot_timer = NULL;
+}
+
+// ================================================================================================
+// 連続起動回数の更新
+// 数えるのは電源ON/EN(リセット)ボタンによる起動で、RTCメモリの内容は残らないのでNVSに保存する
+// return : 今回を含めた連続起動回数
+// ================================================================================================
+static uint8_t count_quick_boot(void)
+{
+    nvs_handle_t    handle;
+    uint8_t         count = 0;
+
+    // 手で電源ON/リセットした場合だけ数える (ウォッチドッグ等によるリセットの繰り返しで設定モードに入らないように)
+    esp_reset_reason_t  reason = esp_reset_reason();
+    if (reason != ESP_RST_POWERON && reason != ESP_RST_EXT) {
+        return 0;
+    }
+
+    if (nvs_open(NVS_NAMESPACE_INFO, NVS_READWRITE, &handle) != ESP_OK) {
+        return 0;
+    }
+    nvs_get_u8(handle, NVS_KEY_QUICK_BOOT, &count);             // 無ければ0回
+    count = (count < UINT8_MAX) ? count + 1 : count;
+    if (count >= BOOT_MODE_QUICK_BOOT_NUM) {
+        nvs_erase_key(handle, NVS_KEY_QUICK_BOOT);              // 設定モードに入るので数え直す
+    }
+    else {
+        nvs_set_u8(handle, NVS_KEY_QUICK_BOOT, count);
+    }
+    nvs_commit(handle);
+    nvs_close(handle);
+
+    if (count < BOOT_MODE_QUICK_BOOT_NUM) {
+        // 一定時間動いたら連続起動ではないのでクリアする
+        quick_boot_timer = xTimerCreate("quick_boot", pdMS_TO_TICKS(BOOT_MODE_QUICK_BOOT_WINDOW_MS), pdFALSE, NULL, quick_boot_timer_cb);
+        if (quick_boot_timer) {
+            xTimerStart(quick_boot_timer, 0);
+        }
+    }
+    return count;
+}
+
+// ================================================================================================
+// 設定モードに入るかの判定 (NVS初期化後に呼ぶこと。待ち時間なしで戻る)
+// return : BOOT_MODE_xxx
+// ================================================================================================
+int boot_mode_check(void)
+{
+    int     mode = BOOT_MODE_NORMAL;
+
+    // 前回の起動からの要求 (フラグは1回で消す)
+    if (setting_request == SETTING_REQUEST_MAGIC) {
+        mode = BOOT_MODE_BY_REQUEST;
+    }
+    setting_request = 0;
+
+    // 連続起動 (要求/ボタンで設定モードに入る場合も数えておく)
+    if (count_quick_boot() >= BOOT_MODE_QUICK_BOOT_NUM && mode == BOOT_MODE_NORMAL) {
+        mode = BOOT_MODE_BY_QUICK_BOOT;
+    }
+
+    // ボタン
+    gpio_reset_pin(BOOT_MODE_GPIO);
+    gpio_set_direction(BOOT_MODE_GPIO, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(BOOT_MODE_GPIO, GPIO_PULLUP_ONLY);
+    if (gpio_get_level(BOOT_MODE_GPIO) == 0 && mode == BOOT_MODE_NORMAL) {
+        mode = BOOT_MODE_BY_GPIO;
+    }
+
+    ESP_LOGI(TAG, "boot mode : %d", mode);
+    return mode;
+}
+
+// ================================================================================================
+// 次回起動時に設定モードに入るよう要求する (この後 esp_restart() すること)
+// ================================================================================================
+void boot_mode_request_setting(void)
+{
+    setting_request = SETTING_REQUEST_MAGIC;
+}
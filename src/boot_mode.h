@@ -0,0 +1,32 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- 設定モード(BLE)に入るかの判定 ---------------------------
+    起動時に待ち時間なしで判定する。以下のどれかで設定モードに入る
+      - BOOT_MODE_GPIO (BOOTボタン) が押されている
+      - 前回の起動で boot_mode_request_setting() を呼んでからリブートした (RTCメモリのフラグ)
+      - 電源ON/リセットを BOOT_MODE_QUICK_BOOT_WINDOW_MS 以内に BOOT_MODE_QUICK_BOOT_NUM 回繰り返した
+        (ウォッチドッグ等によるリセットは数えない)
+   ------------------------------------------------------- */
+
+// ==== マクロ定義 ===========================================================================================
+#define BOOT_MODE_GPIO                  GPIO_NUM_0      // 設定モードボタン (押されているとLow)
+#define BOOT_MODE_QUICK_BOOT_NUM        3               // 設定モードに入る連続起動回数
+#define BOOT_MODE_QUICK_BOOT_WINDOW_MS  5000            // この時間以内に再起動したら連続起動とみなす
+#define NVS_KEY_QUICK_BOOT              "quick_boot"    // 連続起動回数 (NVS_NAMESPACE_INFO に保存)
+
+// 設定モードに入る理由
+#define BOOT_MODE_NORMAL                0               // 通常起動
+#define BOOT_MODE_BY_GPIO               1               // ボタン
+#define BOOT_MODE_BY_REQUEST            2               // 前回の起動からの要求
+#define BOOT_MODE_BY_QUICK_BOOT         3               // 連続起動
+
+
+// ==== extern 宣言 ===========================================================================================
+extern int          boot_mode_check(void);
+extern void         boot_mode_request_setting(void);
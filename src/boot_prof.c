@@ -0,0 +1,106 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    "freertos/FreeRTOS.h"
+#include    "freertos/task.h"
+#include    "esp_log.h"
+#include    "esp_err.h"
+#include    "esp_timer.h"
+
+#include    "boot_prof.h"
+
+// LOG表示用TAG(関数名にしておく)
+#define     TAG             __func__
+
+// チェックポイント
+struct boot_prof_point {
+    const char*     name;                   // チェックポイント名
+    uint32_t        time_us;                // 通過時刻 (esp_timer_get_time())
+};
+static struct boot_prof_point   prof_points[BOOT_PROF_POINT_NUM];
+static int                      prof_num = 0;
+static portMUX_TYPE             prof_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// ================================================================================================
+// チェックポイントの記録
+// ================================================================================================
+void boot_prof_mark(const char* name)
+{
+    uint32_t    now = (uint32_t)esp_timer_get_time();
+
+    portENTER_CRITICAL(&prof_mux);
+    if (prof_num < BOOT_PROF_POINT_NUM) {
+        prof_points[prof_num].name    = name;
+        prof_points[prof_num].time_us = now;
+        prof_num++;
+    }
+    portEXIT_CRITICAL(&prof_mux);
+}
+
+// ================================================================================================
+// チェックポイントのコピー
+// return : チェックポイント数
+// ================================================================================================
+static int copy_points(struct boot_prof_point* points)
+{
+    portENTER_CRITICAL(&prof_mux);
+    int     num = prof_num;
+    memcpy(points, prof_points, sizeof(points[0]) * num);
+    portEXIT_CRITICAL(&prof_mux);
+    return num;
+}
+
+// ================================================================================================
+// 起動時間の表示
+// ================================================================================================
+void boot_prof_disp(void)
+{
+    struct boot_prof_point  points[BOOT_PROF_POINT_NUM];
+    int                     num = copy_points(points);
+
+    printf("---------------------------------------\n");
+    printf("    %-*s  %10s  %10s\n", BOOT_PROF_NAME_MAX, "checkpoint", "time[ms]", "delta[ms]");
+    for (int i = 0; i < num; i++) {
+        uint32_t    delta = (i > 0) ? points[i].time_us - points[i - 1].time_us : points[i].time_us;
+        printf("    %-*.*s  %6u.%03u  %6u.%03u\n", BOOT_PROF_NAME_MAX, BOOT_PROF_NAME_MAX, points[i].name,
+               points[i].time_us / 1000, points[i].time_us % 1000, delta / 1000, delta % 1000);
+    }
+    printf("---------------------------------------\n");
+}
+
+// ================================================================================================
+// 起動時間のエンコード (BLE読み出し用 フォーマットは boot_prof.h 参照)
+// return : エンコード後の長さ  (領域が足りない場合は -1)
+// ================================================================================================
+int boot_prof_encode(uint8_t* buf, int buf_len)
+{
+    struct boot_prof_point  points[BOOT_PROF_POINT_NUM];
+    int                     num = copy_points(points);
+    int                     pos = 0;
+
+    if (buf_len < BOOT_PROF_MAX_LEN) {
+        return -1;
+    }
+    buf[pos++] = BOOT_PROF_VERSION;
+    buf[pos++] = (uint8_t)num;
+    for (int i = 0; i < num; i++) {
+        int     len = strnlen(points[i].name, BOOT_PROF_NAME_MAX);
+        for (int j = 0; j < sizeof(uint32_t); j++) {
+            buf[pos++] = (uint8_t)(points[i].time_us >> (8 * j));
+        }
+        buf[pos++] = (uint8_t)len;
+        memcpy(&buf[pos], points[i].name, len);
+        pos += len;
+    }
+    return pos;
+}
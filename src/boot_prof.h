@@ -0,0 +1,35 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- 起動時間プロファイラ ----------------------------------
+    起動処理の各段階を通過した時刻(esp_timer_get_time())を固定長の配列に記録する。
+    記録するのは名前のポインタと時刻だけなので、有効にしたままでもコストはほとんどない。
+    BOOT_PROF_ENABLE を 0 にすると BOOT_PROF_MARK() は何もしない。
+
+    BLE読み出し形式 (数値はリトルエンディアン)
+        version(1)  num(1)  { time_us(4)  name_len(1)  name(name_len) } × num
+   ------------------------------------------------------- */
+
+// ==== マクロ定義 ===========================================================================================
+#define BOOT_PROF_ENABLE                1               // 0にすると記録しない
+#define BOOT_PROF_POINT_NUM             16              // 記録できるチェックポイント数 (超えた分は捨てる)
+#define BOOT_PROF_NAME_MAX              15              // チェックポイント名の最大長
+#define BOOT_PROF_VERSION               0x01            // BLE読み出し形式のバージョン
+#define BOOT_PROF_MAX_LEN               (2 + BOOT_PROF_POINT_NUM * (5 + BOOT_PROF_NAME_MAX))
+
+#if BOOT_PROF_ENABLE
+#define BOOT_PROF_MARK(name)            boot_prof_mark(name)
+#else
+#define BOOT_PROF_MARK(name)
+#endif
+
+
+// ==== extern 宣言 ===========================================================================================
+extern void         boot_prof_mark(const char* name);       // name は文字列リテラルにすること(ポインタだけ記録する)
+extern void         boot_prof_disp(void);
+extern int          boot_prof_encode(uint8_t* buf, int buf_len);
@@ -13,6 +13,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/timers.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -25,6 +26,7 @@
 #include "esp_bt_device.h"              // esp_bt_dev_get_address()使用のため
 
 #include "BLE_PARAM_CONFIG.h"
+#include "wifi_common.h"
 
 #include    "uart_console.h"
 
@@ -41,6 +43,17 @@ static char *esp_bt_gatts_event_to_str(esp_gatts_cb_event_t event);
 // コンフィギュレーション済みフラグ
 static bool scan_rsp_config_done    = false;
 static bool adv_config_done         = false;
+static int  adv_data_updating       = 0;            // 完了待ちのadvertising中のデータ更新数(完了しても advertising開始しない。manufacturer_mux で排他)
+static bool adv_enabled             = true;         // advertisingを行う (stop_advertising()で止めたら resume_advertising()まで再開しない)
+
+// advertising スケジューラ
+static int           adv_phase       = ADV_PHASE_STOP;  // 現在のフェーズ
+static int           adv_next_phase  = ADV_PHASE_STOP;  // 停止完了後に移るフェーズ (フェーズ切り替え中以外は ADV_PHASE_STOP)
+static TimerHandle_t adv_phase_timer = NULL;            // フェーズ切り替えタイマ
+static bool          adv_connected   = false;           // ホストと接続中 (接続中はどのフェーズも開始しない)
+static portMUX_TYPE  adv_phase_mux   = portMUX_INITIALIZER_UNLOCKED;    // adv_phase/adv_next_phase/adv_connected の排他 (BTC/タイマタスクから更新される)
+static bool          adv_whitelist_active = false;      // ボンディング済みホストからの接続だけ受け付ける
+static bool          adv_pairing_open     = false;      // 新しいホストのペアリングを受け付ける (open_pairing()で開き、ボンディング完了で閉じる)
 
 // advertising configuration データ
 static esp_ble_adv_data_t adv_config = {
@@ -60,13 +73,12 @@ static esp_ble_adv_data_t adv_config = {
                                                     // advertising flag設定値(advertisingパットに含まれて送信される)
 };
 
-// scan response configuration データ
-static esp_ble_adv_data_t scan_rsp_config = {
-    .set_scan_rsp           = true,                         // scan response configuration データ
-    .include_name           = true,                         // パケットにDeviceNameを含める (DeviceNameはesp_ble_gap_set_device_name()で設定)
-    .manufacturer_len       = sizeof(manufacturer_data),    // マニファクチャデータ長
-    .p_manufacturer_data    = manufacturer_data,            // マニファクチャデータへのポインタ
-};
+// scan response データ (rawで設定する)
+// esp_ble_adv_data_t ではデバイス名がマニファクチャデータより前に入り、31byteに収まらないと
+// マニファクチャデータが落ちるので、マニファクチャデータ → デバイス名(入る分だけ) の順に自前で組み立てる
+static uint8_t      scan_rsp_raw[ESP_BLE_ADV_DATA_LEN_MAX];
+static int          scan_rsp_raw_len = 0;
+static portMUX_TYPE manufacturer_mux = portMUX_INITIALIZER_UNLOCKED;    // manufacturer_data/scan_rsp_raw/adv_data_updating の排他 (BTC/イベントループ/メインから更新される)
 
 // ？？？ =============================================
 // advertising と scan response どっちに割り当てるかはどうやって決める？
@@ -75,9 +87,10 @@ static esp_ble_adv_data_t scan_rsp_config = {
 
 // advertisingパラメータ
 esp_ble_adv_params_t adv_params = {
-    .adv_int_min        = 0x100,                    // advertising インターバル(最小)  Time = N * 0.625 msec
+    .adv_int_min        = ADV_FAST_INT_MIN,         // advertising インターバル(最小)  Time = N * 0.625 msec
                                                     // 設定可能値： 0x0020～0x4000, デフォルト値：0x0800
-    .adv_int_max        = 0x100,                    // advertising インターバル(最大)  Time = N * 0.625 msec
+                                                    // 実際の値はフェーズ毎に start_adv_phase() で設定する
+    .adv_int_max        = ADV_FAST_INT_MAX,         // advertising インターバル(最大)  Time = N * 0.625 msec
                                                     // 設定可能値： 0x0020～0x4000, デフォルト値：0x0800
     .adv_type           = ADV_TYPE_IND,             // advertising タイプ
                                                     // 設定可能値： 
@@ -107,6 +120,208 @@ esp_ble_adv_params_t adv_params = {
 };
 
 
+// ================================================================================================
+// 現在の状態からマニファクチャデータを作る
+// (BTC/イベントループ/パラメータ制御タスクから呼ばれるので、設定パラメータ全体はコピーせず必要な値だけ取得する)
+// ================================================================================================
+static void build_manufacturer_data(uint8_t* data)
+{
+    uint32_t            generation;
+    uint32_t            crc;
+    uint8_t             last_reason;
+    uint8_t             mac[6];
+    uint8_t             flags = 0;
+
+    GetParamGenCrc(&generation, &crc);
+    if (IsParamProvisioned()) {
+        flags |= MANUFACTURER_FLAG_PROVISIONED;
+    }
+    if (IsParamSaved()) {
+        flags |= MANUFACTURER_FLAG_SAVED;
+    }
+    switch (wifi_get_status(&last_reason)) {
+      case WIFI_STATUS_CONNECTED :
+        flags |= MANUFACTURER_FLAG_WIFI_CONNECTED;
+        break;
+      case WIFI_STATUS_FAILED :
+        flags |= MANUFACTURER_FLAG_WIFI_FAILED;
+        break;
+    }
+
+    memcpy(data, manufacturer_data, MANUFACTURER_DATA_POS_FLAGS);  // CompanyId/フォーマットバージョン
+    data[MANUFACTURER_DATA_POS_FLAGS]  = flags;
+    data[MANUFACTURER_DATA_POS_REASON] = last_reason;
+    for (int i = 0; i < sizeof(uint32_t); i++) {
+        data[MANUFACTURER_DATA_POS_GEN + i] = (uint8_t)(generation >> (8 * i));
+        data[MANUFACTURER_DATA_POS_CRC + i] = (uint8_t)(crc        >> (8 * i));
+    }
+    if (esp_read_mac(mac, ESP_MAC_WIFI_STA) != ESP_OK) {
+        memset(mac, 0, sizeof(mac));
+    }
+    memcpy(&data[MANUFACTURER_DATA_POS_ID], &mac[sizeof(mac) - MANUFACTURER_DATA_ID_LEN], MANUFACTURER_DATA_ID_LEN);
+}
+
+// ================================================================================================
+// マニファクチャデータを更新して scan response を組み立てる (manufacturer_mux 取得中に呼ぶ)
+// return : 変化があれば true
+// ================================================================================================
+static bool set_manufacturer_data(const uint8_t* data)
+{
+    if (scan_rsp_raw_len > 0 && memcmp(manufacturer_data, data, MANUFACTURER_DATA_LEN) == 0) {
+        return false;
+    }
+    memcpy(manufacturer_data, data, MANUFACTURER_DATA_LEN);
+
+    // マニファクチャデータ
+    int     pos = 0;
+    scan_rsp_raw[pos++] = 1 + MANUFACTURER_DATA_LEN;
+    scan_rsp_raw[pos++] = ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE;
+    memcpy(&scan_rsp_raw[pos], manufacturer_data, MANUFACTURER_DATA_LEN);
+    pos += MANUFACTURER_DATA_LEN;
+
+    // デバイス名 (入りきらなければ短縮名)
+    int     name_len = strlen(PARAM_CONFIG_DEVICE_NAME);
+    int     space    = sizeof(scan_rsp_raw) - pos - 2;
+    if (space > 0) {
+        scan_rsp_raw[pos++] = 1 + ((name_len <= space) ? name_len : space);
+        scan_rsp_raw[pos++] = (name_len <= space) ? ESP_BLE_AD_TYPE_NAME_CMPL : ESP_BLE_AD_TYPE_NAME_SHORT;
+        if (name_len > space) {
+            name_len = space;
+        }
+        memcpy(&scan_rsp_raw[pos], PARAM_CONFIG_DEVICE_NAME, name_len);
+        pos += name_len;
+    }
+    scan_rsp_raw_len = pos;
+    return true;
+}
+
+// ================================================================================================
+// scan response の設定
+// ================================================================================================
+static esp_err_t config_scan_rsp(bool update)
+{
+    uint8_t     data[MANUFACTURER_DATA_LEN];
+    uint8_t     raw[ESP_BLE_ADV_DATA_LEN_MAX];
+    int         raw_len;
+
+    build_manufacturer_data(data);
+    portENTER_CRITICAL(&manufacturer_mux);
+    bool    changed = set_manufacturer_data(data);
+    memcpy(raw, scan_rsp_raw, scan_rsp_raw_len);
+    raw_len = scan_rsp_raw_len;
+    if (update && changed) {
+        adv_data_updating++;    // 設定完了イベントで advertising を開始しないように
+    }
+    portEXIT_CRITICAL(&manufacturer_mux);
+
+    if (update && !changed) {
+        return ESP_OK;          // 状態に変化なし
+    }
+    esp_err_t ret = esp_ble_gap_config_scan_rsp_data_raw(raw, raw_len);
+    if (ret) {
+        ESP_LOGE(TAG, "    config scan rsp data failed, error code = %x", ret);
+        if (update) {
+            portENTER_CRITICAL(&manufacturer_mux);
+            adv_data_updating--;
+            portEXIT_CRITICAL(&manufacturer_mux);
+        }
+    }
+    return ret;
+}
+
+// ================================================================================================
+// フェーズ切り替えタイマのコールバック (タイマタスクから呼ばれる)
+// ここでは停止要求だけ出して、実際の切り替えは停止完了イベントで行う
+// ================================================================================================
+static void adv_phase_timer_cb(TimerHandle_t timer)
+{
+    bool    stop = true;
+
+    portENTER_CRITICAL(&adv_phase_mux);
+    if (adv_connected) {
+        stop = false;           // 接続された
+    }
+    else if (adv_phase == ADV_PHASE_FAST) {
+        adv_next_phase = ADV_PHASE_SLOW;
+    }
+    else if (adv_phase == ADV_PHASE_SLOW) {
+        adv_next_phase = ADV_PHASE_IDLE;
+    }
+    else {
+        stop = false;           // 停止された
+    }
+    portEXIT_CRITICAL(&adv_phase_mux);
+
+    if (stop) {
+        esp_ble_gap_stop_advertising();
+    }
+}
+
+// ================================================================================================
+// 指定フェーズの間隔で advertising 開始
+// ================================================================================================
+static esp_err_t start_adv_phase(int phase)
+{
+    if (phase == ADV_PHASE_FAST) {
+        adv_params.adv_int_min = ADV_FAST_INT_MIN;
+        adv_params.adv_int_max = ADV_FAST_INT_MAX;
+    }
+    else {
+        adv_params.adv_int_min = ADV_SLOW_INT_MIN;
+        adv_params.adv_int_max = ADV_SLOW_INT_MAX;
+    }
+    adv_params.adv_filter_policy = adv_whitelist_active ? ADV_FILTER_ALLOW_SCAN_ANY_CON_WLST : ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY;
+    portENTER_CRITICAL(&adv_phase_mux);
+    adv_phase      = phase;
+    adv_next_phase = ADV_PHASE_STOP;
+    portEXIT_CRITICAL(&adv_phase_mux);
+    return esp_ble_gap_start_advertising(&adv_params);  // advertising 開始
+}
+
+#if BLE_BONDED_MODE
+// ================================================================================================
+// ボンディング済みデバイスをホワイトリストに登録 (advertising停止中に呼ぶ)
+// return : 登録したデバイス数
+// ================================================================================================
+static int update_bonded_whitelist(void)
+{
+    esp_ble_gap_clear_whitelist();
+
+    // ボンディングデバイス数 (ホワイトリストに入る分だけ)
+    int         dev_num = esp_ble_get_bond_device_num();
+    uint16_t    wl_size = 0;
+    if (esp_ble_gap_get_whitelist_size(&wl_size) == ESP_OK && dev_num > wl_size) {
+        dev_num = wl_size;
+    }
+    if (dev_num <= 0) {
+        return 0;
+    }
+
+    // 情報取得用領域を確保
+    esp_ble_bond_dev_t *dev_list = (esp_ble_bond_dev_t *)malloc(sizeof(esp_ble_bond_dev_t) * dev_num);
+    if (dev_list == NULL) {
+        return 0;
+    }
+
+    // ボンディングデバイスリストを取得
+    esp_ble_get_bond_device_list(&dev_num, dev_list);
+
+    for (int i = 0; i < dev_num; i++) {
+        // IRKを受け取っていればIDアドレス(ランダムアドレスはコントローラで解決される)、なければ接続時のアドレスを登録
+        if (dev_list[i].bond_key.key_mask & ESP_BLE_ID_KEY_MASK) {
+            esp_ble_gap_update_whitelist(true, dev_list[i].bond_key.pid_key.static_addr,
+                                         (dev_list[i].bond_key.pid_key.addr_type == BLE_ADDR_TYPE_PUBLIC) ? BLE_WL_ADDR_TYPE_PUBLIC : BLE_WL_ADDR_TYPE_RANDOM);
+        }
+        else {
+            esp_ble_gap_update_whitelist(true, dev_list[i].bd_addr, BLE_WL_ADDR_TYPE_RANDOM);
+        }
+    }
+    // バッファ解放
+    free(dev_list);
+    return dev_num;
+}
+#endif
+
 // ================================================================================================
 // GAP(Generic Access Profile)のコールバック
 // (大雑把に言うと、advertisingまわりの処理)
@@ -116,7 +331,19 @@ void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
     ESP_LOGV(TAG, "* GAP_EVT: %s(%d)", esp_bt_gap_event_to_str(event), event);
 
     switch (event) {
-      case ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT:  // scan response data 設定完了
+      case ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT:  // scan response data 設定完了
+        {
+            // 設定完了イベントは要求順に来るので、更新中の数だけ読み捨てる
+            portENTER_CRITICAL(&manufacturer_mux);
+            bool    updating = (adv_data_updating > 0);
+            if (updating) {
+                adv_data_updating--;
+            }
+            portEXIT_CRITICAL(&manufacturer_mux);
+            if (updating) {
+                break;                                  // マニファクチャデータの更新 (advertisingの状態はそのまま)
+            }
+        }
         scan_rsp_config_done = true;
         if (scan_rsp_config_done &&  adv_config_done) { // scan response data と advertising data の両方が設定完了している?
             start_advertising();                        // advertising 開始
@@ -133,7 +360,18 @@ void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
             ESP_LOGE(TAG, "    advertising start failed, error status = %x", param->adv_start_cmpl.status);
             break;
         }
-        ESP_LOGI(TAG, "    advertising start success");
+        {
+            // 次のフェーズへの切り替えタイマを開始 (開始要求の後に接続されていたら開始しない)
+            portENTER_CRITICAL(&adv_phase_mux);
+            int         phase     = adv_phase;
+            bool        connected = adv_connected;
+            portEXIT_CRITICAL(&adv_phase_mux);
+            ESP_LOGI(TAG, "    advertising start success (%s)", (phase == ADV_PHASE_FAST) ? "fast" : "slow");
+            uint32_t    duration = (phase == ADV_PHASE_FAST) ? ADV_FAST_DURATION_MS : ADV_IDLE_TIMEOUT_MS;
+            if (duration != 0 && adv_phase_timer && !connected) {
+                xTimerChangePeriod(adv_phase_timer, pdMS_TO_TICKS(duration), 0);    // タイマも開始される
+            }
+        }
         {
             esp_bd_addr_t bd_addr;
             uint8_t       addr_type;
@@ -240,18 +478,34 @@ void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
                 ESP_LOGI(TAG, "    reason = 0x%x",param->ble_security.auth_cmpl.fail_reason);
             } else {
                 ESP_LOGI(TAG, "    pair status = success");
+#if BLE_BONDED_MODE
+                adv_pairing_open = false;       // 新しいホストをボンディングしたので受付を閉じる (次のadvertisingからホワイトリストに入る)
+#endif
                 ESP_LOGI(TAG, "    auth mode = %s",esp_auth_req_to_str(param->ble_security.auth_cmpl.auth_mode));
             }
+#if BLE_BONDED_MODE
+            // ボンディング済みのホストならCCCを前回の接続の値に戻す
+            param_config_auth_complete(bd_addr, param->ble_security.auth_cmpl.success &&
+                                                (param->ble_security.auth_cmpl.auth_mode & ESP_LE_AUTH_BOND));
+#endif
             // ボンディング済みデバイスの表示
             show_bonded_devices();
             break;
         }
+      case ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT:   // ホワイトリスト更新完了イベント
+        if (param->update_whitelist_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGE(TAG, "    update whitelist failed, error status = %x", param->update_whitelist_cmpl.status);
+        }
+        break;
       case ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT:    // ボンディング済みデバイスの削除完了イベント
         {
             ESP_LOGD(TAG, "    status = %d", param->remove_bond_dev_cmpl.status);
             uint8_t* bd_addr = param->remove_bond_dev_cmpl.bd_addr;
             ESP_LOGI(TAG, "    remove BD_ADDR: %02x:%02x:%02x:%02x:%02x:%02x",                  // 削除するのBDアドレスの表示
                     bd_addr[0], bd_addr[1], bd_addr[2], bd_addr[3], bd_addr[4], bd_addr[5]);
+#if BLE_BONDED_MODE
+            param_config_forget_bond(bd_addr);      // 保存していたCCCも消す
+#endif
         }
         break;
     case ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT:    // プライバシー有効化/無効化完了イベント
@@ -267,18 +521,46 @@ void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
         } else {
             adv_config_done = false;
         }
-        // scan response の設定
-        ret = esp_ble_gap_config_adv_data(&scan_rsp_config);
-        if (ret) {
-            ESP_LOGE(TAG, "    config adv data failed, error code = %x", ret);
-        } else {
+        // scan response の設定 (マニファクチャデータには現在の状態を入れる)
+        ret = config_scan_rsp(false);
+        if (ret == ESP_OK) {
             scan_rsp_config_done = false;
         }
         // 両方の設定が正常終了した
         ESP_LOGI(TAG, "    success");
         break;
+    case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:     // LLデータ長設定完了
+        if (param->pkt_data_lenth_cmpl.status != ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGW(TAG, "    set packet length failed, error status = %x", param->pkt_data_lenth_cmpl.status);
+            break;
+        }
+        param_config_set_pkt_data_len(param->pkt_data_lenth_cmpl.params.tx_len, param->pkt_data_lenth_cmpl.params.rx_len);
+        break;
     case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:    // Advertising停止完了
         ESP_LOGI(TAG, "Advertising stop completed");
+        ble_service_notify(BLE_SERVICE_EVT_ADV_STOPPED);    // 停止処理のadvertising停止待ちに通知
+        {
+            // 停止要求を出した後に接続されていたら、どのフェーズも開始しない (切断後にFASTから始まる)
+            int     next;
+            portENTER_CRITICAL(&adv_phase_mux);
+            next = (adv_connected || !adv_enabled) ? ADV_PHASE_STOP : adv_next_phase;
+            adv_phase      = (next == ADV_PHASE_IDLE) ? ADV_PHASE_IDLE : ADV_PHASE_STOP;
+            adv_next_phase = ADV_PHASE_STOP;
+            portEXIT_CRITICAL(&adv_phase_mux);
+
+            if (next == ADV_PHASE_FAST) {
+                // フィルタポリシーの変更 (open_pairing()) → ホワイトリストを作り直して FAST から
+                start_advertising();
+            }
+            else if (next == ADV_PHASE_SLOW) {
+                // FAST → SLOW
+                start_adv_phase(ADV_PHASE_SLOW);
+            }
+            else if (next == ADV_PHASE_IDLE) {
+                // SLOW → IDLE (ble_service_start() で再開)
+                ESP_LOGI(TAG, "    advertising idle timeout");
+            }
+        }
         break;
       default:
             ESP_LOGI(TAG, "    event not handled");
@@ -310,6 +592,22 @@ void gatts_event_handler(esp_gatts_cb_event_t        event,
         }
     }
 
+    if (event == ESP_GATTS_CONNECT_EVT) {       // 接続されたらadvertisingは止まるので、フェーズ切り替えも止める
+        if (adv_phase_timer) {
+            xTimerStop(adv_phase_timer, 0);
+        }
+        portENTER_CRITICAL(&adv_phase_mux);
+        adv_connected  = true;
+        adv_phase      = ADV_PHASE_STOP;
+        adv_next_phase = ADV_PHASE_STOP;
+        portEXIT_CRITICAL(&adv_phase_mux);
+    }
+    else if (event == ESP_GATTS_DISCONNECT_EVT) {   // 切断後のadvertising再開(プロファイルのコールバック)より先に落とす
+        portENTER_CRITICAL(&adv_phase_mux);
+        adv_connected  = false;
+        portEXIT_CRITICAL(&adv_phase_mux);
+    }
+
     // 各プロファイルについてループして対象のコールバックを探す
     for (int idx = 0; idx < PROFILE_NUM; idx++) {
         if (gatts_if == ESP_GATT_IF_NONE || //  ESP_GATT_IF_NONE 時は全てのプロファイルに対するコールバック呼び出し
@@ -322,11 +620,109 @@ void gatts_event_handler(esp_gatts_cb_event_t        event,
 }
 
 // ================================================================================================
-// Advertising start
+// Advertising start (開始時/切断後は FAST フェーズから始める)
 // ================================================================================================
 esp_err_t start_advertising(void)
 {
-    return esp_ble_gap_start_advertising(&adv_params);  // advertising 開始
+    if (!adv_enabled) {
+        return ESP_OK;          // 停止中 (切断時などに再開しない)
+    }
+    if (adv_phase_timer == NULL) {
+        adv_phase_timer = xTimerCreate("adv_phase", pdMS_TO_TICKS(ADV_FAST_DURATION_MS), pdFALSE, NULL, adv_phase_timer_cb);
+    }
+    else {
+        xTimerStop(adv_phase_timer, 0);
+    }
+#if BLE_BONDED_MODE
+    // ボンディング済みのホストがいれば、そのホストからの接続だけ受け付ける
+    adv_whitelist_active = !adv_pairing_open && (update_bonded_whitelist() > 0);
+    ESP_LOGI(TAG, "    connection filter : %s", adv_whitelist_active ? "bonded hosts only" : "any");
+#endif
+    return start_adv_phase(ADV_PHASE_FAST);
+}
+
+// ================================================================================================
+// 新しいホストのペアリング受付を開く (ボンディングモードのみ。ボンディングが完了したら閉じる)
+// advertising中ならフィルタポリシーを変えるため停止→停止完了イベントでFASTから再開する
+// ================================================================================================
+void open_pairing(void)
+{
+#if BLE_BONDED_MODE
+    ESP_LOGI(TAG, "    open pairing for new host");
+    adv_pairing_open = true;
+    if (adv_phase_timer) {
+        xTimerStop(adv_phase_timer, 0);
+    }
+    portENTER_CRITICAL(&adv_phase_mux);
+    int     phase = adv_phase;
+    if (phase == ADV_PHASE_FAST || phase == ADV_PHASE_SLOW) {
+        adv_next_phase = ADV_PHASE_FAST;
+    }
+    portEXIT_CRITICAL(&adv_phase_mux);
+
+    if (phase == ADV_PHASE_FAST || phase == ADV_PHASE_SLOW) {
+        esp_ble_gap_stop_advertising();
+    }
+    else if (phase == ADV_PHASE_IDLE) {
+        resume_advertising();
+    }
+    // 接続中なら切断後のadvertisingから反映される
+#endif
+}
+
+// ================================================================================================
+// タイムアウトで advertising を止めているか
+// ================================================================================================
+bool advertising_is_idle(void)
+{
+    portENTER_CRITICAL(&adv_phase_mux);
+    bool    idle = (adv_phase == ADV_PHASE_IDLE);
+    portEXIT_CRITICAL(&adv_phase_mux);
+    return idle;
+}
+
+// ================================================================================================
+// Advertising 再開 (stop_advertising()で止めた後)
+// ================================================================================================
+esp_err_t resume_advertising(void)
+{
+    adv_enabled = true;
+    return start_advertising();
+}
+
+// ================================================================================================
+// Advertising 状態の初期化 (BLEスタック停止時に呼ぶ。再初期化時はデータ設定からやり直す)
+// ================================================================================================
+void reset_advertising_state(void)
+{
+    scan_rsp_config_done = false;
+    adv_config_done      = false;
+    portENTER_CRITICAL(&manufacturer_mux);
+    adv_data_updating    = 0;
+    portEXIT_CRITICAL(&manufacturer_mux);
+    adv_enabled          = true;
+    if (adv_phase_timer) {
+        xTimerStop(adv_phase_timer, 0);
+    }
+    portENTER_CRITICAL(&adv_phase_mux);
+    adv_connected        = false;
+    adv_phase            = ADV_PHASE_STOP;
+    adv_next_phase       = ADV_PHASE_STOP;
+    portEXIT_CRITICAL(&adv_phase_mux);
+    adv_whitelist_active = false;
+    adv_pairing_open     = false;
+}
+
+// ================================================================================================
+// マニファクチャデータの更新 (設定パラメータ確定時/Wi-Fi接続状態の変化時に呼ぶ)
+// 状態が変わっていれば scan response を設定し直す。advertising中なら次のscan responseから反映される
+// ================================================================================================
+esp_err_t update_manufacturer_data(void)
+{
+    if (!scan_rsp_config_done) {
+        return ESP_OK;          // 初回の設定前(設定時に最新の値が入る)
+    }
+    return config_scan_rsp(true);
 }
 
 // ================================================================================================
@@ -334,6 +730,13 @@ esp_err_t start_advertising(void)
 // ================================================================================================
 esp_err_t stop_advertising(void)
 {
+    adv_enabled = false;
+    if (adv_phase_timer) {
+        xTimerStop(adv_phase_timer, 0);
+    }
+    portENTER_CRITICAL(&adv_phase_mux);
+    adv_next_phase = ADV_PHASE_STOP;
+    portEXIT_CRITICAL(&adv_phase_mux);
     return esp_ble_gap_stop_advertising();              // advertising 停止
 }
 
@@ -6,11 +6,38 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+/* ---- Advertising スケジューラ -------------------------------
+    開始時/切断後の最初の ADV_FAST_DURATION_MS は短い間隔(FAST)でadvertisingし、ホストからすぐ見つかるようにする。
+    その後は長い間隔(SLOW)に切り替えて消費電力を抑え、さらに ADV_IDLE_TIMEOUT_MS 経過したらadvertisingを止める(IDLE)。
+    間隔はadvertising中に変えられないので、停止→停止完了イベント(ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT)で次のフェーズを開始する。
+    IDLEからは resume_advertising() (ble_service_start()) で FAST から再開する。
+    ボンディングモード(BLE_BONDED_MODE)でボンディング済みのホストがいれば、FAST開始時にホワイトリストを作り直し、
+    接続はホワイトリストのホストからだけ受け付ける(スキャンは誰からでも受け付けるので状態レコードは見える)。
+   ----------------------------------------------------------- */
+
+// ==== マクロ定義 ===========================================================================================
+#define ADV_PHASE_STOP              0               // 停止中 (停止要求/接続中)
+#define ADV_PHASE_FAST              1               // 短い間隔 (発見されやすさ優先)
+#define ADV_PHASE_SLOW              2               // 長い間隔 (消費電力優先)
+#define ADV_PHASE_IDLE              3               // タイムアウトで停止中
+
+#define ADV_FAST_INT_MIN            0x0020          // FAST advertising インターバル  20ms    (N * 0.625 msec)
+#define ADV_FAST_INT_MAX            0x0030          //                                30ms
+#define ADV_FAST_DURATION_MS        30000           // FAST フェーズの長さ
+#define ADV_SLOW_INT_MIN            0x0320          // SLOW advertising インターバル  500ms
+#define ADV_SLOW_INT_MAX            0x036A          //                                546.25ms
+#define ADV_IDLE_TIMEOUT_MS         (5 * 60 * 1000) // SLOW フェーズの長さ (0ならタイムアウトしない)
+
 // ==== extern 宣言 ===========================================================================================
 extern void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
 extern void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
 extern esp_err_t start_advertising(void);
 extern esp_err_t stop_advertising(void);
+extern esp_err_t resume_advertising(void);
+extern void reset_advertising_state(void);
+extern bool advertising_is_idle(void);
+extern void open_pairing(void);
+extern esp_err_t update_manufacturer_data(void);
 extern void remove_all_bonded_devices(void);
 extern void show_bonded_devices(void);
 
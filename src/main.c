@@ -26,9 +26,13 @@
 #include "BLE_PARAM_CONFIG.h"
 
 #include "wifi_common.h"
+#include "param_ctrl.h"
 
 #include "uart_console.h"
 
+#include "boot_prof.h"
+#include "boot_mode.h"
+
 // LOG表示用TAG(関数名にしておく)
 #define     TAG             __func__
 
@@ -39,6 +43,7 @@ void app_main(void)
 {
     esp_err_t err;
 
+    BOOT_PROF_MARK("app_main");
     ESP_LOGI(TAG, "==== application start ====================");
     // NVS初期化
     err = nvs_flash_init();
@@ -47,59 +52,178 @@ void app_main(void)
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK( err );
+    BOOT_PROF_MARK("nvs_init");
 
     
     printf("==== Loading Params ====================\n");
-    bool param_available = LoadParam(&AppParam);
+    bool param_available = LoadParam(&AppParam);        // 他のタスクが動く前なので直接ロードする
     DispParam(&AppParam);
+    BOOT_PROF_MARK("param_load");
 
+    // パラメータロードが失敗した or 設定モード要求(ボタン/前回の起動からの要求/連続起動)があればBLEによる設定モードで動作
+    // 判定は待ち時間なしで行うので、通常はすぐにWi-Fi接続を開始する
     bool    enter_ble_main = false;
-    if (!param_available) {            // パラメータロードが失敗した or 5秒以内にキー入力があればBLEによる設定モードで動作
+    int     boot_mode = boot_mode_check();          // 連続起動回数を数えるため、パラメータロードの成否によらず呼ぶ
+    if (!param_available) {
         printf("    ==== parameter load failed! ====\n");
         enter_ble_main = true;
     }
-    else {
-        printf("    ==== enter to setting mode? ====\n");
-        if (uart_checkkey(50)) {            // パラメータロードが失敗した or 5秒以内にキー入力があればBLEによる設定モードで動作
-            enter_ble_main = true;
-        }
+    else if (boot_mode != BOOT_MODE_NORMAL) {
+        printf("    ==== enter to setting mode (%d) ====\n", boot_mode);
+        enter_ble_main = true;
+    }
+
+    BOOT_PROF_MARK("mode_select");
+
+    // パラメータのワーカータスク起動 (IPアドレス取得時のスロット確認などを行う。BLEを使わない場合も必要)
+    // BLEの設定サービスが結果通知先を登録するので、その前に起動しておく
+    if (param_ctrl_start(NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "param_ctrl_start failed.");
     }
 
+    // 接続先(SSID/パスワード/プロファイル)が変更されたら通知してもらう (リブートせずに接続し直すため)
+    // BLEで変更される前に登録しておく
+    SubscribeParamNotify(PARAM_FIELD_SSID_NAME | PARAM_FIELD_SSID_PASS | PARAM_FIELD_AP_PROFILE, xTaskGetCurrentTaskHandle());
+
     if (enter_ble_main) {
-        // BLE処理
-        ble_main();
+        // BLEによる設定サービスをバックグラウンドで開始 (メイン処理/Wi-Fiはそのまま動作を続ける)
+        if (ble_service_start() != ESP_OK) {
+            ESP_LOGE(TAG, "ble_service_start failed.");
+        }
+    }
+    else {
+        // このブートでは設定を行わないので、BTコントローラ/Bluedroidのメモリをヒープに返す
+        ble_service_release_mem();
+        BOOT_PROF_MARK("bt_mem_release");
     }
 
     // 本来のmain処理
-    DispParam(&AppParam);
+    struct app_param    param;
+    GetParam(&param);                   // BLEから更新されることがあるのでスナップショットを使う
+    DispParam(&param);
+
+    // 接続先が未設定なら、BLEで設定されるまで待つ
+    if (strlen(param.ssid_name) == 0) {
+        printf("==== waiting for parameters via BLE ====\n");
+        while (strlen(param.ssid_name) == 0) {
+            xTaskNotifyWait(0, UINT32_MAX, NULL, 1000 / portTICK_PERIOD_MS);
+            GetParam(&param);
+        }
+        DispParam(&param);
+    }
 
     // Wi-Fi 接続
     ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
-    err = wifi_init_sta(AppParam.ssid_name, AppParam.ssid_pass);
+    err = wifi_init_sta(&param);
     if (err != ESP_OK) {
         // Wi-Fi初期化失敗
         ESP_LOGE(TAG, "wifi_init_sta failed.");
         return;
     }
+    BOOT_PROF_MARK("wifi_init");
     // 接続待ち
     wait_wifi_connect();
+    BOOT_PROF_MARK("wifi_wait");
+    boot_prof_disp();               // 起動からオンラインになるまでの時間内訳
 
     // 必要ならwait_wifi_connect()の戻り値で接続できたか確認する
 
     // 本来の接続後の処理
     // 今回は何もやることがないので、リブート待ちしておく
+    printf("Hit 'w' key for Wi-Fi statistics, \n");
+    printf("Hit 'b' key for boot timeline, \n");
+    printf("Hit 'm' key for start BLE setting service, \n");
+    printf("Hit 'q' key for stop  BLE setting service, \n");
+    printf("Hit 'd' key for disconnect BLE, \n");
+    printf("Hit 'O' key for open pairing for new host (bonded mode), \n");
+    printf("Hit 'L' key for list bonded devices, \n");
+    printf("Hit 'C' key for clear bonded devices, \n");
+    printf("Hit 'p' key for print AppParam, \n");
+    printf("Hit 's' key for Save  AppParam, \n");
+    printf("Hit 'c' key for Clear AppParam, \n");
     printf("Hit 'r' key for system reboot... \n");
     while (1) {
         int in_key = uart_getchar_nowait();
         switch (in_key) {
           case 'r' :
-            // rが入力されたらreboot
+            // rが入力されたらreboot (NVS書き込み中なら完了を待つ)
+            WaitParamSaved();
             esp_restart();
             break;
+          case 'w' :
+            // wが入力されたらWi-Fi接続統計情報を表示
+            wifi_disp_stats();
+            break;
+          case 'b' :
+            // bが入力されたら起動時間の内訳を表示
+            boot_prof_disp();
+            break;
+          case 'm' :
+            // mが入力されたらBLEによる設定サービスを開始
+            if (ble_service_start() == ESP_ERR_INVALID_STATE) {
+                // BTのメモリは解放済みなので、設定モードでreboot (NVS書き込み中なら完了を待つ)
+                printf("==== BT memory already released. reboot into setting mode ====\n");
+                boot_mode_request_setting();
+                WaitParamSaved();
+                esp_restart();
+            }
+            break;
+          case 'q' :
+            // qが入力されたらBLEによる設定サービスを停止 (未確定の書き込みは確定し、BLEスタックを解放する)
+            ble_service_stop();
+            break;
+          case 'd' :
+            // dが入力されたら切断する(接続されているかはcall先でチェック)
+            if (ble_service_is_running()) {
+                param_config_disconnect();
+            }
+            break;
+          case 'O' :
+            // ボンディングモードで新しいホストのペアリングを受け付ける
+            if (ble_service_is_running()) {
+                open_pairing();
+            }
+            break;
+          case 'L' :
+            // ボンディング済みデバイスを表示
+            if (ble_service_is_running()) {
+                show_bonded_devices();
+            }
+            break;
+          case 'C' :
+            // ボンディング済みデバイスをすべて削除
+            if (ble_service_is_running()) {
+                remove_all_bonded_devices();
+            }
+            break;
+          case 'p' :
+            // pが入力されたら変数一覧を表示(確定済みの値)
+            GetParam(&param);
+            DispParam(&param);
+            break;
+          case 's' :
+            // sが入力されたら変数をnvsに保存
+            GetParam(&param);
+            SaveParam(&param);
+            break;
+          case 'c' :
+            // cが入力されたらnvs上の変数を削除
+            ClearParam();
+            ReloadParam();          // 変更通知のため確定処理を通す
+            break;
         }
         
-        // Task watchdog のトリガを防止するため、vTaskDelay()をコールしておく
-        vTaskDelay(1000 / portTICK_PERIOD_MS);          // 1秒待つ
+        // 設定パラメータの変更通知を待つ (Task watchdog のトリガ防止のため、最大1秒で抜ける)
+        uint32_t    fields = 0;
+        if (xTaskNotifyWait(0, UINT32_MAX, &fields, 1000 / portTICK_PERIOD_MS) == pdTRUE &&
+            (fields & (PARAM_FIELD_SSID_NAME | PARAM_FIELD_SSID_PASS | PARAM_FIELD_AP_PROFILE))) {
+            // 接続先が変更された → 新しい設定で接続し直す
+            GetParam(&param);
+            ESP_LOGI(TAG, "Wi-Fi config changed. reconnecting");
+            if (wifi_reconfigure_sta(&param) == ESP_OK) {
+                wait_wifi_connect();
+            }
+        }
     }
 
     return;
@@ -0,0 +1,228 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    "esp_log.h"
+#include    "esp_err.h"
+
+#include    "app_param.h"
+#include    "param_blob.h"
+
+// LOG表示用TAG(関数名にしておく)
+#define     TAG             __func__
+
+// ================================================================================================
+// TLV 1個分の書き込み
+// return : 書き込んだ長さ  (領域が足りない場合は -1)
+// ================================================================================================
+static int put_tlv(uint8_t* buf, int buf_len, uint8_t tag, const void* value, int len)
+{
+    if (buf_len < (2 + len)) {
+        return -1;      // 領域不足
+    }
+    buf[0] = tag;
+    buf[1] = (uint8_t)len;
+    memcpy(&buf[2], value, len);
+    return 2 + len;
+}
+
+// ================================================================================================
+// 設定パラメータ → ブロブ変換
+// return : エンコード後の長さ  (領域が足りない場合は -1)
+// ================================================================================================
+int param_blob_encode(const struct app_param* pParam, uint8_t* buf, int buf_len)
+{
+    int     pos = 0;
+    int     ret;
+    uint8_t u32_buf[sizeof(uint32_t)];
+
+    if (buf_len < 1) {
+        return -1;
+    }
+    buf[pos++] = PARAM_BLOB_VERSION;
+
+    // SSID名
+    ret = put_tlv(&buf[pos], buf_len - pos, PARAM_BLOB_TAG_SSID_NAME,
+                  pParam->ssid_name, strnlen(pParam->ssid_name, sizeof(pParam->ssid_name) - 1));
+    if (ret < 0) {
+        return -1;
+    }
+    pos += ret;
+
+    // SSIDパスワード
+    ret = put_tlv(&buf[pos], buf_len - pos, PARAM_BLOB_TAG_SSID_PASS,
+                  pParam->ssid_pass, strnlen(pParam->ssid_pass, sizeof(pParam->ssid_pass) - 1));
+    if (ret < 0) {
+        return -1;
+    }
+    pos += ret;
+
+    // ループインターバル (リトルエンディアン)
+    for (int i = 0; i < sizeof(u32_buf); i++) {
+        u32_buf[i] = (uint8_t)(pParam->loop_interval >> (8 * i));
+    }
+    ret = put_tlv(&buf[pos], buf_len - pos, PARAM_BLOB_TAG_LOOP_IVAL, u32_buf, sizeof(u32_buf));
+    if (ret < 0) {
+        return -1;
+    }
+    pos += ret;
+
+    // 接続先プロファイル (使用中のものだけ)
+    for (int i = 0; i < AP_PROFILE_NUM; i++) {
+        const struct ap_profile*    prof = &pParam->ap_profile[i];
+        uint8_t     prof_buf[PARAM_BLOB_PROFILE_MAX_LEN - 2];
+        int         name_len = strnlen(prof->ssid_name, sizeof(prof->ssid_name) - 1);
+        int         pass_len = strnlen(prof->ssid_pass, sizeof(prof->ssid_pass) - 1);
+        if (name_len == 0) {
+            continue;
+        }
+        prof_buf[0] = (uint8_t)i;
+        prof_buf[1] = prof->priority;
+        prof_buf[2] = (uint8_t)name_len;
+        memcpy(&prof_buf[3],            prof->ssid_name, name_len);
+        memcpy(&prof_buf[3 + name_len], prof->ssid_pass, pass_len);
+        ret = put_tlv(&buf[pos], buf_len - pos, PARAM_BLOB_TAG_AP_PROFILE, prof_buf, 3 + name_len + pass_len);
+        if (ret < 0) {
+            return -1;
+        }
+        pos += ret;
+    }
+
+    return pos;
+}
+
+// ================================================================================================
+// 文字列項目のデコード
+// ================================================================================================
+static bool get_str(char* dst, int dst_size, const uint8_t* value, int len)
+{
+    if (len > (dst_size - 1)) {
+        return false;           // NULL文字の分が入らない
+    }
+    if (memchr(value, '\0', len) != NULL) {
+        return false;           // 途中にNULL文字を含む
+    }
+    memcpy(dst, value, len);
+    memset(&dst[len], 0x00, dst_size - len);       // 後ろをNULLで埋める
+    return true;
+}
+
+// ================================================================================================
+// 接続先プロファイルのデコード
+// ================================================================================================
+static bool get_profile(struct app_param* pParam, const uint8_t* value, int len)
+{
+    if (len < 3 || value[0] >= AP_PROFILE_NUM || (3 + value[2]) > len) {
+        return false;
+    }
+    struct ap_profile   prof;
+    int                 name_len = value[2];
+    if (!get_str(prof.ssid_name, sizeof(prof.ssid_name), &value[3], name_len) ||
+        !get_str(prof.ssid_pass, sizeof(prof.ssid_pass), &value[3 + name_len], len - 3 - name_len)) {
+        return false;
+    }
+    if (name_len == 0) {
+        memset(&prof, 0x00, sizeof(prof));         // 削除
+    }
+    else {
+        prof.priority = value[1];
+    }
+    memcpy(&pParam->ap_profile[value[0]], &prof, sizeof(prof));
+    return true;
+}
+
+// ================================================================================================
+// ブロブ → 設定パラメータ変換 (作業領域指定)
+// 全項目の検証が終わってから pParam に反映するので、エラー時は pParam は変更されない
+// pWork : デコード中の値を組み立てる作業領域 (スタックの小さいタスクからは static な領域を渡す)
+// return : ESP_OK                      正常終了
+//          ESP_ERR_INVALID_VERSION     バージョン不一致
+//          ESP_ERR_INVALID_SIZE        長さ不正
+//          ESP_ERR_INVALID_ARG         設定値不正
+// ================================================================================================
+esp_err_t param_blob_decode_work(const uint8_t* buf, int len, struct app_param* pParam, struct app_param* pWork)
+{
+    int                 pos = 0;
+
+    if (len < 1) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (buf[pos++] != PARAM_BLOB_VERSION) {
+        ESP_LOGW(TAG, "    version mismatch : 0x%02x", buf[0]);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    // 現在値をベースに上書きしていく
+    memcpy(pWork, pParam, sizeof(*pWork));
+
+    while (pos < len) {
+        if ((len - pos) < 2) {
+            return ESP_ERR_INVALID_SIZE;        // tag/lenが途中で切れている
+        }
+        uint8_t         tag     = buf[pos];
+        int             val_len = buf[pos + 1];
+        const uint8_t*  value   = &buf[pos + 2];
+        pos += 2;
+        if ((len - pos) < val_len) {
+            return ESP_ERR_INVALID_SIZE;        // valueが途中で切れている
+        }
+        pos += val_len;
+
+        switch (tag) {
+          case PARAM_BLOB_TAG_SSID_NAME :
+            if (!get_str(pWork->ssid_name, sizeof(pWork->ssid_name), value, val_len)) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            break;
+          case PARAM_BLOB_TAG_SSID_PASS :
+            if (!get_str(pWork->ssid_pass, sizeof(pWork->ssid_pass), value, val_len)) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            break;
+          case PARAM_BLOB_TAG_LOOP_IVAL :
+            if (val_len != sizeof(uint32_t)) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            pWork->loop_interval = (uint32_t)value[0]         | ((uint32_t)value[1] <<  8)
+                              | ((uint32_t)value[2] << 16) | ((uint32_t)value[3] << 24);
+            break;
+          case PARAM_BLOB_TAG_AP_PROFILE :
+            if (!get_profile(pWork, value, val_len)) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            break;
+          default :
+            // 未知のtagは読み飛ばす(新しいホストツールとの互換のため)
+            ESP_LOGW(TAG, "    unknown tag : 0x%02x (skip)", tag);
+            break;
+        }
+    }
+
+    // 設定値のチェック (LoadParam()でエラー扱いになる値は受け付けない)
+    if (strlen(pWork->ssid_name) == 0 || strlen(pWork->ssid_pass) == 0 || pWork->loop_interval == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // まとめて反映
+    memcpy(pParam, pWork, sizeof(*pParam));
+    return ESP_OK;
+}
+
+// ================================================================================================
+// ブロブ → 設定パラメータ変換 (作業領域はスタックに取る)
+// return : param_blob_decode_work() と同じ
+// ================================================================================================
+esp_err_t param_blob_decode(const uint8_t* buf, int len, struct app_param* pParam)
+{
+    struct app_param    work;
+    return param_blob_decode_work(buf, len, pParam, &work);
+}
@@ -0,0 +1,39 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- パラメータブロブのフォーマット ---------------------
+    [0]     : バージョン (PARAM_BLOB_VERSION)
+    [1]～   : TLVの繰り返し
+                tag(1byte)  len(1byte)  value(len byte)
+    数値はリトルエンディアン、文字列はNULL文字を含まない。
+    含まれていないtagの項目は現在値のまま。未知のtagは読み飛ばす。
+
+    接続先プロファイル(PARAM_BLOB_TAG_AP_PROFILE)の value
+                index(1byte)  priority(1byte)  SSID名の長さ(1byte)  SSID名  SSIDパスワード(残り全部)
+                SSID名が空ならそのプロファイルを削除する。エンコード時は使用中のプロファイルだけ出力する
+   ------------------------------------------------------- */
+
+// ==== マクロ定義 ===========================================================================================
+#define PARAM_BLOB_VERSION              0x01            // フォーマットバージョン
+
+// TLV tag
+#define PARAM_BLOB_TAG_SSID_NAME        0x01            // SSID名
+#define PARAM_BLOB_TAG_SSID_PASS        0x02            // SSIDパスワード
+#define PARAM_BLOB_TAG_LOOP_IVAL        0x03            // ループインターバル
+#define PARAM_BLOB_TAG_AP_PROFILE       0x04            // 接続先プロファイル
+
+// エンコード後の最大長
+#define PARAM_BLOB_PROFILE_MAX_LEN      (2 + 3 + SSID_NAME_SIZE - 1 + SSID_PASS_SIZE - 1)
+#define PARAM_BLOB_MAX_LEN              (1 + (2 + SSID_NAME_SIZE - 1) + (2 + SSID_PASS_SIZE - 1) + (2 + sizeof(uint32_t)) \
+                                         + AP_PROFILE_NUM * PARAM_BLOB_PROFILE_MAX_LEN)     // ATTの最大長(512byte)以下にすること
+
+
+// ==== extern 宣言 ===========================================================================================
+extern int          param_blob_encode(const struct app_param* pParam, uint8_t* buf, int buf_len);
+extern esp_err_t    param_blob_decode(const uint8_t* buf, int len, struct app_param* pParam);
+extern esp_err_t    param_blob_decode_work(const uint8_t* buf, int len, struct app_param* pParam, struct app_param* pWork);
@@ -13,6 +13,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/timers.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -24,10 +25,19 @@
 #include "esp_bt_main.h"
 
 #include "BLE_PARAM_CONFIG.h"
+#include "param_blob.h"
+#include "prep_queue.h"
+#include "param_handle_index.h"
+#include "param_ctrl.h"
+#include "wifi_common.h"
+#include "boot_prof.h"
 
 // LOG表示用TAG(関数名にしておく)
 #define     TAG             __func__
 
+// ==== マクロ定義 ===========================================================================================
+#define PCONF_COMMIT_DEBOUNCE_MS        500             // 書き込み確定までの待ち時間(この間に次の書き込みがあれば延長)
+
 // ==== static 変数 ===========================================================================================
 // GATTサーバattributeテーブル
 uint16_t         param_config_handle_table[PCONF_IDX_NUM];
@@ -37,16 +47,65 @@ static bool            pconf_is_connected = false;                 // 接続中
 static uint16_t        pconf_conn_id      = 0xffff;                // 接続ID
 static esp_gatt_if_t   pconf_gatts_if     = ESP_GATT_IF_NONE;      // GATTインタフェース
 static esp_bd_addr_t   pconf_remote_bda;                           // リモートのBDアドレス
+static uint16_t        pconf_mtu          = ESP_GATT_DEF_BLE_MTU_SIZE;  // ネゴシエーション済みATT MTU
+static uint16_t        pconf_tx_len       = PARAM_CONFIG_DEF_PKT_DATA_LEN;  // ネゴシエーション済みLLデータ長(送信)
+
+// 書き込み確定用タイマ(最後の書き込みから一定時間経過したら確定する)
+static TimerHandle_t   pconf_commit_timer = NULL;
+static bool            pconf_commit_pending = false;              // 未確定の書き込みあり
+
+// Prepare Write キュー(接続毎にクリア)
+static struct prep_queue    pconf_prep_queue;
+static uint8_t              pconf_exec_buf[PREP_QUEUE_POOL_SIZE];   // Execute Write 時の連結用
+
+// ハンドル→インデックス変換用
+static struct param_handle_index   pconf_handle_index;
+
+// 変更通知
+static TimerHandle_t   pconf_notify_timer = NULL;                  // 通知をまとめるためのタイマ
+static uint16_t        pconf_ccc_blob     = 0x0000;                // CCC設定値(パラメータブロブ)
+static uint16_t        pconf_ccc_gen      = 0x0000;                // CCC設定値(世代番号/CRC)
+static uint16_t        pconf_ccc_ctrl     = 0x0000;                // CCC設定値(コントロールポイント)
+static uint8_t         pconf_notify_buf[PARAM_BLOB_MAX_LEN];       // 通知用バッファ
+
+#if BLE_BONDED_MODE
+// ボンディング済みホストのCCC設定値 (切断時に保存し、次の接続で認証が完了したら戻す)
+// RAM上にだけ持つので、リブートすると消える(ホストが再度CCCを書き込むまで通知されない)
+struct pconf_bond_ccc {
+    bool            used;
+    esp_bd_addr_t   bda;                    // ホストのBDアドレス
+    uint16_t        ccc_blob;
+    uint16_t        ccc_gen;
+    uint16_t        ccc_ctrl;
+};
+static bool                     pconf_peer_bonded  = false;         // 接続中のホストとボンディング済み
+static struct pconf_bond_ccc    pconf_bond_ccc[PARAM_CONFIG_BOND_CCC_NUM];
+static int                      pconf_bond_ccc_next = 0;            // 空きがない場合に上書きする位置
+#endif
+
+// 設定値読み出し用 (確定済みの値のコピー。スタックを節約するためstatic)
+static struct app_param pconf_read_param;
+
+// パラメータブロブ読み出し用バッファ(ロングリード中に値が変わらないよう、offset=0の時点の値を保持する)
+static uint8_t         pconf_blob_buf[PARAM_BLOB_MAX_LEN];
+static int             pconf_blob_len     = 0;
+
+// Wi-Fi接続統計情報読み出し用バッファ(ロングリード中に値が変わらないよう、offset=0の時点の値を保持する)
+static uint8_t         pconf_wifi_stats_buf[WIFI_STATS_MAX_LEN];
+static int             pconf_wifi_stats_len = 0;
 
 // ==== プロファイルの設定 ======================================================================================
 // characteristicのアクセス種別
 // 未使用 static const uint8_t char_prop_notify               = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
-// 未使用 static const uint8_t char_prop_read                 = ESP_GATT_CHAR_PROP_BIT_READ;
+static const uint8_t char_prop_read                 = ESP_GATT_CHAR_PROP_BIT_READ;
 static const uint8_t char_prop_read_write           = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_READ;
+static const uint8_t char_prop_read_notify          = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t char_prop_read_write_notify    = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t char_prop_write_indicate       = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_INDICATE;
 
 static const uint16_t primary_service_uuid          = ESP_GATT_UUID_PRI_SERVICE;        // プライマリサービス
 static const uint16_t character_declaration_uuid    = ESP_GATT_UUID_CHAR_DECLARE;       // characteristic 宣言
-// static const uint16_t character_client_config_uuid  = ESP_GATT_UUID_CHAR_CLIENT_CONFIG; // CCC (Client Characteristic Configuration Descriptor)
+static const uint16_t character_client_config_uuid  = ESP_GATT_UUID_CHAR_CLIENT_CONFIG; // CCC (Client Characteristic Configuration Descriptor)
 
 // パラメータ設定サービス
 const uint8_t service_uuid[]         = UUID128_to_ARRAY(0xea7542b0, 0xbfae, 0x7587, 0xdc60, 0x45dbf29ca088);     // Service UUID     ea7542b0-bfae-7587-dc60-45dbf29ca088  https://uuid.doratool.com/ などで生成
@@ -60,8 +119,63 @@ const uint8_t    ssid_pass_uuid[]    = UUID128_to_ARRAY(0xea7542b2, 0xbfae, 0x75
 // ループインターバル(Heart Rate Control Point)
 const uint8_t loop_interval_uuid[]   = UUID128_to_ARRAY(0xea7542b3, 0xbfae, 0x7587, 0xdc60, 0x45dbf29ca088);     // UUID             ea7542b3-bfae-7587-dc63-45dbf29ca088
 
+// パラメータ一括(ブロブ)
+const uint8_t param_blob_uuid[]      = UUID128_to_ARRAY(0xea7542b4, 0xbfae, 0x7587, 0xdc60, 0x45dbf29ca088);     // UUID             ea7542b4-bfae-7587-dc60-45dbf29ca088
+
+// パラメータ世代番号/CRC
+const uint8_t param_gen_uuid[]       = UUID128_to_ARRAY(0xea7542b5, 0xbfae, 0x7587, 0xdc60, 0x45dbf29ca088);     // UUID             ea7542b5-bfae-7587-dc60-45dbf29ca088
+
+// コントロールポイント
+const uint8_t param_ctrl_uuid[]      = UUID128_to_ARRAY(0xea7542b6, 0xbfae, 0x7587, 0xdc60, 0x45dbf29ca088);     // UUID             ea7542b6-bfae-7587-dc60-45dbf29ca088
+
+// Wi-Fi接続統計情報
+const uint8_t wifi_stats_uuid[]      = UUID128_to_ARRAY(0xea7542b7, 0xbfae, 0x7587, 0xdc60, 0x45dbf29ca088);     // UUID             ea7542b7-bfae-7587-dc60-45dbf29ca088
+
+// 起動時間の内訳
+const uint8_t boot_prof_uuid[]       = UUID128_to_ARRAY(0xea7542b8, 0xbfae, 0x7587, 0xdc60, 0x45dbf29ca088);     // UUID             ea7542b8-bfae-7587-dc60-45dbf29ca088
+
+// ==== Attribute データベース生成用マクロ ===========================================================================
+// characteristic 宣言
+#define PCONF_CHAR_DECL(prop)   {                                                   \
+        .attr_control = { .auto_rsp = ESP_GATT_AUTO_RSP },                          \
+        .att_desc = {                                                               \
+            .uuid_length    = ESP_UUID_LEN_16,                                      \
+            .uuid_p         = (uint8_t *)&character_declaration_uuid,               \
+            .perm           = ESP_GATT_PERM_READ,                                   \
+            .max_length     = sizeof(prop),                                         \
+            .length         = sizeof(prop),                                         \
+            .value          = (uint8_t *)&(prop)                                    \
+        }                                                                           \
+    }
+
+// characteristic 値  (値の読み書きは param_config_variable_table のハンドラで行うのでアプリで応答する)
+#define PCONF_CHAR_VAL(uuid, max_len)   {                                           \
+        .attr_control = { .auto_rsp = ESP_GATT_RSP_BY_APP },                        \
+        .att_desc = {                                                               \
+            .uuid_length    = sizeof(uuid),                                         \
+            .uuid_p         = (uint8_t *)(uuid),                                    \
+            .perm           = ESP_GATT_PERM_WRITE_ENCRYPTED | ESP_GATT_PERM_READ_ENCRYPTED, \
+            .max_length     = (max_len),                                            \
+            .length         = 0,                                                    \
+            .value          = NULL                                                  \
+        }                                                                           \
+    }
+
+// CCC (Client Characteristic Configuration Descriptor)
+#define PCONF_CHAR_CCC()    {                                                       \
+        .attr_control = { .auto_rsp = ESP_GATT_RSP_BY_APP },                        \
+        .att_desc = {                                                               \
+            .uuid_length    = ESP_UUID_LEN_16,                                      \
+            .uuid_p         = (uint8_t *)&character_client_config_uuid,             \
+            .perm           = ESP_GATT_PERM_WRITE_ENCRYPTED | ESP_GATT_PERM_READ_ENCRYPTED, \
+            .max_length     = sizeof(uint16_t),                                     \
+            .length         = 0,                                                    \
+            .value          = NULL                                                  \
+        }                                                                           \
+    }
+
 /// Attribute データベース
-static esp_gatts_attr_db_t param_config_gatt_db[PCONF_IDX_NUM] =
+static const esp_gatts_attr_db_t param_config_gatt_db[PCONF_IDX_NUM] =
 {
     // ==== サービス宣言 ====
     [PCONF_IDX_SVC] = {                                 // Parameter Configulation Service Declaration
@@ -76,84 +190,64 @@ static esp_gatts_attr_db_t param_config_gatt_db[PCONF_IDX_NUM] =
         }
     },
     // ==== SSID名 ====
-    [PCONF_IDX_SSID_NAME_CHAR] = {                      // characteristic 宣言
-        .attr_control = { .auto_rsp = ESP_GATT_AUTO_RSP }, 
-        .att_desc = {
-            .uuid_length    = ESP_UUID_LEN_16, 
-            .uuid_p         = (uint8_t *)&character_declaration_uuid,
-            .perm           = ESP_GATT_PERM_READ,
-            .max_length     = sizeof(char_prop_read_write),
-            .length         = sizeof(char_prop_read_write),
-            .value          = (uint8_t *)&char_prop_read_write
-        }
-    },
-    [PCONF_IDX_SSID_NAME_VAL] = {                       // characteristic 値
-        .attr_control = { .auto_rsp = ESP_GATT_AUTO_RSP }, 
-        .att_desc = {
-            .uuid_length    = sizeof(ssid_name_uuid), 
-            .uuid_p         = (uint8_t *)ssid_name_uuid,
-            .perm           = ESP_GATT_PERM_WRITE_ENCRYPTED | ESP_GATT_PERM_READ_ENCRYPTED,
-            .max_length     = sizeof(AppParam.ssid_name) - 1,            // NULL文字追加のため、1文字分減らしておく
-            .length         = sizeof(AppParam.ssid_name) - 1,            // あとで書き換え
-            .value          = (uint8_t*)AppParam.ssid_name
-        }
-    }, 
+    [PCONF_IDX_SSID_NAME_CHAR]  = PCONF_CHAR_DECL(char_prop_read_write),
+    [PCONF_IDX_SSID_NAME_VAL]   = PCONF_CHAR_VAL(ssid_name_uuid,     sizeof(AppParam.ssid_name) - 1),       // NULL文字追加のため、1文字分減らしておく
     // ==== SSIDパスワード ====
-    [PCONF_IDX_SSID_PASS_CHAR] = {                      // characteristic 宣言
-        .attr_control = { .auto_rsp = ESP_GATT_AUTO_RSP }, 
-        .att_desc = {
-            .uuid_length    = ESP_UUID_LEN_16, 
-            .uuid_p         = (uint8_t *)&character_declaration_uuid,
-            .perm           = ESP_GATT_PERM_READ,
-            .max_length     = sizeof(char_prop_read_write),
-            .length         = sizeof(char_prop_read_write),
-            .value          = (uint8_t *)&char_prop_read_write
-        }
-    },
-    [PCONF_IDX_SSID_PASS_VAL]  = {                      // characteristic 値
-        .attr_control = { .auto_rsp = ESP_GATT_AUTO_RSP }, 
-        .att_desc = {
-            .uuid_length    = sizeof(ssid_pass_uuid), 
-            .uuid_p         = (uint8_t *)ssid_pass_uuid,
-            .perm           = ESP_GATT_PERM_WRITE_ENCRYPTED | ESP_GATT_PERM_READ_ENCRYPTED,
-            .max_length     = sizeof(AppParam.ssid_pass) - 1,            // NULL文字追加のため、1文字分減らしておく
-            .length         = sizeof(AppParam.ssid_pass) - 1,            // あとで書き換え
-            .value          = (uint8_t *)AppParam.ssid_pass
-        }
-    },
+    [PCONF_IDX_SSID_PASS_CHAR]  = PCONF_CHAR_DECL(char_prop_read_write),
+    [PCONF_IDX_SSID_PASS_VAL]   = PCONF_CHAR_VAL(ssid_pass_uuid,     sizeof(AppParam.ssid_pass) - 1),       // NULL文字追加のため、1文字分減らしておく
     // ==== ループインターバル ====
-    [PCONF_IDX_LOOP_IVAL_CHAR]      = {              // characteristic 宣言
-        .attr_control = { .auto_rsp = ESP_GATT_AUTO_RSP }, 
-        .att_desc = {
-            .uuid_length    = ESP_UUID_LEN_16, 
-            .uuid_p         = (uint8_t *)&character_declaration_uuid,
-            .perm           = ESP_GATT_PERM_READ,
-            .max_length     = sizeof(char_prop_read_write),
-            .length         = sizeof(char_prop_read_write),
-            .value          = (uint8_t *)&char_prop_read_write
-        }
-    },    [PCONF_IDX_LOOP_IVAL_VAL] = {              // characteristic 値
-        .attr_control = { .auto_rsp = ESP_GATT_AUTO_RSP }, 
-        .att_desc = {
-            .uuid_length    = sizeof(loop_interval_uuid), 
-            .uuid_p         = (uint8_t *)loop_interval_uuid,
-            .perm           = ESP_GATT_PERM_WRITE_ENCRYPTED | ESP_GATT_PERM_READ_ENCRYPTED,
-            .max_length     = sizeof(AppParam.loop_interval), 
-            .length         = sizeof(AppParam.loop_interval),
-            .value          = (uint8_t *)&AppParam.loop_interval
-        }
-    },
+    [PCONF_IDX_LOOP_IVAL_CHAR]  = PCONF_CHAR_DECL(char_prop_read_write),
+    [PCONF_IDX_LOOP_IVAL_VAL]   = PCONF_CHAR_VAL(loop_interval_uuid, sizeof(AppParam.loop_interval)),
+    // ==== パラメータ一括(ブロブ) ====
+    [PCONF_IDX_PARAM_BLOB_CHAR] = PCONF_CHAR_DECL(char_prop_read_write_notify),
+    [PCONF_IDX_PARAM_BLOB_VAL]  = PCONF_CHAR_VAL(param_blob_uuid,    PARAM_BLOB_MAX_LEN),
+    [PCONF_IDX_PARAM_BLOB_CCC]  = PCONF_CHAR_CCC(),
+    // ==== パラメータ世代番号/CRC ====
+    [PCONF_IDX_PARAM_GEN_CHAR]  = PCONF_CHAR_DECL(char_prop_read_notify),
+    [PCONF_IDX_PARAM_GEN_VAL]   = PCONF_CHAR_VAL(param_gen_uuid,     PARAM_CONFIG_GEN_LEN),
+    [PCONF_IDX_PARAM_GEN_CCC]   = PCONF_CHAR_CCC(),
+    // ==== コントロールポイント ====
+    [PCONF_IDX_CTRL_CHAR]       = PCONF_CHAR_DECL(char_prop_write_indicate),
+    [PCONF_IDX_CTRL_VAL]        = PCONF_CHAR_VAL(param_ctrl_uuid,    sizeof(uint8_t)),
+    [PCONF_IDX_CTRL_CCC]        = PCONF_CHAR_CCC(),
+    // ==== Wi-Fi接続統計情報 ====
+    [PCONF_IDX_WIFI_STATS_CHAR] = PCONF_CHAR_DECL(char_prop_read),
+    [PCONF_IDX_WIFI_STATS_VAL]  = PCONF_CHAR_VAL(wifi_stats_uuid,    WIFI_STATS_MAX_LEN),
+    // ==== 起動時間の内訳 ====
+    [PCONF_IDX_BOOT_PROF_CHAR]  = PCONF_CHAR_DECL(char_prop_read),
+    [PCONF_IDX_BOOT_PROF_VAL]   = PCONF_CHAR_VAL(boot_prof_uuid,     BOOT_PROF_MAX_LEN),
 };
 
-// characteristic - プログラム内変数対応テーブル
-struct char_var_tab param_config_variable_table[PCONF_IDX_NUM] = {
-    [PCONF_IDX_SVC]             = {NULL,                                                 0   },  // サービス宣言
-    [PCONF_IDX_SSID_NAME_CHAR]  = {NULL,                                                 0   },  // SSID名 宣言
-    [PCONF_IDX_SSID_NAME_VAL]   = {AppParam.ssid_name,       sizeof(AppParam.ssid_name)       },  // SSID名 (Read/Write)
-    [PCONF_IDX_SSID_PASS_CHAR]  = {NULL,                                                  0   },  // SSIDパスワード 宣言
-    [PCONF_IDX_SSID_PASS_VAL]   = {AppParam.ssid_pass,       sizeof(AppParam.ssid_pass)       },  // SSIDパスワード 値(Read/Write)
-    [PCONF_IDX_LOOP_IVAL_CHAR]  = {NULL,                                                  0   },  // ループインターバル 宣言
-    [PCONF_IDX_LOOP_IVAL_VAL]   = {&AppParam.loop_interval,  sizeof(AppParam.loop_interval)   },  // ループインターバル 値(Read/Write)
+// ==== 型別 Read/Write ハンドラ ===============================================================================
+static esp_gatt_status_t pconf_read_str(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp);
+static esp_gatt_status_t pconf_write_str(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len);
+static esp_gatt_status_t pconf_read_u32(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp);
+static esp_gatt_status_t pconf_write_u32(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len);
+static esp_gatt_status_t pconf_read_blob(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp);
+static esp_gatt_status_t pconf_write_blob(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len);
+static esp_gatt_status_t pconf_read_gen(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp);
+static esp_gatt_status_t pconf_read_ccc(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp);
+static esp_gatt_status_t pconf_write_ccc(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len);
+static esp_gatt_status_t pconf_write_ccc_ind(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len);
+static esp_gatt_status_t pconf_write_ctrl(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len);
+static esp_gatt_status_t pconf_read_wifi_stats(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp);
+static esp_gatt_status_t pconf_read_boot_prof(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp);
+
+// characteristic - プログラム内変数対応テーブル  (宣言などハンドラのないattributeは記述不要)
+// 書き込みは編集用バッファ(AppParamStage)に行い、確定(CommitParam())するまでアプリケーションからは見えない
+// 読み出しは確定済みの値(AppParam)から行う (dispatch_read()参照)。未確定の書き込みは確定するまで読めない
+static const struct char_var_tab param_config_variable_table[PCONF_IDX_NUM] = {
+    [PCONF_IDX_SSID_NAME_VAL]   = {AppParamStage.ssid_name,      sizeof(AppParamStage.ssid_name),      pconf_read_str,  pconf_write_str  },  // SSID名 (Read/Write)
+    [PCONF_IDX_SSID_PASS_VAL]   = {AppParamStage.ssid_pass,      sizeof(AppParamStage.ssid_pass),      pconf_read_str,  pconf_write_str  },  // SSIDパスワード 値(Read/Write)
+    [PCONF_IDX_LOOP_IVAL_VAL]   = {&AppParamStage.loop_interval, sizeof(AppParamStage.loop_interval),  pconf_read_u32,  pconf_write_u32  },  // ループインターバル 値(Read/Write)
+    [PCONF_IDX_PARAM_BLOB_VAL]  = {&AppParamStage,               sizeof(AppParamStage),                pconf_read_blob, pconf_write_blob },  // パラメータ一括 値(Read/Write)
+    [PCONF_IDX_PARAM_BLOB_CCC]  = {&pconf_ccc_blob,              sizeof(pconf_ccc_blob),               pconf_read_ccc,  pconf_write_ccc  },  // パラメータ一括 CCC
+    [PCONF_IDX_PARAM_GEN_VAL]   = {NULL,                         PARAM_CONFIG_GEN_LEN,                 pconf_read_gen,  NULL             },  // 世代番号/CRC 値(Read)
+    [PCONF_IDX_PARAM_GEN_CCC]   = {&pconf_ccc_gen,               sizeof(pconf_ccc_gen),                pconf_read_ccc,  pconf_write_ccc  },  // 世代番号/CRC CCC
+    [PCONF_IDX_CTRL_VAL]        = {NULL,                         sizeof(uint8_t),                      NULL,            pconf_write_ctrl },  // コントロールポイント 値(Write)
+    [PCONF_IDX_CTRL_CCC]        = {&pconf_ccc_ctrl,              sizeof(pconf_ccc_ctrl),               pconf_read_ccc,  pconf_write_ccc_ind },  // コントロールポイント CCC
+    [PCONF_IDX_WIFI_STATS_VAL]  = {NULL,                         WIFI_STATS_MAX_LEN,                   pconf_read_wifi_stats, NULL       },  // Wi-Fi接続統計情報 値(Read)
+    [PCONF_IDX_BOOT_PROF_VAL]   = {NULL,                         BOOT_PROF_MAX_LEN,                    pconf_read_boot_prof,  NULL       },  // 起動時間の内訳 値(Read)
 };
 
 // ================================================================================================
@@ -161,13 +255,653 @@ struct char_var_tab param_config_variable_table[PCONF_IDX_NUM] = {
 // ================================================================================================
 static int handle_to_index(uint16_t handle)
 {
-    int                 idx;
-    for (idx = 0; idx < PCONF_IDX_NUM; idx++) {    // 一致するハンドルを探す
-        if ( handle == param_config_handle_table[idx]) {
-            return idx;
+    return param_handle_index_lookup(&pconf_handle_index, handle);
+}
+
+#if BLE_BONDED_MODE
+// ================================================================================================
+// ボンディング済みホストのCCC設定値の検索
+// return : 見つからない場合は NULL
+// ================================================================================================
+static struct pconf_bond_ccc* find_bond_ccc(const uint8_t* bd_addr)
+{
+    for (int i = 0; i < PARAM_CONFIG_BOND_CCC_NUM; i++) {
+        if (pconf_bond_ccc[i].used && memcmp(pconf_bond_ccc[i].bda, bd_addr, sizeof(esp_bd_addr_t)) == 0) {
+            return &pconf_bond_ccc[i];
+        }
+    }
+    return NULL;
+}
+
+// ================================================================================================
+// 接続中のホストのCCC設定値を保存 (切断時)
+// ================================================================================================
+static void save_bond_ccc(void)
+{
+    struct pconf_bond_ccc*  bond = find_bond_ccc(pconf_remote_bda);
+
+    if (bond == NULL) {
+        bond = &pconf_bond_ccc[pconf_bond_ccc_next];        // 空きがなければ古いものから上書き
+        for (int i = 0; i < PARAM_CONFIG_BOND_CCC_NUM; i++) {
+            if (!pconf_bond_ccc[i].used) {
+                bond = &pconf_bond_ccc[i];
+                break;
+            }
+        }
+        if (bond == &pconf_bond_ccc[pconf_bond_ccc_next]) {
+            pconf_bond_ccc_next = (pconf_bond_ccc_next + 1) % PARAM_CONFIG_BOND_CCC_NUM;
+        }
+        bond->used = true;
+        memcpy(bond->bda, pconf_remote_bda, sizeof(bond->bda));
+    }
+    bond->ccc_blob = pconf_ccc_blob;
+    bond->ccc_gen  = pconf_ccc_gen;
+    bond->ccc_ctrl = pconf_ccc_ctrl;
+}
+
+// ================================================================================================
+// 認証完了の通知 (GAPのコールバックから呼ばれる)
+// ボンディング済みのホストなら、前回の接続のCCC設定値を戻す
+// (暗号化される前に通知しないよう、接続時ではなく認証完了時に戻す)
+// ================================================================================================
+void param_config_auth_complete(const uint8_t* bd_addr, bool bonded)
+{
+    if (!pconf_is_connected || memcmp(bd_addr, pconf_remote_bda, sizeof(esp_bd_addr_t)) != 0) {
+        return;
+    }
+    pconf_peer_bonded = bonded;
+    if (!bonded) {
+        return;
+    }
+    struct pconf_bond_ccc*  bond = find_bond_ccc(bd_addr);
+    if (bond != NULL) {
+        pconf_ccc_blob = bond->ccc_blob;
+        pconf_ccc_gen  = bond->ccc_gen;
+        pconf_ccc_ctrl = bond->ccc_ctrl;
+        ESP_LOGI(TAG, "    CCC restored : blob 0x%04x / gen 0x%04x / ctrl 0x%04x", pconf_ccc_blob, pconf_ccc_gen, pconf_ccc_ctrl);
+    }
+}
+
+// ================================================================================================
+// ボンディング削除の通知 (GAPのコールバックから呼ばれる)
+// ================================================================================================
+void param_config_forget_bond(const uint8_t* bd_addr)
+{
+    struct pconf_bond_ccc*  bond = find_bond_ccc(bd_addr);
+    if (bond != NULL) {
+        bond->used = false;
+    }
+}
+#endif
+
+// ================================================================================================
+// LLデータ長の通知 (GAPのコールバックから呼ばれる)
+// 接続は1つだけなので、接続中なら現在の接続の値として記憶する(GATTSと同じBTCタスクから呼ばれるので排他は不要)
+// Notify/Read応答は1回分がMTU以下なので、LLパケットへの分割はコントローラに任せる
+// ================================================================================================
+void param_config_set_pkt_data_len(uint16_t tx_len, uint16_t rx_len)
+{
+    if (pconf_is_connected) {
+        pconf_tx_len = tx_len;
+    }
+    ESP_LOGI(TAG, "    data length : tx %d / rx %d   (MTU %d)", tx_len, rx_len, pconf_mtu);
+}
+
+// ================================================================================================
+// 1回のRead応答/Notifyで送れるデータ長
+// ================================================================================================
+uint16_t param_config_get_chunk_size(void)
+{
+    return pconf_mtu - 1;           // ATT Read Response / Handle Value Notification のヘッダ分を引く
+}
+
+// ================================================================================================
+// 書き込み確定
+// ================================================================================================
+void param_config_commit(void)
+{
+    bool    committed = false;
+
+    if (pconf_commit_timer) {
+        xTimerStop(pconf_commit_timer, 0);
+    }
+    LockParamStage();
+    if (pconf_commit_pending) {
+        pconf_commit_pending = false;
+        CommitParam();
+        committed = true;
+    }
+    UnlockParamStage();
+    if (committed) {
+        ESP_LOGI(TAG, "    parameters committed");
+    }
+}
+
+// ================================================================================================
+// 未確定の書き込みを破棄 (編集用バッファを確定済みの値に戻す)
+// ================================================================================================
+void param_config_discard(void)
+{
+    if (pconf_commit_timer) {
+        xTimerStop(pconf_commit_timer, 0);
+    }
+    LockParamStage();
+    pconf_commit_pending = false;
+    UnlockParamStage();
+    StageParam();
+}
+
+// ================================================================================================
+// 未確定の書き込みの確定をワーカータスクに依頼 (切断時)
+// BTCタスクのスタックでCRC計算/変更通知を行わないため、ここでは確定しない
+// ================================================================================================
+static void request_commit(void)
+{
+    LockParamStage();
+    bool    pending = pconf_commit_pending;
+    UnlockParamStage();
+
+    if (pending && !param_ctrl_post(PARAM_CTRL_OP_STAGE_COMMIT) && pconf_commit_timer) {
+        xTimerReset(pconf_commit_timer, 0);     // キューが空いていないので書き込み確定タイマに任せる
+    }
+}
+
+// ================================================================================================
+// 書き込み確定タイマのコールバック
+// タイマデーモンはスタックが小さいので、確定処理はワーカータスクに依頼する
+// ================================================================================================
+static void commit_timer_cb(TimerHandle_t timer)
+{
+    if (!param_ctrl_post(PARAM_CTRL_OP_STAGE_COMMIT)) {
+        xTimerReset(timer, 0);          // キューが空いていないので後でやり直す
+    }
+}
+
+// ================================================================================================
+// 文字列 Read
+// ================================================================================================
+static esp_gatt_status_t pconf_read_str(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp)
+{
+    uint16_t    len = strnlen((const char*)var->value, var->length - 1);
+    if (offset > len) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+    rsp->attr_value.len = len - offset;
+    memcpy(rsp->attr_value.value, (const uint8_t*)var->value + offset, rsp->attr_value.len);
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// 文字列 Write
+// ================================================================================================
+static esp_gatt_status_t pconf_write_str(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len)
+{
+    uint8_t*    var_ptr = var->value;
+    if ((offset + len) > (var->length - 1)) {           // NULL文字の分を空けておく
+        return ESP_GATT_INVALID_ATTR_LEN;
+    }
+    memcpy(&var_ptr[offset], value, len);
+    // 設定値の後ろをNULLで埋める(文字列のNULL Terminateのため)
+    memset(&var_ptr[offset + len], 0x00, var->length - (offset + len));
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// 数値(uint32_t) Read
+// ================================================================================================
+static esp_gatt_status_t pconf_read_u32(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp)
+{
+    if (offset > sizeof(uint32_t)) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+    rsp->attr_value.len = sizeof(uint32_t) - offset;
+    memcpy(rsp->attr_value.value, (const uint8_t*)var->value + offset, rsp->attr_value.len);
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// 数値(uint32_t) Write
+// ================================================================================================
+static esp_gatt_status_t pconf_write_u32(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len)
+{
+    uint32_t    tmp = 0;
+    if (offset != 0 || len > sizeof(uint32_t)) {
+        return ESP_GATT_INVALID_ATTR_LEN;
+    }
+    memcpy(&tmp, value, len);       // 短い場合も以前の上位バイトが残らないよう0から組み立てる
+    *(uint32_t*)var->value = tmp;
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// パラメータブロブ Read
+// ================================================================================================
+static esp_gatt_status_t pconf_read_blob(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp)
+{
+    if (offset == 0) {
+        // 先頭からの読み出しのときだけエンコードし直す
+        pconf_blob_len = param_blob_encode(var->value, pconf_blob_buf, sizeof(pconf_blob_buf));
+        if (pconf_blob_len < 0) {
+            pconf_blob_len = 0;
+            return ESP_GATT_ERR_UNLIKELY;
         }
     }
-    return -1;      // 見つからなかった
+    if (offset > pconf_blob_len) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+    // MTUを超える分は呼び出し元で切り詰める
+    rsp->attr_value.len = pconf_blob_len - offset;
+    memcpy(rsp->attr_value.value, &pconf_blob_buf[offset], rsp->attr_value.len);
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// Wi-Fi接続統計情報 Read
+// ================================================================================================
+static esp_gatt_status_t pconf_read_wifi_stats(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp)
+{
+    if (offset == 0) {
+        // 先頭からの読み出しのときだけエンコードし直す
+        pconf_wifi_stats_len = wifi_encode_stats(pconf_wifi_stats_buf, sizeof(pconf_wifi_stats_buf));
+        if (pconf_wifi_stats_len < 0) {
+            pconf_wifi_stats_len = 0;
+            return ESP_GATT_ERR_UNLIKELY;
+        }
+    }
+    if (offset > pconf_wifi_stats_len) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+    // MTUを超える分は呼び出し元で切り詰める
+    rsp->attr_value.len = pconf_wifi_stats_len - offset;
+    memcpy(rsp->attr_value.value, &pconf_wifi_stats_buf[offset], rsp->attr_value.len);
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// 起動時間の内訳 Read
+// 記録は起動時にしか増えないので、読み出しの度にエンコードし直す
+// ================================================================================================
+static esp_gatt_status_t pconf_read_boot_prof(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp)
+{
+    static uint8_t  buf[BOOT_PROF_MAX_LEN];     // スタックを節約するためstatic (BTCタスクからしか呼ばれない)
+    int         len = boot_prof_encode(buf, sizeof(buf));
+    if (len < 0) {
+        return ESP_GATT_ERR_UNLIKELY;
+    }
+    if (offset > len) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+    // MTUを超える分は呼び出し元で切り詰める
+    rsp->attr_value.len = len - offset;
+    memcpy(rsp->attr_value.value, &buf[offset], rsp->attr_value.len);
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// パラメータブロブ Write
+// ================================================================================================
+static esp_gatt_status_t pconf_write_blob(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len)
+{
+    if (offset != 0) {
+        // ブロブは全体をまとめて書き込むこと(MTUを大きくするか、Prepare/Execute Writeを使う)
+        return ESP_GATT_REQ_NOT_SUPPORTED;
+    }
+    static struct app_param work;           // デコード用作業領域 (BTCタスクのスタックを節約するためstatic。BTCタスクからしか呼ばれない)
+
+    // 検証がすべて通った場合のみ反映される
+    esp_err_t err = param_blob_decode_work(value, len, var->value, &work);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "    param blob rejected : %s", esp_err_to_name(err));
+        return (err == ESP_ERR_INVALID_SIZE) ? ESP_GATT_INVALID_ATTR_LEN : ESP_GATT_ILLEGAL_PARAMETER;
+    }
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// 世代番号/CRC の値を作成
+// [0-3] 世代番号  [4-7] CRC32  (リトルエンディアン)
+// ================================================================================================
+static void make_gen_value(uint8_t* buf)
+{
+    uint32_t    generation;
+    uint32_t    crc;
+    GetParamGenCrc(&generation, &crc);
+    for (int i = 0; i < sizeof(uint32_t); i++) {
+        buf[i]                    = (uint8_t)(generation >> (8 * i));
+        buf[sizeof(uint32_t) + i] = (uint8_t)(crc        >> (8 * i));
+    }
+}
+
+// ================================================================================================
+// 世代番号/CRC Read
+// ================================================================================================
+static esp_gatt_status_t pconf_read_gen(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp)
+{
+    uint8_t     value[PARAM_CONFIG_GEN_LEN];
+    if (offset > sizeof(value)) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+    make_gen_value(value);
+    rsp->attr_value.len = sizeof(value) - offset;
+    memcpy(rsp->attr_value.value, &value[offset], rsp->attr_value.len);
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// CCC Read
+// ================================================================================================
+static esp_gatt_status_t pconf_read_ccc(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp)
+{
+    if (offset != 0) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+    rsp->attr_value.len = sizeof(uint16_t);
+    memcpy(rsp->attr_value.value, var->value, sizeof(uint16_t));
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// CCC Write
+// ================================================================================================
+static esp_gatt_status_t pconf_write_ccc(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len)
+{
+    if (offset != 0 || len != sizeof(uint16_t)) {
+        return ESP_GATT_INVALID_ATTR_LEN;
+    }
+    uint16_t    ccc = value[0] | (value[1] << 8);
+    if (ccc & ~0x0001) {
+        return ESP_GATT_REQ_NOT_SUPPORTED;      // Notifyのみ対応(Indicateは不可)
+    }
+    *(uint16_t*)var->value = ccc;
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// CCC Write (Indicate用)
+// ================================================================================================
+static esp_gatt_status_t pconf_write_ccc_ind(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len)
+{
+    if (offset != 0 || len != sizeof(uint16_t)) {
+        return ESP_GATT_INVALID_ATTR_LEN;
+    }
+    uint16_t    ccc = value[0] | (value[1] << 8);
+    if (ccc & ~0x0002) {
+        return ESP_GATT_REQ_NOT_SUPPORTED;      // Indicateのみ対応(Notifyは不可)
+    }
+    *(uint16_t*)var->value = ccc;
+    return ESP_GATT_OK;
+}
+
+// ================================================================================================
+// コントロールポイント Write
+// 受け付けたら書き込みには正常応答し、実行結果はIndicationで返す
+// ================================================================================================
+static esp_gatt_status_t pconf_write_ctrl(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len)
+{
+    if (offset != 0 || len != sizeof(uint8_t)) {
+        return ESP_GATT_INVALID_ATTR_LEN;
+    }
+    switch (param_ctrl_request(value[0])) {
+      case PARAM_CTRL_STATUS_SUCCESS :
+        return ESP_GATT_OK;
+      case PARAM_CTRL_STATUS_BUSY :
+        return ESP_GATT_BUSY;
+      default :
+        return ESP_GATT_REQ_NOT_SUPPORTED;
+    }
+}
+
+// ================================================================================================
+// コントロールポイントの実行結果通知 (ワーカータスクから呼ばれる)
+// ================================================================================================
+static void ctrl_result(uint8_t opcode, uint8_t status)
+{
+    if (!pconf_is_connected || !(pconf_ccc_ctrl & 0x0002)) {
+        return;
+    }
+    uint8_t     value[PARAM_CTRL_RSP_LEN] = { PARAM_CTRL_RSP_CODE, opcode, status };
+    esp_ble_gatts_send_indicate(pconf_gatts_if, pconf_conn_id, param_config_handle_table[PCONF_IDX_CTRL_VAL],
+                                sizeof(value), value, true);
+}
+
+// ================================================================================================
+// 変更通知の送信 (ワーカータスクから呼ばれる)
+// ================================================================================================
+void param_config_notify_changed(void)
+{
+    static struct app_param     param;          // スタックを節約するためstatic (ワーカータスクからしか呼ばれない)
+
+    if (!pconf_is_connected) {
+        return;
+    }
+
+    if (pconf_ccc_gen & 0x0001) {
+        uint8_t     value[PARAM_CONFIG_GEN_LEN];
+        make_gen_value(value);
+        esp_ble_gatts_send_indicate(pconf_gatts_if, pconf_conn_id, param_config_handle_table[PCONF_IDX_PARAM_GEN_VAL],
+                                    sizeof(value), value, false);
+    }
+    if (pconf_ccc_blob & 0x0001) {
+        GetParam(&param);
+        int     len = param_blob_encode(&param, pconf_notify_buf, sizeof(pconf_notify_buf));
+        if (len > 0 && len <= (pconf_mtu - 3)) {        // Notifyに収まらない場合は送らない(ホストがReadする)
+            esp_ble_gatts_send_indicate(pconf_gatts_if, pconf_conn_id, param_config_handle_table[PCONF_IDX_PARAM_BLOB_VAL],
+                                        len, pconf_notify_buf, false);
+        }
+    }
+}
+
+// ================================================================================================
+// 変更通知タイマのコールバック
+// 遅延中に複数回確定されても通知は1回だけ送る
+// タイマデーモンはスタックが小さいので、ブロブのエンコードと送信はワーカータスクに依頼する
+// ================================================================================================
+static void notify_timer_cb(TimerHandle_t timer)
+{
+    if (pconf_is_connected && !param_ctrl_post(PARAM_CTRL_OP_CHANGE_NOTIFY)) {
+        xTimerReset(timer, 0);          // キューが空いていないので後でやり直す
+    }
+}
+
+// ================================================================================================
+// パラメータ確定時に呼ばれる (CommitParam()から呼ばれるので、どのタスクから呼ばれるかは不定)
+// ================================================================================================
+static void param_changed(uint32_t generation)
+{
+    // advertising の世代番号/CRCを更新
+    update_manufacturer_data();
+
+    if (pconf_notify_timer && pconf_is_connected) {
+        // 既にタイマが動いている場合は延長しない(通知が遅れすぎないように)
+        if (!xTimerIsTimerActive(pconf_notify_timer)) {
+            xTimerStart(pconf_notify_timer, 0);
+        }
+    }
+}
+
+// ================================================================================================
+// NVSへの保存/消去時に呼ばれる (保存したタスクから呼ばれる)
+// ================================================================================================
+static void param_saved(void)
+{
+    // advertising の保存済みフラグを更新 (変化がなければ何もしない)
+    update_manufacturer_data();
+}
+
+// ================================================================================================
+// Wi-Fi接続状態の変化 (イベントループのタスクから呼ばれる)
+// ================================================================================================
+static void wifi_status_changed(void)
+{
+    // advertising の状態フラグ/切断理由を更新 (変化がなければ何もしない)
+    update_manufacturer_data();
+}
+
+// ================================================================================================
+// ステージング領域(AppParamStage)の項目か?
+// CCCなど接続毎の設定値は確定処理の対象外
+// ================================================================================================
+static bool is_stage_var(const struct char_var_tab* var)
+{
+    const uint8_t*  p = (const uint8_t*)var->value;
+    return (p >= (const uint8_t*)&AppParamStage) && (p < (const uint8_t*)(&AppParamStage + 1));
+}
+
+// ================================================================================================
+// Readイベントの振り分け
+// ================================================================================================
+static void dispatch_read(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+    static esp_gatt_rsp_t   rsp;            // 約600byteあるのでstatic (BTCタスクからしか呼ばれない)
+    esp_gatt_status_t   status = ESP_GATT_READ_NOT_PERMIT;
+
+    if (!param->read.need_rsp) {
+        return;         // スタックが応答済み(auto_rspのattribute)
+    }
+
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.attr_value.handle = param->read.handle;
+    rsp.attr_value.offset = param->read.offset;
+
+    int     idx = handle_to_index(param->read.handle);
+    if (idx >= 0 && param_config_variable_table[idx].read) {
+        const struct char_var_tab*  var = &param_config_variable_table[idx];
+        if (is_stage_var(var)) {
+            // 設定値は確定済みの値(AppParam)を返す (世代番号/CRCやadvertisingと一致させるため)
+            // 書き込み先は編集用バッファなので、同じ位置を確定済みの値のコピーに置き換えて読み出す
+            struct char_var_tab     committed = *var;
+            GetParam(&pconf_read_param);
+            committed.value = (uint8_t*)&pconf_read_param + ((const uint8_t*)var->value - (const uint8_t*)&AppParamStage);
+            status = committed.read(&committed, param->read.offset, &rsp);
+        }
+        else {
+            status = var->read(var, param->read.offset, &rsp);
+        }
+        if (rsp.attr_value.len > param_config_get_chunk_size()) {
+            // 1回の応答はMTUに合わせて切り詰める(残りはRead Blobで要求される)
+            rsp.attr_value.len = param_config_get_chunk_size();
+        }
+    }
+    esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, status, &rsp);
+}
+
+// ================================================================================================
+// Prepare Write 処理
+// ================================================================================================
+static void prepare_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+    esp_gatt_status_t   status = ESP_GATT_OK;
+    static esp_gatt_rsp_t   rsp;            // 約600byteあるのでstatic (BTCタスクからしか呼ばれない)
+
+    int     idx = handle_to_index(param->write.handle);
+    if (idx < 0 || param_config_variable_table[idx].write == NULL) {
+        status = ESP_GATT_WRITE_NOT_PERMIT;
+    }
+    else if (!is_stage_var(&param_config_variable_table[idx])) {
+        // コントロールポイント/CCCは即時に実行されるので、Execute Writeでまとめて取り消せない
+        // (後のフラグメントが失敗してもリブートなどは取り消せない)ため、Prepare Writeでは受け付けない
+        status = ESP_GATT_REQ_NOT_SUPPORTED;
+    }
+    else if (param->write.offset > param_config_gatt_db[idx].att_desc.max_length) {
+        status = ESP_GATT_INVALID_OFFSET;
+    }
+    else if ((param->write.offset + param->write.len) > param_config_gatt_db[idx].att_desc.max_length) {
+        status = ESP_GATT_INVALID_ATTR_LEN;
+    }
+    else if (prep_queue_push(&pconf_prep_queue, param->write.handle, param->write.offset,
+                             param->write.value, param->write.len) != ESP_OK) {
+        status = ESP_GATT_PREPARE_Q_FULL;
+    }
+
+    if (param->write.need_rsp) {
+        // Prepare Write Response には受け取った値をそのまま返す
+        memset(&rsp, 0, sizeof(rsp));
+        rsp.attr_value.handle = param->write.handle;
+        rsp.attr_value.offset = param->write.offset;
+        rsp.attr_value.len    = param->write.len;
+        memcpy(rsp.attr_value.value, param->write.value, param->write.len);
+        esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, &rsp);
+    }
+}
+
+// ================================================================================================
+// Execute Write 処理
+// キューのフラグメントをハンドル毎に連結して書き込む。1つでも失敗したらすべて書き込み前に戻す
+// キューには編集用バッファの項目しか入らない(prepare_write()で弾く)ので、失敗しても副作用は残らない
+// ================================================================================================
+static void execute_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+    static struct app_param backup;         // 失敗時の復元用 (スタックを節約するためstatic)
+    esp_gatt_status_t   status = ESP_GATT_OK;
+    uint16_t            handles[PREP_QUEUE_ENTRY_NUM];
+
+    if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC) {
+        int     num = prep_queue_handles(&pconf_prep_queue, handles, PREP_QUEUE_ENTRY_NUM);
+
+        LockParamStage();
+        memcpy(&backup, &AppParamStage, sizeof(backup));
+        for (int i = 0; i < num && status == ESP_GATT_OK; i++) {
+            const struct char_var_tab*  var = &param_config_variable_table[handle_to_index(handles[i])];
+            int     len = prep_queue_assemble(&pconf_prep_queue, handles[i], pconf_exec_buf, sizeof(pconf_exec_buf));
+            if (len < 0) {
+                status = ESP_GATT_INVALID_OFFSET;
+                break;
+            }
+            status = var->write(var, 0, pconf_exec_buf, len);
+        }
+        if (status == ESP_GATT_OK) {
+            if (num > 0) {
+                pconf_commit_pending = true;
+                xTimerReset(pconf_commit_timer, 0);
+            }
+        }
+        else {
+            // 途中で失敗したのでまとめて元に戻す
+            ESP_LOGW(TAG, "    execute write rejected : 0x%x", status);
+            memcpy(&AppParamStage, &backup, sizeof(AppParamStage));
+        }
+        UnlockParamStage();
+    }
+    else {
+        // Cancel : キューを破棄するだけ
+        ESP_LOGI(TAG, "    prepare write canceled");
+    }
+    prep_queue_reset(&pconf_prep_queue);
+
+    esp_ble_gatts_send_response(gatts_if, param->exec_write.conn_id, param->exec_write.trans_id, status, NULL);
+}
+
+// ================================================================================================
+// Writeイベントの振り分け
+// ================================================================================================
+static void dispatch_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+    esp_gatt_status_t   status = ESP_GATT_WRITE_NOT_PERMIT;
+
+    int     idx = handle_to_index(param->write.handle);
+    if (param->write.is_prep) {
+        // Prepare Write はキューに貯めておき、Execute Write でまとめて反映する
+        prepare_write(gatts_if, param);
+        return;
+    }
+    else if (idx >= 0 && param_config_variable_table[idx].write) {
+        const struct char_var_tab*  var = &param_config_variable_table[idx];
+        LockParamStage();           // 確定タイマ(別タスク)との排他
+        status = var->write(var, param->write.offset, param->write.value, param->write.len);
+        if (status == ESP_GATT_OK && is_stage_var(var)) {
+            // 連続した書き込みをまとめて確定するため、確定はタイマ満了時に行う
+            pconf_commit_pending = true;
+            xTimerReset(pconf_commit_timer, 0);
+        }
+        UnlockParamStage();
+    }
+    else {
+        ESP_LOGI(TAG, "    variable not defined");
+    }
+
+    if (param->write.need_rsp) {
+        esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, NULL);
+    }
 }
 
 // ================================================================================================
@@ -181,12 +915,23 @@ void param_config_event_handler(esp_gatts_cb_event_t event,
             esp_ble_gap_set_device_name(PARAM_CONFIG_DEVICE_NAME);  // DeviceNameの登録
             esp_ble_gap_config_local_privacy(true);                 // ローカルデバイスでのプライバシー有効化
 
-            // lengthフィールドの設定
-            esp_gatts_attr_db_t* pAttr_db;
-            pAttr_db = &param_config_gatt_db[PCONF_IDX_SSID_NAME_VAL];
-            pAttr_db->att_desc.length = strlen((const char*)pAttr_db->att_desc.value);
-            pAttr_db = &param_config_gatt_db[PCONF_IDX_SSID_PASS_VAL];
-            pAttr_db->att_desc.length = strlen((const char*)pAttr_db->att_desc.value);
+            // 書き込み確定タイマの生成
+            if (pconf_commit_timer == NULL) {
+                pconf_commit_timer = xTimerCreate("pconf_commit", pdMS_TO_TICKS(PCONF_COMMIT_DEBOUNCE_MS),
+                                                  pdFALSE, NULL, commit_timer_cb);
+            }
+            // 変更通知タイマの生成と確定時の通知先登録
+            if (pconf_notify_timer == NULL) {
+                pconf_notify_timer = xTimerCreate("pconf_notify", pdMS_TO_TICKS(PARAM_CONFIG_NOTIFY_DELAY_MS),
+                                                  pdFALSE, NULL, notify_timer_cb);
+            }
+            SetParamChangeHook(param_changed);
+            SetParamSaveHook(param_saved);
+            wifi_set_status_hook(wifi_status_changed);
+            // コントロールポイントのワーカータスク起動
+            if (param_ctrl_start(ctrl_result) != ESP_OK) {
+                ESP_LOGE(TAG, "    param_ctrl_start failed");
+            }
 
             esp_ble_gatts_create_attr_tab(param_config_gatt_db, gatts_if,
                                       PCONF_IDX_NUM, PARAM_CONFIG_SVC_INST_ID);  // Attribute テーブルの登録
@@ -197,6 +942,7 @@ void param_config_event_handler(esp_gatts_cb_event_t event,
                 if(param->add_attr_tab.num_handle == PCONF_IDX_NUM) {
                     // Attribute数が想定した値に等しい
                     memcpy(param_config_handle_table, param->add_attr_tab.handles, sizeof(param_config_handle_table));
+                    param_handle_index_build(&pconf_handle_index, param_config_handle_table, PCONF_IDX_NUM);
 #if 0   // DEBUG
                     // Attributeテーブルの確認
                     ESP_LOGV(TAG, "    The number handle = %x",param->add_attr_tab.num_handle);
@@ -223,50 +969,18 @@ void param_config_event_handler(esp_gatts_cb_event_t event,
         case ESP_GATTS_READ_EVT:                    // Readイベント
             ESP_LOGI(TAG, "    read value");
             ESP_LOGI(TAG, "    handole : %04x", param->read.handle);
+            dispatch_read(gatts_if, param);
             break;
         case ESP_GATTS_WRITE_EVT:                   // writeイベント
             ESP_LOGI(TAG, "    write value:");
             ESP_LOGI(TAG, "    handole : %04x", param->write.handle);
             ESP_LOGI(TAG, "    offset : %d,    length : %d", param->write.offset, param->write.len);
             esp_log_buffer_hex(TAG, param->write.value, param->write.len);
-            // 保持したい領域に自分でコピーする(自動でコピーしてくれない)
-            {
-                int     idx = handle_to_index(param->write.handle);
-                if (idx >= 0) {                 // ハンドルが見つかった
-                    uint8_t* var_ptr = param_config_variable_table[idx].value;
-                    uint16_t var_len = param_config_variable_table[idx].length;
-                    if (var_ptr) {                          // 領域が定義されている
-                        const uint8_t*      char_ptr;
-                        uint16_t            char_len;
-                        // characteristicのデータを読み出して保存
-                        esp_gatt_status_t ret = esp_ble_gatts_get_attr_value(param->write.handle, &char_len, &char_ptr);
-                        if (ret == ESP_GATT_OK) {
-                            ESP_LOGI(TAG, "====[esp_ble_gatts_get_attr_value] :");
-                            esp_log_buffer_hex(TAG, char_ptr, char_len);
-                            // データのコピー
-                            memcpy(var_ptr, char_ptr, char_len);
-                            if (char_len < var_len) {
-                                for (int i = char_len; i < var_len; i++) {
-                                    // 設定値の後ろをNULLで埋める(文字列のNULL Terminateのため)
-                                    // (数値の場合も以前の上位バイトが残ってしまうのでクリア)
-                                    var_ptr[i] = 0x00;
-                                }
-                            }
-                        }
-                        else {
-                            ESP_LOGI(TAG, "    esp_ble_gatts_get_attr_value : ERROR!! %d", ret);
-                        }
-                    }
-                    else {
-                            ESP_LOGI(TAG, "    variable not defined");
-                    }
-                }
-            }
-            /* ---- NOTE ---------------------
-                ここで記憶しておかなくても 任意の場所で
-                    esp_gatt_status_t esp_ble_gatts_get_attr_value(uint16_t attr_handle, uint16_t *length, const uint8_t **value)
-                を使えば読み出せるんだけど、都度読み出すのは面倒なのでここでやっとく。
-               ------------------------------- */
+            dispatch_write(gatts_if, param);
+            break;
+        case ESP_GATTS_EXEC_WRITE_EVT:              // Execute Write イベント(ロングattributeに対する書き込み)
+            ESP_LOGI(TAG, "    exec write flag : %d", param->exec_write.exec_write_flag);
+            execute_write(gatts_if, param);
             break;
         case ESP_GATTS_CONNECT_EVT:                 // 接続要求イベント
             ESP_LOGI(TAG, "    connection start");
@@ -274,13 +988,43 @@ void param_config_event_handler(esp_gatts_cb_event_t event,
             pconf_gatts_if         = gatts_if;
             pconf_is_connected     = true;
             memcpy(pconf_remote_bda, param->connect.remote_bda, sizeof(pconf_remote_bda));
+            pconf_mtu              = ESP_GATT_DEF_BLE_MTU_SIZE;     // MTU交換されるまではデフォルト値
+            pconf_tx_len           = PARAM_CONFIG_DEF_PKT_DATA_LEN; // データ長の変更が完了するまではデフォルト値
+            // LE Data Length Extension を要求 (結果は ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT で通知される)
+            esp_ble_gap_set_pkt_data_len(param->connect.remote_bda, PARAM_CONFIG_PKT_DATA_LEN);
+            {
+                // 編集用バッファを確定済みの値で初期化
+                // (前の接続の書き込みが確定待ちなら、ワーカータスクで確定されるのでそのまま使う)
+                LockParamStage();
+                bool    pending = pconf_commit_pending;
+                UnlockParamStage();
+                if (!pending) {
+                    StageParam();
+                }
+            }
+            prep_queue_reset(&pconf_prep_queue);
             esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT_MITM);
             break;
         case ESP_GATTS_DISCONNECT_EVT:              // 切断要求イベント
             ESP_LOGI(TAG, "    disconnect reason 0x%x", param->disconnect.reason);
+            ESP_LOGI(TAG, "    MTU %d / data length (tx) %d", pconf_mtu, pconf_tx_len);
             pconf_conn_id      = 0xffff;
             pconf_gatts_if     = ESP_GATT_IF_NONE;
             pconf_is_connected = false;
+            pconf_mtu          = ESP_GATT_DEF_BLE_MTU_SIZE;
+            pconf_tx_len       = PARAM_CONFIG_DEF_PKT_DATA_LEN;
+#if BLE_BONDED_MODE
+            if (pconf_peer_bonded) {
+                save_bond_ccc();            // ボンディング済みのホストなら次の接続用にCCCを保存
+            }
+            pconf_peer_bonded  = false;
+#endif
+            pconf_ccc_blob     = 0x0000;    // ボンディングしていないホストのCCCは接続毎にクリア
+            pconf_ccc_gen      = 0x0000;
+            pconf_ccc_ctrl     = 0x0000;
+            prep_queue_reset(&pconf_prep_queue);    // 実行されなかった Prepare Write は破棄
+            request_commit();               // 未確定の書き込みがあれば確定 (ワーカータスクで行う)
+            ble_service_notify(BLE_SERVICE_EVT_DISCONNECTED);   // 停止処理の切断待ちに通知
             // advertising 再開
             start_advertising();
             break;
@@ -296,10 +1040,11 @@ void param_config_event_handler(esp_gatts_cb_event_t event,
         case ESP_GATTS_MTU_EVT:
             ESP_LOGI(TAG, "    conn_id = %d", param->mtu.conn_id);
             ESP_LOGI(TAG, "    mtu     = %d", param->mtu.mtu);
+            if (param->mtu.conn_id == pconf_conn_id) {
+                pconf_mtu = param->mtu.mtu;
+            }
             break;
 #if 0
-        case ESP_GATTS_EXEC_WRITE_EVT:      // ロングattributeに対する書き込み時(今回はロングAttributeがないので発生しない)
-            break;
         case ESP_GATTS_UNREG_EVT:
             break;
         case ESP_GATTS_DELETE_EVT:
@@ -323,15 +1068,48 @@ void param_config_event_handler(esp_gatts_cb_event_t event,
     }
 }
 
-void param_config_disconnect(void)
+// ================================================================================================
+// BLEスタック停止時の後始末
+// スタックを止めると切断イベントが来ないことがあるので、接続状態をここでクリアする
+// タイマ/ワーカータスクは再初期化時にそのまま使う
+// ================================================================================================
+void param_config_deinit(void)
+{
+    SetParamChangeHook(NULL);               // 停止中は advertising/通知の更新をしない
+    SetParamSaveHook(NULL);
+    wifi_set_status_hook(NULL);
+    if (pconf_notify_timer) {
+        xTimerStop(pconf_notify_timer, 0);
+    }
+    param_config_commit();                  // 未確定の書き込みがあれば確定
+
+    pconf_conn_id      = 0xffff;
+    pconf_gatts_if     = ESP_GATT_IF_NONE;
+    pconf_is_connected = false;
+    pconf_mtu          = ESP_GATT_DEF_BLE_MTU_SIZE;
+    pconf_tx_len       = PARAM_CONFIG_DEF_PKT_DATA_LEN;
+#if BLE_BONDED_MODE
+    pconf_peer_bonded  = false;
+#endif
+    pconf_ccc_blob     = 0x0000;
+    pconf_ccc_gen      = 0x0000;
+    pconf_ccc_ctrl     = 0x0000;
+    prep_queue_reset(&pconf_prep_queue);
+}
+
+// ================================================================================================
+// 切断
+// return : 切断要求を出した(ESP_GATTS_DISCONNECT_EVT が来る)なら true
+// ================================================================================================
+bool param_config_disconnect(void)
 {
     // 接続されたままだったら切断する
     if (pconf_is_connected) {           // 接続されていたら
         uint8_t* bd_addr = pconf_remote_bda;
         ESP_LOGI(TAG, "    disconnect :   %02x:%02x:%02x:%02x:%02x:%02x\n",    // BDアドレスの表示
                 bd_addr[0], bd_addr[1], bd_addr[2], bd_addr[3], bd_addr[4], bd_addr[5]);
-        esp_ble_gap_disconnect(pconf_remote_bda);   // Disconnect
+        return esp_ble_gap_disconnect(pconf_remote_bda) == ESP_OK;     // Disconnect
     }
-    return;
+    return false;
 }
 
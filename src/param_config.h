@@ -11,6 +11,12 @@
 #define ESP_PARAM_CONFIG_APP_ID             PARAM_CONFIG_PROFILE_APP_IDX    // 心拍計のアプリケーションID  (プロファイルIDと同じにしておく)
 #define PARAM_CONFIG_DEVICE_NAME            "ESP_PARAM_CONFIG"              // デバイス名
 #define PARAM_CONFIG_SVC_INST_ID            0                               // サービスインスタンスID
+#define PARAM_CONFIG_LOCAL_MTU              247                             // 要求するATT MTU (DLEの最大251byteから L2CAPヘッダ4byteを引いた値 = 1パケットに収まる最大値)
+#define PARAM_CONFIG_PKT_DATA_LEN           251                             // 要求するLLデータ長 (LE Data Length Extension)
+#define PARAM_CONFIG_DEF_PKT_DATA_LEN       27                              // LLデータ長のデフォルト値 (Data Length Extension なし)
+#define PARAM_CONFIG_GEN_LEN                8                               // 世代番号/CRC の長さ (世代番号4byte + CRC32 4byte)
+#define PARAM_CONFIG_BOND_CCC_NUM           4                               // CCCを覚えておくボンディング済みホストの数 (BLE_BONDED_MODE)
+#define PARAM_CONFIG_NOTIFY_DELAY_MS        200                             // 変更通知の遅延時間(この間の変更は1回の通知にまとめる)
 
 
 // ==== enum ===========================================================================================
@@ -28,20 +34,54 @@ enum
     PCONF_IDX_LOOP_IVAL_CHAR,       // ループインターバル
     PCONF_IDX_LOOP_IVAL_VAL,
 
+    PCONF_IDX_PARAM_BLOB_CHAR,      // パラメータ一括(ブロブ)
+    PCONF_IDX_PARAM_BLOB_VAL,
+    PCONF_IDX_PARAM_BLOB_CCC,
+
+    PCONF_IDX_PARAM_GEN_CHAR,       // パラメータ世代番号/CRC(差分確認、変更通知用)
+    PCONF_IDX_PARAM_GEN_VAL,
+    PCONF_IDX_PARAM_GEN_CCC,
+
+    PCONF_IDX_CTRL_CHAR,            // コントロールポイント(保存/リブート等)
+    PCONF_IDX_CTRL_VAL,
+    PCONF_IDX_CTRL_CCC,
+
+    PCONF_IDX_WIFI_STATS_CHAR,      // Wi-Fi接続統計情報
+    PCONF_IDX_WIFI_STATS_VAL,
+
+    PCONF_IDX_BOOT_PROF_CHAR,       // 起動時間の内訳
+    PCONF_IDX_BOOT_PROF_VAL,
+
     PCONF_IDX_NUM,
 };
 
 // ==== 構造体 ===========================================================================================
+struct char_var_tab;
+typedef esp_gatt_status_t (*char_read_handler_t)(const struct char_var_tab* var, uint16_t offset, esp_gatt_rsp_t* rsp);
+typedef esp_gatt_status_t (*char_write_handler_t)(const struct char_var_tab* var, uint16_t offset, const uint8_t* value, uint16_t len);
+
 struct char_var_tab {           // キャラクタリスティック-プログラム内変数対応テーブル
     void*   value;
     uint16_t length;
+    char_read_handler_t     read;       // Readハンドラ  (NULLならRead不可)
+    char_write_handler_t    write;      // Writeハンドラ (NULLならWrite不可)
 };
 
 
 // ==== extern 宣言 ===========================================================================================
 extern  uint16_t    param_config_handle_table[];
 extern  void        param_config_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
-extern void         param_config_disconnect(void);
+extern void         param_config_deinit(void);
+extern bool         param_config_disconnect(void);
+extern void         param_config_commit(void);
+extern void         param_config_discard(void);
+extern void         param_config_notify_changed(void);
+extern void         param_config_set_pkt_data_len(uint16_t tx_len, uint16_t rx_len);
+extern uint16_t     param_config_get_chunk_size(void);
+#if BLE_BONDED_MODE
+extern void         param_config_auth_complete(const uint8_t* bd_addr, bool bonded);
+extern void         param_config_forget_bond(const uint8_t* bd_addr);
+#endif
 
 // extern uint8_t  ssid_name[SSID_NAME_SIZE];      // SSID名格納領域
 // extern uint8_t  ssid_pass[];                    // SSIDパスワード格納領域
@@ -52,4 +92,9 @@ extern const uint8_t   service_uuid[16];        // Service UUID
 extern const uint8_t   ssid_name_uuid[16];      // UUID
 extern const uint8_t   ssid_pass_uuid[16];      // UUID
 extern const uint8_t    loop_interval_uuid[16]; // UUID
+extern const uint8_t    param_blob_uuid[16];    // UUID
+extern const uint8_t    param_gen_uuid[16];     // UUID
+extern const uint8_t    param_ctrl_uuid[16];    // UUID
+extern const uint8_t    wifi_stats_uuid[16];    // UUID
+extern const uint8_t    boot_prof_uuid[16];     // UUID
 
@@ -0,0 +1,186 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    "freertos/FreeRTOS.h"
+#include    "freertos/task.h"
+#include    "freertos/queue.h"
+#include    "esp_system.h"
+#include    "esp_log.h"
+#include    "esp_err.h"
+#include    "esp_bt.h"
+
+#include    "esp_gap_ble_api.h"
+#include    "esp_gatts_api.h"
+#include    "esp_bt_defs.h"
+#include    "esp_bt_main.h"
+
+#include    "BLE_PARAM_CONFIG.h"
+#include    "param_ctrl.h"
+#include    "wifi_common.h"
+
+// LOG表示用TAG(関数名にしておく)
+#define     TAG             __func__
+
+// ==== static 変数 ===========================================================================================
+static QueueHandle_t            ctrl_queue = NULL;          // 要求キュー(コントロールポイントの要求は1個だけ)
+static volatile bool            ctrl_busy  = false;         // 要求受付～結果通知まで true
+static param_ctrl_result_cb_t   ctrl_result_cb = NULL;      // 結果通知先
+
+// ================================================================================================
+// オペコードの実行
+// return : PARAM_CTRL_STATUS_xxx
+// ================================================================================================
+static uint8_t execute(uint8_t opcode)
+{
+    struct app_param    param;
+
+    switch (opcode) {
+      case PARAM_CTRL_OP_COMMIT :
+        // 未確定の書き込みを確定してから保存する
+        param_config_commit();
+        GetParam(&param);
+        if (!SaveParam(&param)) {
+            return PARAM_CTRL_STATUS_FAILED;
+        }
+        ESP_LOGI(TAG, "    parameters saved (generation %u)", param.generation);
+        return PARAM_CTRL_STATUS_SUCCESS;
+
+      case PARAM_CTRL_OP_REVERT :
+        param_config_discard();
+        if (!ReloadParam()) {
+            return PARAM_CTRL_STATUS_FAILED;        // NVSに有効な値がない
+        }
+        return PARAM_CTRL_STATUS_SUCCESS;
+
+      case PARAM_CTRL_OP_FACTORY_RESET :
+        param_config_discard();
+        ResetParam();
+        return PARAM_CTRL_STATUS_SUCCESS;
+
+      case PARAM_CTRL_OP_REBOOT :
+        // 結果を通知してからリブートする (ワーカータスク側で行う)
+        return PARAM_CTRL_STATUS_SUCCESS;
+
+      case PARAM_CTRL_OP_STAGE_COMMIT :
+        // CRC計算や変更通知はタイマデーモンのスタックでは足りないので、こちらで行う
+        param_config_commit();
+        return PARAM_CTRL_STATUS_SUCCESS;
+
+      case PARAM_CTRL_OP_CHANGE_NOTIFY :
+        param_config_notify_changed();
+        return PARAM_CTRL_STATUS_SUCCESS;
+
+      case PARAM_CTRL_OP_CONFIRM :
+        // NVSの読み書きはイベントループのスタックでは足りないので、こちらで行う
+        ConfirmParam();
+        return PARAM_CTRL_STATUS_SUCCESS;
+
+      case PARAM_CTRL_OP_SAVE_WIFI_CACHE :
+        // NVSへの書き込みでイベントループを止めないよう、こちらで行う
+        wifi_save_conn_cache();
+        return PARAM_CTRL_STATUS_SUCCESS;
+
+      default :
+        return PARAM_CTRL_STATUS_NOT_SUPPORTED;
+    }
+}
+
+// ================================================================================================
+// ワーカータスク
+// ================================================================================================
+static void param_ctrl_task(void* arg)
+{
+    uint8_t     opcode;
+
+    while (1) {
+        if (xQueueReceive(ctrl_queue, &opcode, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (opcode > PARAM_CTRL_OP_REBOOT) {
+            execute(opcode);            // 内部要求は結果を通知しない
+            continue;
+        }
+        ESP_LOGI(TAG, "    control point opcode 0x%02x", opcode);
+        uint8_t     status = execute(opcode);
+        ESP_LOGI(TAG, "    control point status 0x%02x", status);
+
+        ctrl_busy = false;
+        if (ctrl_result_cb) {
+            ctrl_result_cb(opcode, status);
+        }
+
+        if (opcode == PARAM_CTRL_OP_REBOOT) {
+            vTaskDelay(PARAM_CTRL_REBOOT_DELAY_MS / portTICK_PERIOD_MS);
+            WaitParamSaved();
+            esp_restart();
+        }
+    }
+}
+
+// ================================================================================================
+// ワーカータスクの起動 (2回目以降は結果通知先の更新のみ)
+// app_main()から結果通知先なし(NULL)で起動し、BLEの設定サービスが通知先を登録する
+// ================================================================================================
+esp_err_t param_ctrl_start(param_ctrl_result_cb_t result_cb)
+{
+    ctrl_result_cb = result_cb;
+    if (ctrl_queue) {
+        return ESP_OK;
+    }
+
+    ctrl_queue = xQueueCreate(PARAM_CTRL_QUEUE_LEN, sizeof(uint8_t));
+    if (ctrl_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(param_ctrl_task, "param_ctrl", PARAM_CTRL_TASK_STACK_SIZE, NULL,
+                    PARAM_CTRL_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "    task create failed");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// ================================================================================================
+// 要求の受付 (BTCタスクから呼ばれる。実行はワーカータスクで行う)
+// return : PARAM_CTRL_STATUS_SUCCESS          受付完了(結果は後で通知)
+//          PARAM_CTRL_STATUS_NOT_SUPPORTED    未対応のオペコード
+//          PARAM_CTRL_STATUS_BUSY             前の要求を実行中
+// ================================================================================================
+uint8_t param_ctrl_request(uint8_t opcode)
+{
+    if (opcode < PARAM_CTRL_OP_COMMIT || opcode > PARAM_CTRL_OP_REBOOT) {
+        return PARAM_CTRL_STATUS_NOT_SUPPORTED;
+    }
+    if (ctrl_queue == NULL || ctrl_busy) {
+        return PARAM_CTRL_STATUS_BUSY;
+    }
+    ctrl_busy = true;
+    if (xQueueSend(ctrl_queue, &opcode, 0) != pdTRUE) {
+        ctrl_busy = false;
+        return PARAM_CTRL_STATUS_BUSY;
+    }
+    return PARAM_CTRL_STATUS_SUCCESS;
+}
+
+// ================================================================================================
+// 内部要求の受付 (タイマのコールバックなど、スタックの小さいタスクから呼ばれる)
+// return : true    受付完了
+//          false   ワーカータスク未起動/キューに空きがない
+// ================================================================================================
+bool param_ctrl_post(uint8_t opcode)
+{
+    if (ctrl_queue == NULL) {
+        return false;
+    }
+    return xQueueSend(ctrl_queue, &opcode, 0) == pdTRUE;
+}
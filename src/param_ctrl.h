@@ -0,0 +1,53 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- コントロールポイント ----------------------------------
+    Write : [0] オペコード
+    Indicate(結果) : [0] PARAM_CTRL_RSP_CODE  [1] 要求されたオペコード  [2] 結果
+    NVSへの書き込みやリブートは時間がかかるので、BTCタスクではなく
+    ワーカータスクで実行し、結果をIndicationで返す。
+    ワーカータスクはBLEを使わない起動でも app_main() で起動し、
+    イベントループ/タイマなどスタックの小さいタスクからのNVS操作も引き受ける(param_ctrl_post())。
+   ------------------------------------------------------- */
+
+// ==== マクロ定義 ===========================================================================================
+// オペコード
+#define PARAM_CTRL_OP_COMMIT            0x01            // 確定してNVSに保存
+#define PARAM_CTRL_OP_REVERT            0x02            // 未保存の変更を破棄してNVSの値に戻す
+#define PARAM_CTRL_OP_FACTORY_RESET     0x03            // NVSを消去して未設定状態に戻す
+#define PARAM_CTRL_OP_REBOOT            0x04            // リブート
+
+// 内部要求 (タイマやイベントループから依頼される処理。コントロールポイントからは受け付けず、結果も通知しない)
+#define PARAM_CTRL_OP_STAGE_COMMIT      0x41            // 未確定の書き込みを確定 (書き込み確定タイマ満了/切断時)
+#define PARAM_CTRL_OP_CHANGE_NOTIFY     0x42            // 変更通知の送信 (変更通知タイマ満了)
+#define PARAM_CTRL_OP_CONFIRM           0x43            // 使用中のスロットを確認済みにする (IPアドレス取得時)
+#define PARAM_CTRL_OP_SAVE_WIFI_CACHE   0x44            // Wi-Fi接続情報キャッシュをNVSに保存 (IPアドレス取得時、内容が変わった場合)
+
+// 応答
+#define PARAM_CTRL_RSP_CODE             0x80            // 応答のオペコード
+#define PARAM_CTRL_RSP_LEN              3               // 応答の長さ
+
+// 結果
+#define PARAM_CTRL_STATUS_SUCCESS       0x01            // 正常終了
+#define PARAM_CTRL_STATUS_NOT_SUPPORTED 0x02            // 未対応のオペコード
+#define PARAM_CTRL_STATUS_BUSY          0x03            // 前の要求を実行中
+#define PARAM_CTRL_STATUS_FAILED        0x04            // 実行失敗
+
+#define PARAM_CTRL_TASK_STACK_SIZE      3072            // ワーカータスクのスタックサイズ
+#define PARAM_CTRL_QUEUE_LEN            8               // 要求キューの長さ (コントロールポイント1個 + 内部要求)
+#define PARAM_CTRL_TASK_PRIORITY        5               // ワーカータスクの優先度
+#define PARAM_CTRL_REBOOT_DELAY_MS      1000            // リブート前の待ち時間(応答のIndicationを送り終えるため)
+
+// 結果通知関数
+typedef void (*param_ctrl_result_cb_t)(uint8_t opcode, uint8_t status);
+
+
+// ==== extern 宣言 ===========================================================================================
+extern esp_err_t    param_ctrl_start(param_ctrl_result_cb_t result_cb);
+extern uint8_t      param_ctrl_request(uint8_t opcode);
+extern bool         param_ctrl_post(uint8_t opcode);
@@ -0,0 +1,63 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    "esp_log.h"
+
+#include    "param_handle_index.h"
+
+// LOG表示用TAG(関数名にしておく)
+#define     TAG             __func__
+
+// ================================================================================================
+// 未登録状態にする
+// ================================================================================================
+void param_handle_index_reset(struct param_handle_index* hidx)
+{
+    hidx->base = 0;
+    hidx->num  = 0;
+}
+
+// ================================================================================================
+// ハンドルテーブルが連番になっているか確認し、先頭ハンドルを記憶する
+// return : true    登録成功
+//          false   連番でない (未登録状態になる)
+// ================================================================================================
+bool param_handle_index_build(struct param_handle_index* hidx, const uint16_t* handles, int num)
+{
+    param_handle_index_reset(hidx);
+    if (num <= 0 || handles[0] == 0) {
+        return false;
+    }
+    for (int i = 0; i < num; i++) {
+        if (handles[i] != handles[0] + i) {
+            ESP_LOGE(TAG, "    handle table not contiguous : [%d] 0x%04x", i, handles[i]);
+            return false;
+        }
+    }
+    hidx->base = handles[0];
+    hidx->num  = num;
+    return true;
+}
+
+// ================================================================================================
+// ハンドル→インデックス
+// return : attributeテーブルのインデックス   見つからない場合は -1
+// ================================================================================================
+int param_handle_index_lookup(const struct param_handle_index* hidx, uint16_t handle)
+{
+    uint16_t    idx = handle - hidx->base;          // 先頭より前のハンドルは大きな値になるので下のチェックで弾かれる
+    if (hidx->base == 0 || idx >= hidx->num) {
+        return -1;      // 見つからなかった
+    }
+    return idx;
+}
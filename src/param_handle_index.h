@@ -0,0 +1,26 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- ハンドル→attributeテーブルのインデックス変換 -------
+    esp_ble_gatts_create_attr_tab() で登録したattributeのハンドルは
+    サービス宣言から連番で割り当てられるので、先頭ハンドルからのオフセットを
+    そのままインデックスとして使う(テーブルの大きさによらず一定時間で引ける)。
+    ホストでのユニットテストのため、ESP-IDFには依存させない。
+   ------------------------------------------------------- */
+
+// ==== 構造体 ===========================================================================================
+struct param_handle_index {
+    uint16_t    base;                   // 先頭(サービス宣言)のハンドル  0は未登録
+    uint16_t    num;                    // attribute数
+};
+
+
+// ==== extern 宣言 ===========================================================================================
+extern void         param_handle_index_reset(struct param_handle_index* hidx);
+extern bool         param_handle_index_build(struct param_handle_index* hidx, const uint16_t* handles, int num);
+extern int          param_handle_index_lookup(const struct param_handle_index* hidx, uint16_t handle);
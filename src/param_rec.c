@@ -0,0 +1,145 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+#include    <stddef.h>
+
+#include    "esp_log.h"
+#include    "esp_err.h"
+#include    "esp_rom_crc.h"
+
+#include    "app_param.h"
+#include    "param_blob.h"
+#include    "param_rec.h"
+
+// LOG表示用TAG(関数名にしておく)
+#define     TAG             __func__
+
+// ================================================================================================
+// レコードのCRC計算 (ヘッダのcrcより前の部分 + 本体)
+// ================================================================================================
+static uint32_t calc_record_crc(const struct param_rec_hdr* pHdr, const uint8_t* body)
+{
+    uint32_t    crc = esp_rom_crc32_le(0, (const uint8_t*)pHdr, offsetof(struct param_rec_hdr, crc));
+    return esp_rom_crc32_le(crc, body, pHdr->length);
+}
+
+// ================================================================================================
+// 設定パラメータ → レコード変換
+// 本体はパラメータブロブ形式(項目の追加/削除に対応できるようにTLVにしておく)
+// return : レコードの長さ  (領域が足りない場合は -1)
+// ================================================================================================
+int param_rec_encode(const struct app_param* pParam, uint32_t seq, uint8_t state, uint8_t* buf, int buf_len)
+{
+    struct param_rec_hdr    hdr;
+
+    if (buf_len < (int)sizeof(hdr)) {
+        return -1;
+    }
+    int     len = param_blob_encode(pParam, &buf[sizeof(hdr)], buf_len - sizeof(hdr));
+    if (len < 0) {
+        return -1;
+    }
+    memset(&hdr, 0x00, sizeof(hdr));
+    hdr.version    = PARAM_REC_VERSION;
+    hdr.state      = state;
+    hdr.length     = len;
+    hdr.seq        = seq;
+    hdr.generation = pParam->generation;
+    hdr.crc        = calc_record_crc(&hdr, &buf[sizeof(hdr)]);
+    memcpy(buf, &hdr, sizeof(hdr));
+    return sizeof(hdr) + len;
+}
+
+// ================================================================================================
+// レコード → 設定パラメータ変換
+// 全項目の検証が終わってから pParam に反映するので、エラー時は pParam は変更されない
+// return : ESP_OK                      正常終了
+//          ESP_ERR_INVALID_SIZE        長さ不正(途中で切れている/余分なデータがある)
+//          ESP_ERR_INVALID_VERSION     レコード/ブロブのバージョン不一致
+//          ESP_ERR_INVALID_CRC         CRC不一致
+//          ESP_ERR_INVALID_ARG         設定値不正
+// ================================================================================================
+esp_err_t param_rec_decode(const uint8_t* buf, int len, struct app_param* pParam, struct param_rec_hdr* pHdr)
+{
+    // ヘッダのチェック
+    if (len < (int)sizeof(*pHdr)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(pHdr, buf, sizeof(*pHdr));
+    if (pHdr->version != PARAM_REC_VERSION) {
+        ESP_LOGW(TAG, "    version mismatch (%d)", pHdr->version);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (pHdr->length != (len - sizeof(*pHdr))) {
+        ESP_LOGW(TAG, "    length mismatch (%d / %d)", pHdr->length, len - sizeof(*pHdr));
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (pHdr->crc != calc_record_crc(pHdr, &buf[sizeof(*pHdr)])) {
+        ESP_LOGW(TAG, "    crc mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    // 本体(パラメータブロブ形式)のデコード
+    esp_err_t   err = param_blob_decode(&buf[sizeof(*pHdr)], pHdr->length, pParam);
+    if (err != ESP_OK) {
+        return err;
+    }
+    pParam->generation = pHdr->generation;
+    return ESP_OK;
+}
+
+// ================================================================================================
+// 使用するスロットの選択
+// 有効なスロットのうち、シーケンス番号の新しい方 (シーケンス番号は一周しても比較できるよう差で比べる)
+// return : スロット番号  (有効なスロットがなければ -1)
+// ================================================================================================
+int param_rec_select(const bool* valid, const struct param_rec_hdr* hdr)
+{
+    int     sel = -1;
+
+    for (int i = 0; i < PARAM_SLOT_NUM; i++) {
+        if (valid[i] && (sel < 0 || (int32_t)(hdr[i].seq - hdr[sel].seq) > 0)) {
+            sel = i;
+        }
+    }
+    return sel;
+}
+
+// ================================================================================================
+// 書き込むスロットの選択
+// 通常は使用中でない方。使用中のスロットが未確認なら、そのスロットを上書きする
+// (もう一方は最後に確認済みになったスロットなので、ロールバック先として残しておく)
+// return : スロット番号
+// ================================================================================================
+int param_rec_save_slot(int active_slot, bool active_pending)
+{
+    if (active_slot < 0) {
+        return 0;
+    }
+    return active_pending ? active_slot : (1 - active_slot);
+}
+
+// ================================================================================================
+// 未確認のスロットで起動するときに使用するスロット
+// try_count : これまでに未確認のまま起動した回数
+// return : ロールバックするならもう一方のスロット、しないなら slot
+//          (もう一方が無効ならロールバックできないので slot)
+// ================================================================================================
+int param_rec_boot_slot(int slot, const bool* valid, int try_count)
+{
+    int     other = 1 - slot;
+
+    if (valid[other] && try_count >= PARAM_BOOT_TRY_MAX) {
+        return other;
+    }
+    return slot;
+}
@@ -0,0 +1,20 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- 設定パラメータレコード(A/Bスロット) ------------------
+    レコードのフォーマット(struct param_rec_hdr + パラメータブロブ)は app_param.h を参照。
+    NVSの読み書きは app_param.c で行い、ここではレコードの組み立て/検証と
+    使用するスロットの選択だけを行う(ホストでのユニットテストのため、NVSに依存させない)。
+   ------------------------------------------------------- */
+
+// ==== extern 宣言 ===========================================================================================
+extern int          param_rec_encode(const struct app_param* pParam, uint32_t seq, uint8_t state, uint8_t* buf, int buf_len);
+extern esp_err_t    param_rec_decode(const uint8_t* buf, int len, struct app_param* pParam, struct param_rec_hdr* pHdr);
+extern int          param_rec_select(const bool* valid, const struct param_rec_hdr* hdr);
+extern int          param_rec_save_slot(int active_slot, bool active_pending);
+extern int          param_rec_boot_slot(int slot, const bool* valid, int try_count);
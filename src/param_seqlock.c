@@ -0,0 +1,69 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <stddef.h>
+#include    <string.h>
+
+#include    "param_seqlock.h"
+
+// ================================================================================================
+// 読み出し開始 (書き込み中なら終わるまで待つ)
+// return : 読み出し開始時のシーケンス番号 (param_seqlock_read_retry() に渡す)
+// ================================================================================================
+uint32_t param_seqlock_read_begin(const struct param_seqlock* lock)
+{
+    uint32_t    seq;
+
+    while ((seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE)) & 1) {
+        // 書き込み中(別コア)。書き込みは短いコピーだけなのですぐ終わる
+    }
+    return seq;
+}
+
+// ================================================================================================
+// 読み出し終了
+// return : true  読み出し中に書き込みがあった(やり直し)
+// ================================================================================================
+bool param_seqlock_read_retry(const struct param_seqlock* lock, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&lock->seq, __ATOMIC_RELAXED) != seq);
+}
+
+// ================================================================================================
+// 全体のコピー (途中で書き込みがあればやり直す)
+// ================================================================================================
+void param_seqlock_read(const struct param_seqlock* lock, void* dst, const void* src, size_t len)
+{
+    uint32_t    seq;
+
+    do {
+        seq = param_seqlock_read_begin(lock);
+        memcpy(dst, src, len);
+    } while (param_seqlock_read_retry(lock, seq));
+}
+
+// ================================================================================================
+// 書き込み開始 (書き込み側同士の排他は呼び出し側で行うこと)
+// ================================================================================================
+void param_seqlock_write_begin(struct param_seqlock* lock)
+{
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELAXED);     // 奇数 = 書き込み中
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// ================================================================================================
+// 書き込み終了
+// ================================================================================================
+void param_seqlock_write_end(struct param_seqlock* lock)
+{
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELEASE);     // 偶数 = 書き込み完了
+}
@@ -0,0 +1,27 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- 設定パラメータ参照用 seqlock ------------------------
+    書き込み側 : param_seqlock_write_begin() で seq を奇数にしてから書き換え、param_seqlock_write_end() で偶数に戻す
+                 (書き込み側同士の排他は呼び出し側で行う。app_param.c ではクリティカルセクション内で呼ぶ)
+    読み出し側 : ロックを取らずにコピーし、コピー前後で seq が同じ偶数なら成功、違えばやり直す
+    ホストでのユニットテストのため、FreeRTOS/ESP-IDFに依存させない
+   ------------------------------------------------------- */
+
+// ==== 構造体 ===========================================================================================
+struct param_seqlock {
+    uint32_t    seq;                    // シーケンス番号 (奇数 = 書き込み中)
+};
+
+
+// ==== extern 宣言 ===========================================================================================
+extern uint32_t     param_seqlock_read_begin(const struct param_seqlock* lock);
+extern bool         param_seqlock_read_retry(const struct param_seqlock* lock, uint32_t seq);
+extern void         param_seqlock_read(const struct param_seqlock* lock, void* dst, const void* src, size_t len);
+extern void         param_seqlock_write_begin(struct param_seqlock* lock);
+extern void         param_seqlock_write_end(struct param_seqlock* lock);
@@ -0,0 +1,73 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    "freertos/FreeRTOS.h"
+#include    "freertos/task.h"
+#include    "freertos/queue.h"
+
+#include    "app_param.h"
+#include    "param_subscriber.h"
+
+// ================================================================================================
+// 通知先の登録 (table は PARAM_SUBSCRIBER_MAX 個分)
+// return : 登録ID (param_subscriber_remove()で使う)   空きがない/通知先がない場合は -1
+// ================================================================================================
+int param_subscriber_add(struct param_subscriber* table, uint32_t fields, QueueHandle_t queue, TaskHandle_t task)
+{
+    if (queue == NULL && task == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < PARAM_SUBSCRIBER_MAX; i++) {
+        if (table[i].queue == NULL && table[i].task == NULL) {
+            table[i].fields = fields;
+            table[i].queue  = queue;
+            table[i].task   = task;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// ================================================================================================
+// 通知先の登録解除 (範囲外のIDは無視する)
+// ================================================================================================
+void param_subscriber_remove(struct param_subscriber* table, int id)
+{
+    if (id < 0 || id >= PARAM_SUBSCRIBER_MAX) {
+        return;
+    }
+    memset(&table[id], 0x00, sizeof(table[id]));
+}
+
+// ================================================================================================
+// 変更項目 fields を通知する先の選択
+// out : PARAM_SUBSCRIBER_MAX 個分。通知先毎の fields は通知対象の項目と変更項目の共通部分
+// return : 通知先の数
+// ================================================================================================
+int param_subscriber_collect(const struct param_subscriber* table, uint32_t fields, struct param_subscriber* out)
+{
+    int     num = 0;
+
+    for (int i = 0; i < PARAM_SUBSCRIBER_MAX; i++) {
+        if (table[i].queue == NULL && table[i].task == NULL) {
+            continue;
+        }
+        if ((fields & table[i].fields) == 0) {
+            continue;
+        }
+        out[num] = table[i];
+        out[num].fields = fields & table[i].fields;
+        num++;
+    }
+    return num;
+}
@@ -0,0 +1,27 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- 設定パラメータ変更通知先テーブル ---------------------
+    SubscribeParam()/SubscribeParamNotify() で登録された通知先(PARAM_SUBSCRIBER_MAX 個)を管理する。
+    排他と実際の通知(xQueueSend()/xTaskNotify())は app_param.c で行い、ここではテーブルの操作と
+    変更項目による通知先の選択だけを行う(ホストでのユニットテストのため、FreeRTOSの型以外には依存させない)。
+   ------------------------------------------------------- */
+
+// ==== 構造体 ===========================================================================================
+// 変更通知先 (キューまたはタスク通知。どちらもNULLなら未使用)
+struct param_subscriber {
+    uint32_t        fields;                 // 通知対象の項目 (collect結果では通知する変更項目)
+    QueueHandle_t   queue;                  // 通知先キュー
+    TaskHandle_t    task;                   // 通知先タスク (xTaskNotify()で変更項目のビットをセットする)
+};
+
+
+// ==== extern 宣言 ===========================================================================================
+extern int          param_subscriber_add(struct param_subscriber* table, uint32_t fields, QueueHandle_t queue, TaskHandle_t task);
+extern void         param_subscriber_remove(struct param_subscriber* table, int id);
+extern int          param_subscriber_collect(const struct param_subscriber* table, uint32_t fields, struct param_subscriber* out);
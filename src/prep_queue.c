@@ -0,0 +1,122 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    "esp_log.h"
+#include    "esp_err.h"
+
+#include    "prep_queue.h"
+
+// LOG表示用TAG(関数名にしておく)
+#define     TAG             __func__
+
+// ================================================================================================
+// キューのクリア
+// ================================================================================================
+void prep_queue_reset(struct prep_queue* q)
+{
+    q->entry_num = 0;
+    q->pool_used = 0;
+}
+
+// ================================================================================================
+// フラグメントの登録
+// return : ESP_OK              正常終了
+//          ESP_ERR_NO_MEM      キュー/プールに空きがない
+// ================================================================================================
+esp_err_t prep_queue_push(struct prep_queue* q, uint16_t handle, uint16_t offset, const uint8_t* value, uint16_t len)
+{
+    if (q->entry_num >= PREP_QUEUE_ENTRY_NUM || (q->pool_used + len) > sizeof(q->pool)) {
+        ESP_LOGW(TAG, "    prepare queue full (entry:%d  pool:%d)", q->entry_num, q->pool_used);
+        return ESP_ERR_NO_MEM;
+    }
+
+    struct prep_entry*  e = &q->entry[q->entry_num++];
+    e->handle   = handle;
+    e->offset   = offset;
+    e->len      = len;
+    e->pool_pos = q->pool_used;
+    memcpy(&q->pool[q->pool_used], value, len);
+    q->pool_used += len;
+
+    return ESP_OK;
+}
+
+// ================================================================================================
+// キュー内のハンドル一覧(重複なし、最初に書き込まれた順)
+// return : ハンドル数
+// ================================================================================================
+int prep_queue_handles(const struct prep_queue* q, uint16_t* handles, int max)
+{
+    int     num = 0;
+    for (int i = 0; i < q->entry_num; i++) {
+        int     j;
+        for (j = 0; j < num; j++) {
+            if (handles[j] == q->entry[i].handle) {
+                break;
+            }
+        }
+        if (j == num && num < max) {
+            handles[num++] = q->entry[i].handle;
+        }
+    }
+    return num;
+}
+
+// ================================================================================================
+// 指定ハンドルのフラグメントを連結
+// フラグメントは受信順にオフセット位置へ書き込むので、オフセットの順番は問わない
+// return : 連結後の長さ  (隙間がある/バッファに入らない場合は -1)
+// ================================================================================================
+int prep_queue_assemble(const struct prep_queue* q, uint16_t handle, uint8_t* buf, int buf_size)
+{
+    int     idx[PREP_QUEUE_ENTRY_NUM];
+    int     num = 0;
+
+    // 対象ハンドルのフラグメントをオフセット順に並べる(数が少ないので挿入ソート)
+    for (int i = 0; i < q->entry_num; i++) {
+        if (q->entry[i].handle != handle) {
+            continue;
+        }
+        int     j = num++;
+        while (j > 0 && q->entry[idx[j - 1]].offset > q->entry[i].offset) {
+            idx[j] = idx[j - 1];
+            j--;
+        }
+        idx[j] = i;
+    }
+
+    // 先頭から隙間なく埋まっているか確認
+    int     total = 0;
+    for (int i = 0; i < num; i++) {
+        const struct prep_entry*    e = &q->entry[idx[i]];
+        if (e->offset > total) {
+            ESP_LOGW(TAG, "    gap at offset %d (handle 0x%04x)", total, handle);
+            return -1;
+        }
+        if ((e->offset + e->len) > total) {
+            total = e->offset + e->len;
+        }
+    }
+    if (total > buf_size) {
+        return -1;
+    }
+
+    // 受信順に書き込む(重なっている部分は後から来た値が有効)
+    for (int i = 0; i < q->entry_num; i++) {
+        const struct prep_entry*    e = &q->entry[i];
+        if (e->handle == handle) {
+            memcpy(&buf[e->offset], &q->pool[e->pool_pos], e->len);
+        }
+    }
+    return total;
+}
@@ -0,0 +1,39 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- Prepare Write キュー -------------------------------
+    Prepare Write で受け取ったフラグメントを Execute Write まで保持する。
+    フラグメントのデータは固定長のプールに詰めて格納するので、
+    フラグメント毎のmallocは行わない。
+   ------------------------------------------------------- */
+
+// ==== マクロ定義 ===========================================================================================
+#define PREP_QUEUE_ENTRY_NUM            32              // 保持できるフラグメント数 (MTU 23 でもパラメータブロブの最大長が入る数)
+#define PREP_QUEUE_POOL_SIZE            512             // フラグメントデータ格納用プールサイズ
+
+// ==== 構造体 ===========================================================================================
+struct prep_entry {             // フラグメント情報
+    uint16_t    handle;             // 書き込み先ハンドル
+    uint16_t    offset;             // 書き込みオフセット
+    uint16_t    len;                // データ長
+    uint16_t    pool_pos;           // プール内の格納位置
+};
+
+struct prep_queue {
+    struct prep_entry   entry[PREP_QUEUE_ENTRY_NUM];
+    int                 entry_num;                      // 登録済みフラグメント数
+    uint16_t            pool_used;                      // プール使用量
+    uint8_t             pool[PREP_QUEUE_POOL_SIZE];     // フラグメントデータ
+};
+
+
+// ==== extern 宣言 ===========================================================================================
+extern void         prep_queue_reset(struct prep_queue* q);
+extern esp_err_t    prep_queue_push(struct prep_queue* q, uint16_t handle, uint16_t offset, const uint8_t* value, uint16_t len);
+extern int          prep_queue_handles(const struct prep_queue* q, uint16_t* handles, int max);
+extern int          prep_queue_assemble(const struct prep_queue* q, uint16_t handle, uint8_t* buf, int buf_size);
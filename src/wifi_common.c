@@ -7,6 +7,7 @@
 */
 
 #include <string.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <sys/socket.h>
 
@@ -15,74 +16,770 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/timers.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_event.h"
 #include "esp_wifi.h"
+#include "esp_netif.h"
+#include "nvs_flash.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 
 #include "wifi_common.h"
+#include "app_param.h"
+#include "param_ctrl.h"
+#include "boot_prof.h"
 
 // LOG表示用TAG(関数名にしておく)
 #define     TAG             __func__
 
 // ================================================================================================
-// AP接続最大リトライ回数
+// AP接続最大リトライ回数 (これを超えたら wait_wifi_connect() に接続失敗を返す。再接続自体は続ける)
 #define EXAMPLE_ESP_MAXIMUM_RETRY  5
 
+// 再接続の待ち時間 (指数バックオフ 初回はすぐに再接続し、以降 BASE×2^(n-1) を MAX で頭打ちにする)
+#define     WIFI_RETRY_BASE_MS      500
+#define     WIFI_RETRY_MAX_MS       (60 * 1000)
+
 // イベントビット
 #define     WIFI_CONNECTED_BIT      BIT0
 #define     WIFI_FAIL_BIT           BIT1
 
+// 前回の接続情報(キャッシュ)で取得したIPアドレスを再利用する(DHCPを省略する)
+// DHCPサーバ側でリースが切れて他の機器に割り当てられる可能性があるので、固定割り当てのネットワークでのみ有効にすること
+#define     WIFI_REUSE_CACHED_IP    0
+
+// 接続先候補の最大数 / スキャン結果の最大読み出し数
+#define     WIFI_CANDIDATE_MAX      8
+#define     WIFI_SCAN_REC_MAX       20
+
+// 接続情報キャッシュのNVSキー (設定パラメータと同じnamespaceに保存する)
+#define     NVS_KEY_WIFI_CACHE      "wifi_cache"
+
+// 内部イベント (WIFI_COMMON_EVENT)
+// 接続状態の変数(リトライ回数/接続先候補/スキャン中など)を操作するのはイベントループのタスクだけにするため、
+// 再接続タイマや接続先の変更はイベントとして投げ、イベントハンドラで処理する
+#define     WIFI_COMMON_EVENT_RETRY         0       // 再接続タイマ満了
+#define     WIFI_COMMON_EVENT_RECONFIGURE   1       // 接続先の変更 (event_data は struct wifi_reconfig)
+#define     WIFI_RETRY_POST_DELAY_MS        100     // イベントキューが一杯だったときのやり直しまでの時間
+
 
 // ================================================================================================
 // Wi-Fi接続時のイベントグループ
 static EventGroupHandle_t s_wifi_event_group;
 
+// 内部イベントのイベントベース
+ESP_EVENT_DEFINE_BASE(WIFI_COMMON_EVENT);
+
 // イベントハンドラ
 static esp_event_handler_instance_t instance_any_id;
 static esp_event_handler_instance_t instance_got_ip;
+static esp_event_handler_instance_t instance_common;
+
+// 接続リトライ回数
+static int s_retry_num = 0;
+
+// 接続状態が変わったときに呼ぶ関数 (advertisingの状態表示の更新用)
+static void (*s_status_hook)(void) = NULL;
+
+// 再接続タイマ (バックオフ待ち)
+static TimerHandle_t s_retry_timer = NULL;
+
+// 再接続の統計情報
+static portMUX_TYPE s_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static struct wifi_reconnect_stats s_stats;
+
+// 接続試行の記録 (リングバッファ。s_stats_mux で排他する)
+static struct wifi_attempt s_attempts[WIFI_ATTEMPT_LOG_NUM];
+static int s_attempt_head = 0;                      // 次に書き込む位置
+static int s_attempt_num  = 0;                      // 記録数
+static int s_attempt_cur  = -1;                     // 結果待ちの試行 (-1なら無し)
+static uint32_t s_connected_ms = 0;                 // STA_CONNECTEDの時刻
+static uint32_t s_scan_start_ms = 0;                // スキャン開始時刻
+static uint16_t s_scan_ms = 0;                      // 直前のスキャン時間 (次の試行に記録する)
+
+// AP接続中フラグ (STA_CONNECTED～STA_DISCONNECTED)
+static bool s_sta_connected = false;
+
+// STAのネットワークインタフェース
+static esp_netif_t* s_sta_netif = NULL;
+
+// 接続情報キャッシュ
+static struct wifi_conn_cache s_conn_cache;         // NVSから読んだ/最後に接続できた内容 (更新はイベントループのタスクだけ)
+static bool s_conn_cache_valid = false;
+static portMUX_TYPE s_conn_cache_mux = portMUX_INITIALIZER_UNLOCKED;   // NVS書き込み(ワーカータスク)でのコピーとの排他
+static bool s_fast_connect     = false;             // キャッシュを使って接続中 (失敗したら通常の接続に戻す)
+static uint32_t s_cred_crc     = 0;                 // 現在のSSID/パスワードのCRC
+
+// 接続先プロファイル ([0]が ssid_name/ssid_pass、以降は使用中の ap_profile[])
+static struct ap_profile s_profiles[1 + AP_PROFILE_NUM];
+static int s_profile_num = 0;
+
+// 接続先の変更要求 (WIFI_COMMON_EVENT_RECONFIGURE のデータ)
+struct wifi_reconfig {
+    struct ap_profile   profiles[1 + AP_PROFILE_NUM];
+    int                 profile_num;
+};
+
+// 接続先候補 (1回のスキャン結果から作り、優先度 → RSSI の順に並べる)
+struct wifi_candidate {
+    uint8_t     profile;                            // s_profiles[]のインデックス
+    int8_t      rssi;
+    uint8_t     channel;
+    uint8_t     bssid[6];
+};
+static struct wifi_candidate s_candidates[WIFI_CANDIDATE_MAX];
+static int s_cand_num = 0;                          // 候補数 (0なら候補なし)
+static int s_cand_idx = 0;                          // 接続中の候補
+static bool s_scanning = false;                     // スキャン中
 
 
 // 自身に割り当てられたIPアドレス
 esp_ip4_addr_t my_ipaddr;
 
 
+// ================================================================================================
+// SSID/パスワードのCRC (キャッシュがどの接続先のものか確認するため)
+// ================================================================================================
+static uint32_t calc_cred_crc(const char* ssid_name, const char* ssid_pass)
+{
+    uint32_t    crc = esp_rom_crc32_le(0, (const uint8_t*)ssid_name, strlen(ssid_name));
+    return esp_rom_crc32_le(crc, (const uint8_t*)ssid_pass, strlen(ssid_pass));
+}
+
+// ================================================================================================
+// 接続情報キャッシュのロード
+// ================================================================================================
+static void load_conn_cache(void)
+{
+    nvs_handle_t    handle;
+    size_t          len = sizeof(s_conn_cache);
+
+    s_conn_cache_valid = false;
+    if (nvs_open(NVS_NAMESPACE_INFO, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(handle, NVS_KEY_WIFI_CACHE, &s_conn_cache, &len) == ESP_OK &&
+        len == sizeof(s_conn_cache) && s_conn_cache.version == WIFI_CONN_CACHE_VERSION) {
+        s_conn_cache_valid = true;
+    }
+    nvs_close(handle);
+}
+
+// ================================================================================================
+// 接続情報キャッシュのセーブ (ワーカータスクから呼ばれる)
+// 内容の比較と更新は update_conn_cache() で済ませているので、ここでは最新の内容を書き込むだけ
+// ================================================================================================
+void wifi_save_conn_cache(void)
+{
+    struct wifi_conn_cache  cache;
+    nvs_handle_t            handle;
+
+    portENTER_CRITICAL(&s_conn_cache_mux);
+    memcpy(&cache, &s_conn_cache, sizeof(cache));
+    portEXIT_CRITICAL(&s_conn_cache_mux);
+
+    if (nvs_open(NVS_NAMESPACE_INFO, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(handle, NVS_KEY_WIFI_CACHE, &cache, sizeof(cache)) == ESP_OK &&
+        nvs_commit(handle) == ESP_OK) {
+        ESP_LOGI(TAG, "connection cache saved (channel %d)", cache.channel);
+    }
+    else {
+        ESP_LOGW(TAG, "connection cache save failed");
+    }
+    nvs_close(handle);
+}
+
+// ================================================================================================
+// 接続成功時の接続情報をキャッシュに保存 (イベントループのタスクから呼ばれる)
+// 前回と同じなら何もしない。変わっていればNVSへの書き込みはワーカータスクに依頼する
+// ================================================================================================
+static void update_conn_cache(const esp_netif_ip_info_t* ip_info)
+{
+    struct wifi_conn_cache  cache;
+    wifi_ap_record_t        ap_info;
+    esp_netif_dns_info_t    dns;
+
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    memset(&cache, 0x00, sizeof(cache));
+    cache.version  = WIFI_CONN_CACHE_VERSION;
+    cache.channel  = ap_info.primary;
+    memcpy(cache.bssid, ap_info.bssid, sizeof(cache.bssid));
+    cache.cred_crc = s_cred_crc;
+    cache.ip_info  = *ip_info;
+    if (esp_netif_get_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
+        cache.dns = dns.ip.u_addr.ip4;
+    }
+    if (s_conn_cache_valid && memcmp(&s_conn_cache, &cache, sizeof(cache)) == 0) {
+        return;         // 前回と同じ
+    }
+    portENTER_CRITICAL(&s_conn_cache_mux);
+    memcpy(&s_conn_cache, &cache, sizeof(s_conn_cache));
+    s_conn_cache_valid = true;
+    portEXIT_CRITICAL(&s_conn_cache_mux);
+    if (!param_ctrl_post(PARAM_CTRL_OP_SAVE_WIFI_CACHE)) {
+        ESP_LOGW(TAG, "connection cache save request failed");
+    }
+}
+
+// ================================================================================================
+// キャッシュを使った接続をやめて通常の接続(全チャネルスキャン + DHCP)に戻す
+// ================================================================================================
+static void cancel_fast_connect(void)
+{
+    if (!s_fast_connect) {
+        return;
+    }
+    s_fast_connect = false;         // 接続先の設定は次の start_connect() でやり直す
+#if WIFI_REUSE_CACHED_IP
+    esp_netif_dhcpc_start(s_sta_netif);
+#endif
+}
+
+// ================================================================================================
+// 接続先プロファイルの作成
+// profiles : 1 + AP_PROFILE_NUM 個分の領域
+// return : プロファイル数
+// ================================================================================================
+static int make_profiles(const struct app_param* pParam, struct ap_profile* profiles)
+{
+    int     num = 1;
+
+    memset(profiles, 0x00, sizeof(struct ap_profile) * (1 + AP_PROFILE_NUM));
+    strncpy(profiles[0].ssid_name, pParam->ssid_name, sizeof(profiles[0].ssid_name) - 1);
+    strncpy(profiles[0].ssid_pass, pParam->ssid_pass, sizeof(profiles[0].ssid_pass) - 1);
+    profiles[0].priority = AP_PROFILE_PRIO_PRIMARY;
+    for (int i = 0; i < AP_PROFILE_NUM; i++) {
+        if (strlen(pParam->ap_profile[i].ssid_name) > 0) {
+            memcpy(&profiles[num++], &pParam->ap_profile[i], sizeof(profiles[0]));
+        }
+    }
+    return num;
+}
+
+// ================================================================================================
+// 接続先の設定 (bssid が NULL ならBSSID/チャネルを指定しない)
+// ================================================================================================
+static esp_err_t apply_sta_config(int profile, const uint8_t* bssid, uint8_t channel)
+{
+    wifi_config_t               wifi_config;
+    const struct ap_profile*    prof = &s_profiles[profile];
+    esp_err_t                   err;
+
+    // 現在の設定を読んで、接続先だけ変更する
+    err = esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_wifi_get_config failed.(%d)", err);
+        return err;
+    }
+    memset(wifi_config.sta.ssid,     0x00, sizeof(wifi_config.sta.ssid));
+    memset(wifi_config.sta.password, 0x00, sizeof(wifi_config.sta.password));
+    // 最大長のときはNULL文字が入らないのでstrncpy()でコピーする(SSIDはNULL終端不要)
+    strncpy((char*)wifi_config.sta.ssid, prof->ssid_name, sizeof(wifi_config.sta.ssid));
+    strncpy((char*)wifi_config.sta.password, prof->ssid_pass, sizeof(wifi_config.sta.password));
+    wifi_config.sta.bssid_set = (bssid != NULL);
+    if (bssid) {
+        memcpy(wifi_config.sta.bssid, bssid, sizeof(wifi_config.sta.bssid));
+    }
+    wifi_config.sta.channel = bssid ? channel : 0;
+
+    err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_wifi_set_config failed.(%d)", err);
+        return err;
+    }
+    s_cred_crc = calc_cred_crc(prof->ssid_name, prof->ssid_pass);
+    return ESP_OK;
+}
+
+// ================================================================================================
+// スキャン結果から接続先候補を作る
+// 登録済みのSSIDのAPを 優先度の高い順 → RSSIの強い順 に並べる (同じSSIDのAPが複数あればそれぞれ候補にする)
+// ================================================================================================
+static void build_candidates(void)
+{
+    uint16_t            rec_num = WIFI_SCAN_REC_MAX;
+    wifi_ap_record_t*   recs = (wifi_ap_record_t*)malloc(sizeof(wifi_ap_record_t) * WIFI_SCAN_REC_MAX);
+
+    s_cand_num = 0;
+    s_cand_idx = 0;
+    if (recs == NULL) {
+        ESP_LOGE(TAG, "no memory for scan result");
+        return;
+    }
+    esp_wifi_scan_get_ap_records(&rec_num, recs);           // RSSIの強い順に返ってくる
+
+    for (int i = 0; i < rec_num; i++) {
+        for (int p = 0; p < s_profile_num; p++) {
+            if (strncmp((const char*)recs[i].ssid, s_profiles[p].ssid_name, sizeof(recs[i].ssid)) != 0) {
+                continue;
+            }
+            // 挿入位置を探す (候補が一杯で、最後の候補より悪ければ捨てる)
+            struct wifi_candidate   cand = { .profile = p, .rssi = recs[i].rssi, .channel = recs[i].primary };
+            memcpy(cand.bssid, recs[i].bssid, sizeof(cand.bssid));
+            int     pos = s_cand_num;
+            while (pos > 0 &&
+                   (s_profiles[s_candidates[pos - 1].profile].priority < s_profiles[p].priority ||
+                    (s_profiles[s_candidates[pos - 1].profile].priority == s_profiles[p].priority &&
+                     s_candidates[pos - 1].rssi < cand.rssi))) {
+                pos--;
+            }
+            if (pos >= WIFI_CANDIDATE_MAX) {
+                break;
+            }
+            int     move = (s_cand_num < WIFI_CANDIDATE_MAX ? s_cand_num : WIFI_CANDIDATE_MAX - 1) - pos;
+            memmove(&s_candidates[pos + 1], &s_candidates[pos], sizeof(s_candidates[0]) * move);
+            s_candidates[pos] = cand;
+            if (s_cand_num < WIFI_CANDIDATE_MAX) {
+                s_cand_num++;
+            }
+            break;          // 同じSSIDのプロファイルが複数あっても候補は1つ
+        }
+    }
+    free(recs);
+
+    for (int i = 0; i < s_cand_num; i++) {
+        ESP_LOGI(TAG, "candidate %d : %s  rssi:%d  channel:%d  priority:%d", i,
+                 s_profiles[s_candidates[i].profile].ssid_name, s_candidates[i].rssi,
+                 s_candidates[i].channel, s_profiles[s_candidates[i].profile].priority);
+    }
+}
+
+// ================================================================================================
+// 起動からの経過時間 [ms]
+// ================================================================================================
+static inline uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// 経過時間を記録用の16bitに丸める
+static inline uint16_t elapsed_ms(uint32_t from)
+{
+    uint32_t    t = now_ms() - from;
+    return (t < WIFI_TIME_NONE) ? t : WIFI_TIME_NONE - 1;
+}
+
+// ================================================================================================
+// AP接続開始 (接続試行の記録を開始してから esp_wifi_connect() する)
+// ================================================================================================
+static void sta_connect(uint8_t channel, uint8_t flags)
+{
+    portENTER_CRITICAL(&s_stats_mux);
+    struct wifi_attempt*    rec = &s_attempts[s_attempt_head];
+    memset(rec, 0x00, sizeof(*rec));
+    rec->start_ms = now_ms();
+    rec->scan_ms  = s_scan_ms;
+    rec->assoc_ms = WIFI_TIME_NONE;
+    rec->dhcp_ms  = WIFI_TIME_NONE;
+    rec->retry    = (s_retry_num < UINT8_MAX) ? s_retry_num : UINT8_MAX;
+    rec->channel  = channel;
+    rec->flags    = flags;
+    s_attempt_cur  = s_attempt_head;
+    s_attempt_head = (s_attempt_head + 1) % WIFI_ATTEMPT_LOG_NUM;
+    if (s_attempt_num < WIFI_ATTEMPT_LOG_NUM) {
+        s_attempt_num++;
+    }
+    s_scan_ms = 0;
+    portEXIT_CRITICAL(&s_stats_mux);
+
+    esp_wifi_connect();
+}
+
+// ================================================================================================
+// 接続先候補に接続
+// ================================================================================================
+static void connect_candidate(int idx)
+{
+    const struct wifi_candidate*    cand = &s_candidates[idx];
+
+    s_cand_idx = idx;
+    ESP_LOGI(TAG, "connect to %s (candidate %d/%d)", s_profiles[cand->profile].ssid_name, idx + 1, s_cand_num);
+    if (apply_sta_config(cand->profile, cand->bssid, cand->channel) == ESP_OK) {
+        sta_connect(cand->channel, WIFI_ATTEMPT_FLAG_BSSID);
+    }
+}
+
+// ================================================================================================
+// 接続開始
+// 接続先が1つだけならそのまま接続し、複数あればスキャンして候補を作ってから接続する
+// ================================================================================================
+static void schedule_reconnect(void);
+static void start_connect(void)
+{
+    s_cand_num = 0;
+    s_cand_idx = 0;
+    if (s_fast_connect) {
+        // 接続先は wifi_init_sta() で設定済み
+        sta_connect(s_conn_cache.channel, WIFI_ATTEMPT_FLAG_FAST | WIFI_ATTEMPT_FLAG_BSSID);
+        return;
+    }
+    if (s_profile_num <= 1) {
+        if (apply_sta_config(0, NULL, 0) == ESP_OK) {
+            sta_connect(0, 0);
+        }
+        return;
+    }
+    s_scan_start_ms = now_ms();
+    if (esp_wifi_scan_start(NULL, false) == ESP_OK) {           // 結果は WIFI_EVENT_SCAN_DONE で受け取る
+        s_scanning = true;
+        return;
+    }
+    ESP_LOGW(TAG, "esp_wifi_scan_start failed.");
+    s_retry_num++;
+    schedule_reconnect();
+}
+
+// ================================================================================================
+// 切断理由の記録
+// ================================================================================================
+static void count_disconnect(uint8_t reason)
+{
+    portENTER_CRITICAL(&s_stats_mux);
+    s_stats.disconnect_count++;
+    s_stats.last_reason = reason;
+    int     i;
+    for (i = 0; i < s_stats.reason_num; i++) {
+        if (s_stats.reason[i].reason == reason) {
+            break;
+        }
+    }
+    if (i == s_stats.reason_num) {
+        if (s_stats.reason_num < WIFI_REASON_SLOT_NUM) {
+            s_stats.reason[s_stats.reason_num++].reason = reason;
+        }
+        else {
+            i = WIFI_REASON_SLOT_NUM - 1;           // テーブルが一杯なら最後のスロットを「その他」として使う
+            s_stats.reason[i].reason = WIFI_REASON_OTHER;
+        }
+    }
+    s_stats.reason[i].count++;
+    portEXIT_CRITICAL(&s_stats_mux);
+}
+
+// ================================================================================================
+// 接続状態の取得
+// last_reason : 最後の切断理由 (NULLなら取得しない。切断されたことがなければ0)
+// return : WIFI_STATUS_xxx
+// ================================================================================================
+int wifi_get_status(uint8_t* last_reason)
+{
+    if (last_reason) {
+        portENTER_CRITICAL(&s_stats_mux);
+        *last_reason = s_stats.last_reason;
+        portEXIT_CRITICAL(&s_stats_mux);
+    }
+    if (s_wifi_event_group == NULL) {
+        return WIFI_STATUS_NONE;
+    }
+    EventBits_t bits = xEventGroupGetBits(s_wifi_event_group);
+    if (bits & WIFI_CONNECTED_BIT) {
+        return WIFI_STATUS_CONNECTED;
+    }
+    if (bits & WIFI_FAIL_BIT) {
+        return WIFI_STATUS_FAILED;
+    }
+    return WIFI_STATUS_CONNECTING;
+}
+
+// ================================================================================================
+// 接続状態が変わったときに呼ぶ関数の登録 (NULLで解除)
+// イベントループのタスクから呼ばれるので、hookの中で長い処理はしないこと
+// ================================================================================================
+void wifi_set_status_hook(void (*hook)(void))
+{
+    s_status_hook = hook;
+}
+
+static void notify_status(void)
+{
+    void    (*hook)(void) = s_status_hook;
+    if (hook) {
+        hook();
+    }
+}
+
+// ================================================================================================
+// 再接続の統計情報の取得
+// ================================================================================================
+void wifi_get_reconnect_stats(struct wifi_reconnect_stats* stats)
+{
+    portENTER_CRITICAL(&s_stats_mux);
+    memcpy(stats, &s_stats, sizeof(*stats));
+    portEXIT_CRITICAL(&s_stats_mux);
+}
+
+// ================================================================================================
+// 接続試行の記録の取得 (古い順)
+// return : 取得した記録数
+// ================================================================================================
+int wifi_get_attempt_log(struct wifi_attempt* log, int max)
+{
+    portENTER_CRITICAL(&s_stats_mux);
+    int     num   = (s_attempt_num < max) ? s_attempt_num : max;
+    int     first = (s_attempt_head - num + WIFI_ATTEMPT_LOG_NUM) % WIFI_ATTEMPT_LOG_NUM;
+    for (int i = 0; i < num; i++) {
+        log[i] = s_attempts[(first + i) % WIFI_ATTEMPT_LOG_NUM];
+    }
+    portEXIT_CRITICAL(&s_stats_mux);
+    return num;
+}
+
+// ================================================================================================
+// 接続統計情報の表示 (コンソール用)
+// ================================================================================================
+void wifi_disp_stats(void)
+{
+    static struct wifi_attempt      log[WIFI_ATTEMPT_LOG_NUM];     // スタック節約のためstatic (コンソールからのみ呼ばれる)
+    struct wifi_reconnect_stats     stats;
+
+    wifi_get_reconnect_stats(&stats);
+    int     num = wifi_get_attempt_log(log, WIFI_ATTEMPT_LOG_NUM);
+
+    printf("---------------------------------------\n");
+    printf("    connect : %u   disconnect : %u   retry : %u   last reason : %d\n",
+           stats.connect_count, stats.disconnect_count, stats.retry_count, stats.last_reason);
+    printf("    sta start : %u ms   first ip : %u ms\n", stats.sta_start_ms, stats.first_ip_ms);
+    printf("    retries before connect :");
+    for (int i = 0; i < WIFI_RETRY_HIST_NUM; i++) {
+        printf("  %d%s:%u", i, (i == WIFI_RETRY_HIST_NUM - 1) ? "+" : "", stats.retry_hist[i]);
+    }
+    printf("\n    disconnect reason      :");
+    for (int i = 0; i < stats.reason_num; i++) {
+        printf("  %d:%u", stats.reason[i].reason, stats.reason[i].count);
+    }
+    printf("\n    start[ms]  scan  assoc   dhcp  ch  retry  reason  flags\n");
+    for (int i = 0; i < num; i++) {
+        printf("    %9u  %4d  %5d  %5d  %2d  %5d  %6d  %s%s\n",
+               log[i].start_ms, log[i].scan_ms,
+               (log[i].assoc_ms == WIFI_TIME_NONE) ? -1 : log[i].assoc_ms,
+               (log[i].dhcp_ms  == WIFI_TIME_NONE) ? -1 : log[i].dhcp_ms,
+               log[i].channel, log[i].retry, log[i].reason,
+               (log[i].flags & WIFI_ATTEMPT_FLAG_FAST)  ? "F" : "",
+               (log[i].flags & WIFI_ATTEMPT_FLAG_BSSID) ? "B" : "");
+    }
+    printf("---------------------------------------\n");
+}
+
+// ================================================================================================
+// 接続統計情報のエンコード (BLE読み出し用 フォーマットは wifi_common.h 参照)
+// return : エンコード後の長さ  (領域が足りない場合は -1)
+// ================================================================================================
+static int put_le(uint8_t* buf, int pos, uint32_t val, int len)
+{
+    for (int i = 0; i < len; i++) {
+        buf[pos + i] = (uint8_t)(val >> (8 * i));
+    }
+    return pos + len;
+}
+
+int wifi_encode_stats(uint8_t* buf, int buf_len)
+{
+    static struct wifi_attempt      log[WIFI_ATTEMPT_LOG_NUM];     // スタック節約のためstatic (BTCタスクからのみ呼ばれる)
+    struct wifi_reconnect_stats     stats;
+    int                             pos = 0;
+
+    if (buf_len < WIFI_STATS_MAX_LEN) {
+        return -1;
+    }
+    wifi_get_reconnect_stats(&stats);
+    int     num = wifi_get_attempt_log(log, WIFI_ATTEMPT_LOG_NUM);
+
+    pos = put_le(buf, pos, WIFI_STATS_VERSION,      1);
+    pos = put_le(buf, pos, stats.connect_count,     4);
+    pos = put_le(buf, pos, stats.disconnect_count,  4);
+    pos = put_le(buf, pos, stats.retry_count,       4);
+    pos = put_le(buf, pos, stats.sta_start_ms,      4);
+    pos = put_le(buf, pos, stats.first_ip_ms,       4);
+    pos = put_le(buf, pos, stats.last_reason,       1);
+    for (int i = 0; i < WIFI_RETRY_HIST_NUM; i++) {
+        pos = put_le(buf, pos, stats.retry_hist[i], 2);
+    }
+    pos = put_le(buf, pos, stats.reason_num,        1);
+    for (int i = 0; i < stats.reason_num; i++) {
+        pos = put_le(buf, pos, stats.reason[i].reason, 1);
+        pos = put_le(buf, pos, stats.reason[i].count,  2);
+    }
+    pos = put_le(buf, pos, num,                     1);
+    for (int i = 0; i < num; i++) {
+        pos = put_le(buf, pos, log[i].start_ms,     4);
+        pos = put_le(buf, pos, log[i].scan_ms,      2);
+        pos = put_le(buf, pos, log[i].assoc_ms,     2);
+        pos = put_le(buf, pos, log[i].dhcp_ms,      2);
+        pos = put_le(buf, pos, log[i].reason,       1);
+        pos = put_le(buf, pos, log[i].retry,        1);
+        pos = put_le(buf, pos, log[i].channel,      1);
+        pos = put_le(buf, pos, log[i].flags,        1);
+    }
+    return pos;
+}
+
+// ================================================================================================
+// 再接続までの待ち時間
+// 同じAPに多数のノードがつながっているので、APのリブート後に一斉に再接続しないよう
+// 待ち時間の後半半分をランダムにする
+// ================================================================================================
+static uint32_t calc_retry_delay(int retry)
+{
+    if (retry <= 1) {
+        return 0;                                   // 初回はすぐに再接続
+    }
+    uint32_t    delay = WIFI_RETRY_MAX_MS;
+    if (retry - 2 < 16 && (WIFI_RETRY_BASE_MS << (retry - 2)) < WIFI_RETRY_MAX_MS) {
+        delay = WIFI_RETRY_BASE_MS << (retry - 2);
+    }
+    return delay / 2 + esp_random() % (delay / 2 + 1);
+}
+
+// ================================================================================================
+// 再接続タイマのコールバック
+// 接続処理はイベントループのタスクで行う(接続状態の変数をイベントハンドラと取り合わないため)
+// ================================================================================================
+static void retry_timer_cb(TimerHandle_t timer)
+{
+    if (esp_event_post(WIFI_COMMON_EVENT, WIFI_COMMON_EVENT_RETRY, NULL, 0, 0) != ESP_OK) {
+        xTimerChangePeriod(timer, pdMS_TO_TICKS(WIFI_RETRY_POST_DELAY_MS), 0);     // キューが一杯なので少し後でやり直す
+    }
+}
+
+// ================================================================================================
+// 接続先の変更 (イベントループのタスクで実行)
+// ================================================================================================
+static void reconfigure(const struct wifi_reconfig* req)
+{
+    // 接続先が変わるのでキャッシュ/前回の候補は使わない
+    memcpy(s_profiles, req->profiles, sizeof(s_profiles));
+    s_profile_num = req->profile_num;
+    cancel_fast_connect();
+    s_cand_num = 0;
+
+    // 接続結果を待てるようにイベントビットとリトライ回数をクリア (バックオフ待ちも中止)
+    xTimerStop(s_retry_timer, 0);
+    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+    s_retry_num = 0;
+    notify_status();
+
+    if (s_sta_connected) {
+        // 切断すると STA_DISCONNECTED イベントで新しい設定で再接続される
+        ESP_LOGI(TAG, "reconnect to the AP with new config");
+        esp_wifi_disconnect();
+    }
+    else if (!s_scanning) {
+        // 未接続(バックオフ待ち or 接続中)なら新しい設定で接続し直す
+        // (スキャン中ならスキャン完了時に新しい設定で候補が作られる)
+        ESP_LOGI(TAG, "connect to the AP with new config");
+        start_connect();
+    }
+}
+
+// ================================================================================================
+// 再接続の予約
+// ================================================================================================
+static void schedule_reconnect(void)
+{
+    uint32_t    delay = calc_retry_delay(s_retry_num);
+
+    portENTER_CRITICAL(&s_stats_mux);
+    s_stats.retry_count++;
+    portEXIT_CRITICAL(&s_stats_mux);
+
+    if (delay == 0) {
+        ESP_LOGI(TAG, "retry to connect to the AP  (%d)", s_retry_num);
+        start_connect();
+        return;
+    }
+    ESP_LOGI(TAG, "retry to connect to the AP after %d ms  (%d)", (int)delay, s_retry_num);
+    xTimerChangePeriod(s_retry_timer, pdMS_TO_TICKS(delay), 0);        // 停止中のタイマは開始される
+}
+
 // ================================================================================================
 // Wi-Fi/IPのイベントハンドラ
 // ================================================================================================
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
-    // 接続リトライ回数
-    static int s_retry_num = 0;
-
     if (event_base == WIFI_EVENT) {
         switch  (event_id) {
           case WIFI_EVENT_STA_START :                  // STARTイベント
             ESP_LOGI(TAG, "connect to the AP");
-            esp_wifi_connect();         // 接続開始
+            portENTER_CRITICAL(&s_stats_mux);
+            s_stats.sta_start_ms = now_ms();
+            portEXIT_CRITICAL(&s_stats_mux);
+            BOOT_PROF_MARK("sta_start");
+            start_connect();            // 接続開始
+            break;
+          case WIFI_EVENT_SCAN_DONE :                   // スキャン完了イベント
+            s_scanning = false;
+            s_scan_ms = elapsed_ms(s_scan_start_ms);
+            build_candidates();
+            if (s_cand_num > 0) {
+                connect_candidate(0);
+            }
+            else {
+                // 登録済みのAPが見つからない → バックオフしてスキャンし直す
+                ESP_LOGI(TAG, "no registered AP found");
+                s_retry_num++;
+                if (s_retry_num == EXAMPLE_ESP_MAXIMUM_RETRY) {
+                    xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+                    notify_status();
+                }
+                schedule_reconnect();
+            }
             break;
           case WIFI_EVENT_STA_CONNECTED :               // CONNECTEDイベント
             {
                 // wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;      // SSID名などが得られる
                 
                 ESP_LOGI(TAG, "Wi-Fi connected");
+                s_sta_connected = true;
+                portENTER_CRITICAL(&s_stats_mux);
+                s_connected_ms = now_ms();
+                if (s_attempt_cur >= 0) {
+                    s_attempts[s_attempt_cur].assoc_ms = elapsed_ms(s_attempts[s_attempt_cur].start_ms);
+                }
+                portEXIT_CRITICAL(&s_stats_mux);
                 // ここではまだIPアドレスが取得できていないので何もしない
             }
             break;
           case WIFI_EVENT_STA_DISCONNECTED :            // DISCONNECTEDイベント
             {
                 wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;      // SSID名などが得られる
-                if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY) {
-                    // リトライ回数に達していない → リトライ
-                    s_retry_num++;
-                    ESP_LOGI(TAG, "retry to connect to the AP  (%d)   reason:0x%02x", s_retry_num, event->reason);      // reasonの型は enum wifi_err_reason_t かな?
-                    esp_wifi_connect();         // 再度 接続開始
-                } else {
-                    // リトライ回数に達した → エラー終了
+                s_sta_connected = false;
+                ESP_LOGI(TAG, "disconnected   reason:0x%02x", event->reason);      // reasonの型は enum wifi_err_reason_t かな?
+                count_disconnect(event->reason);
+                portENTER_CRITICAL(&s_stats_mux);
+                if (s_attempt_cur >= 0) {
+                    s_attempts[s_attempt_cur].reason = event->reason;
+                    s_attempt_cur = -1;
+                }
+                portEXIT_CRITICAL(&s_stats_mux);
+                if (s_fast_connect) {
+                    // キャッシュした接続先につながらなかった(APの変更など) → 通常の接続に戻してリトライする
+                    ESP_LOGI(TAG, "fast connect failed (reason:0x%02x). fall back to full scan", event->reason);
+                    cancel_fast_connect();
+                }
+                else if (s_cand_idx + 1 < s_cand_num) {
+                    // 次の候補があれば、スキャンし直さずにすぐ接続する
+                    connect_candidate(s_cand_idx + 1);
+                    notify_status();            // 切断理由が変わった
+                    break;
+                }
+                xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+
+                // 接続できるまでバックオフしながら再接続し続ける
+                s_retry_num++;
+                if (s_retry_num == EXAMPLE_ESP_MAXIMUM_RETRY) {
+                    // リトライ回数に達した → 接続失敗を通知 (再接続は続ける)
                     ESP_LOGI(TAG, "connect to the AP fail");
-                    // 接続失敗を通知
                     xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
                 }
+                notify_status();
+                schedule_reconnect();
             }
             break;
           default :
@@ -96,9 +793,35 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
                 ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
                 ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
                 my_ipaddr = event->ip_info.ip;                  // 自身に割り当てられたIPアドレスを記憶しておく
+                bool    first_ip = false;
+                portENTER_CRITICAL(&s_stats_mux);
+                s_stats.connect_count++;
+                s_stats.retry_hist[(s_retry_num < WIFI_RETRY_HIST_NUM) ? s_retry_num : WIFI_RETRY_HIST_NUM - 1]++;
+                if (s_stats.first_ip_ms == 0) {
+                    s_stats.first_ip_ms = now_ms();
+                    first_ip = true;
+                }
+                if (s_attempt_cur >= 0) {
+                    s_attempts[s_attempt_cur].dhcp_ms = elapsed_ms(s_connected_ms);
+                    s_attempt_cur = -1;
+                }
+                portEXIT_CRITICAL(&s_stats_mux);
+                if (first_ip) {
+                    BOOT_PROF_MARK("got_ip");
+                }
                 s_retry_num = 0;
+                s_fast_connect = false;
+                // 次回起動時に高速接続できるよう接続先/IPアドレスを記憶しておく (変化がなければ書き込まない)
+                update_conn_cache(&event->ip_info);
+                // この設定で接続できたので、設定パラメータのスロットを確認済みにする(ロールバック対象外)
+                // NVSの読み書きはイベントループのスタックでは足りないのでワーカータスクに依頼する
+                if (!param_ctrl_post(PARAM_CTRL_OP_CONFIRM)) {
+                    ESP_LOGW(TAG, "param confirm request failed");
+                }
                 // 接続成功を通知
+                xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
                 xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+                notify_status();
             }
             break;
           default :
@@ -106,6 +829,19 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
             break;
         }
     }
+    else if (event_base == WIFI_COMMON_EVENT) {
+        switch  (event_id) {
+          case WIFI_COMMON_EVENT_RETRY :                // 再接続タイマ満了
+            ESP_LOGI(TAG, "retry to connect to the AP  (%d)", s_retry_num);
+            start_connect();
+            break;
+          case WIFI_COMMON_EVENT_RECONFIGURE :          // 接続先の変更
+            reconfigure((const struct wifi_reconfig*)event_data);
+            break;
+          default :
+            break;
+        }
+    }
     else {
         // それ以外は発生しないはずだが念のため
         ESP_LOGI(TAG, "UNKNOWN EVENT event_base: %s   event_id: %d", event_base, event_id);
@@ -140,10 +876,7 @@ esp_err_t wait_wifi_connect(void)
         ESP_LOGE(TAG, "UNEXPECTED EVENT");
     }
 
-    // イベントグループ/イベントハンドラの削除(接続後はもう使わないので)
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, instance_got_ip));
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, instance_any_id));
-    vEventGroupDelete(s_wifi_event_group);
+    // イベントグループ/イベントハンドラは wifi_reconfigure_sta() での再接続でも使うので削除しない
 
     return ret;
 
@@ -152,19 +885,28 @@ esp_err_t wait_wifi_connect(void)
 // ================================================================================================
 // wi-fi ステーション(STA)モード(クライアント)   初期化
 // ================================================================================================
-esp_err_t wifi_init_sta(char* ssid_name, char* ssid_pass)
+esp_err_t wifi_init_sta(const struct app_param* pParam)
 {
     esp_err_t       err = ESP_OK;
 
+    // イベントハンドラ等は一度だけ登録して、以降は動作中ずっと使い続ける
+    if (s_wifi_event_group != NULL) {
+        ESP_LOGW(TAG, "already initialized. use wifi_reconfigure_sta()");
+        return ESP_ERR_INVALID_STATE;
+    }
+
     // イベントグループの生成
     s_wifi_event_group = xEventGroupCreate();
 
+    // 再接続タイマの生成 (周期は schedule_reconnect() で設定する)
+    s_retry_timer = xTimerCreate("wifi_retry", 1, pdFALSE, NULL, retry_timer_cb);
+
     // NETインタフェース初期化
     ESP_ERROR_CHECK(esp_netif_init());
 
     // イベントループ/イベントハンドラの初期化
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    s_sta_netif = esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -179,6 +921,11 @@ esp_err_t wifi_init_sta(char* ssid_name, char* ssid_pass)
                                                         &event_handler,
                                                         NULL,
                                                         &instance_got_ip));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_COMMON_EVENT,
+                                                        ESP_EVENT_ANY_ID,
+                                                        &event_handler,
+                                                        NULL,
+                                                        &instance_common));
 
     // Wi-Fi パラメータ初期化
     wifi_config_t wifi_config = {
@@ -190,13 +937,34 @@ esp_err_t wifi_init_sta(char* ssid_name, char* ssid_pass)
             },
         },
     };
-    strcpy((char*)wifi_config.sta.ssid, ssid_name);
-    strcpy((char*)wifi_config.sta.password, ssid_pass);
+    // 接続先(SSID/パスワード)は apply_sta_config() で設定する (Wi-Fi開始前なのでイベントハンドラとは競合しない)
+    s_profile_num = make_profiles(pParam, s_profiles);
 
     // Wi-Fi 設定
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
 
+    // 前回と同じ接続先なら、前回のBSSID/チャネルに直接接続する(スキャンを省略)
+    load_conn_cache();
+    for (int i = 0; s_conn_cache_valid && i < s_profile_num; i++) {
+        if (s_conn_cache.cred_crc != calc_cred_crc(s_profiles[i].ssid_name, s_profiles[i].ssid_pass)) {
+            continue;
+        }
+        ESP_LOGI(TAG, "fast connect to %s (channel %d)", s_profiles[i].ssid_name, s_conn_cache.channel);
+        if (apply_sta_config(i, s_conn_cache.bssid, s_conn_cache.channel) != ESP_OK) {
+            break;
+        }
+        s_fast_connect = true;
+#if WIFI_REUSE_CACHED_IP
+        // 前回のIPアドレスを固定で設定する(DHCPを省略)
+        esp_netif_dns_info_t    dns = { .ip.u_addr.ip4 = s_conn_cache.dns, .ip.type = ESP_IPADDR_TYPE_V4 };
+        esp_netif_dhcpc_stop(s_sta_netif);
+        esp_netif_set_ip_info(s_sta_netif, &s_conn_cache.ip_info);
+        esp_netif_set_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+#endif
+        break;
+    }
+
     // Wi-Fi スタート
     ESP_ERROR_CHECK(esp_wifi_start() );
 
@@ -205,3 +973,19 @@ esp_err_t wifi_init_sta(char* ssid_name, char* ssid_pass)
 
     return err;
 }
+
+// ================================================================================================
+// wi-fi ステーション(STA)モード   接続先の変更 (wifi_init_sta()の後で使用する)
+// リブートせずに新しい接続先で接続し直す。結果は wait_wifi_connect() で待つ
+// 実際の変更はイベントループのタスクで行う
+// ================================================================================================
+esp_err_t wifi_reconfigure_sta(const struct app_param* pParam)
+{
+    static struct wifi_reconfig req;        // スタック節約のためstatic (esp_event_post()でコピーされる)
+
+    req.profile_num = make_profiles(pParam, req.profiles);
+
+    // wait_wifi_connect() が前の接続結果で戻らないよう、先にイベントビットをクリアしておく
+    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+    return esp_event_post(WIFI_COMMON_EVENT, WIFI_COMMON_EVENT_RECONFIGURE, &req, sizeof(req), portMAX_DELAY);
+}
@@ -6,10 +6,83 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 #include "esp_netif_ip_addr.h"
+#include "esp_netif_types.h"
+
+// 接続情報キャッシュ (最後にIPアドレスを取得できたときの接続先)
+#define WIFI_CONN_CACHE_VERSION     1
+struct wifi_conn_cache {
+    uint8_t                 version;            // WIFI_CONN_CACHE_VERSION
+    uint8_t                 channel;            // APのチャネル
+    uint8_t                 bssid[6];           // APのBSSID
+    uint32_t                cred_crc;           // SSID/パスワードのCRC (接続先が変わったら使わない)
+    esp_netif_ip_info_t     ip_info;            // 取得したIPアドレス/ネットマスク/ゲートウェイ
+    esp_ip4_addr_t          dns;                // DNSサーバ
+};
+
+// 再接続の統計情報
+#define WIFI_REASON_SLOT_NUM        8               // 記録する切断理由の種類数
+#define WIFI_REASON_OTHER           0               // スロットに入りきらなかった切断理由
+struct wifi_reason_count {
+    uint8_t                 reason;             // 切断理由 (wifi_err_reason_t)
+    uint32_t                count;              // 発生回数
+};
+#define WIFI_RETRY_HIST_NUM         5               // 接続までのリトライ回数のヒストグラム (0,1,2,3,4回以上)
+struct wifi_reconnect_stats {
+    uint32_t                connect_count;      // IPアドレス取得回数
+    uint32_t                disconnect_count;   // 切断回数
+    uint32_t                retry_count;        // 再接続回数
+    uint32_t                sta_start_ms;       // WIFI_EVENT_STA_START の時刻 (起動からのms)
+    uint32_t                first_ip_ms;        // 最初にIPアドレスを取得した時刻 (起動からのms)
+    uint8_t                 last_reason;        // 最後の切断理由
+    uint8_t                 reason_num;         // reason[]の使用数
+    struct wifi_reason_count reason[WIFI_REASON_SLOT_NUM];
+    uint32_t                retry_hist[WIFI_RETRY_HIST_NUM];
+};
+
+// 接続試行の記録 (esp_wifi_connect() 1回分)
+#define WIFI_ATTEMPT_LOG_NUM        16              // 記録する試行数 (古いものから上書き)
+#define WIFI_TIME_NONE              0xffff          // 未到達
+#define WIFI_ATTEMPT_FLAG_FAST      0x01            // 接続情報キャッシュを使った
+#define WIFI_ATTEMPT_FLAG_BSSID     0x02            // BSSID/チャネルを指定した
+struct wifi_attempt {
+    uint32_t                start_ms;           // 開始時刻 (起動からのms)
+    uint16_t                scan_ms;            // 直前のスキャン時間 (スキャンしていなければ0)
+    uint16_t                assoc_ms;           // 開始 → STA_CONNECTED (認証/アソシエーション)
+    uint16_t                dhcp_ms;            // STA_CONNECTED → GOT_IP (DHCP)
+    uint8_t                 reason;             // 失敗時の切断理由 (成功/結果待ちなら0)
+    uint8_t                 retry;              // リトライ回数
+    uint8_t                 channel;            // 指定したチャネル (0なら指定なし)
+    uint8_t                 flags;              // WIFI_ATTEMPT_FLAG_xxx
+};
+
+/* ---- 接続統計情報のエンコード形式 (BLE読み出し用) ------
+    数値はリトルエンディアン
+    version(1) connect(4) disconnect(4) retry(4) sta_start_ms(4) first_ip_ms(4) last_reason(1)
+    retry_hist(2 × WIFI_RETRY_HIST_NUM)
+    reason_num(1) { reason(1) count(2) } × reason_num
+    attempt_num(1) { start_ms(4) scan_ms(2) assoc_ms(2) dhcp_ms(2) reason(1) retry(1) channel(1) flags(1) } × attempt_num  (古い順)
+   ------------------------------------------------------- */
+#define WIFI_STATS_VERSION          0x01
+#define WIFI_STATS_MAX_LEN          (22 + 2 * WIFI_RETRY_HIST_NUM + 1 + 3 * WIFI_REASON_SLOT_NUM + 1 + 14 * WIFI_ATTEMPT_LOG_NUM)
+
+// 接続状態 (wifi_get_status())
+#define WIFI_STATUS_NONE            0               // 未開始
+#define WIFI_STATUS_CONNECTING      1               // 接続中/再接続中
+#define WIFI_STATUS_CONNECTED       2               // IPアドレス取得済み
+#define WIFI_STATUS_FAILED          3               // リトライ回数に達した (再接続は続けている)
 
 
 extern esp_err_t wait_wifi_connect(void);
-extern esp_err_t wifi_init_sta(char* ssid_name, char* ssid_pass);
+struct app_param;
+extern esp_err_t wifi_init_sta(const struct app_param* pParam);
+extern esp_err_t wifi_reconfigure_sta(const struct app_param* pParam);
+extern void      wifi_get_reconnect_stats(struct wifi_reconnect_stats* stats);
+extern int       wifi_get_attempt_log(struct wifi_attempt* log, int max);
+extern void      wifi_disp_stats(void);
+extern int       wifi_encode_stats(uint8_t* buf, int buf_len);
+extern int       wifi_get_status(uint8_t* last_reason);
+extern void      wifi_set_status_hook(void (*hook)(void));
+extern void      wifi_save_conn_cache(void);
 
 // 自身に割り当てられたIPアドレス
 extern esp_ip4_addr_t my_ipaddr;
@@ -0,0 +1,11 @@
+/*
+   ホストでのユニットテスト用 (pio test -e native)
+   ログは表示しない
+*/
+#pragma once
+
+#define ESP_LOGE(tag, format, ...)  ((void)(tag))
+#define ESP_LOGW(tag, format, ...)  ((void)(tag))
+#define ESP_LOGI(tag, format, ...)  ((void)(tag))
+#define ESP_LOGD(tag, format, ...)  ((void)(tag))
+#define ESP_LOGV(tag, format, ...)  ((void)(tag))
@@ -0,0 +1,19 @@
+/*
+   ホストでのユニットテスト用 (pio test -e native)
+   ROMのCRC32(リトルエンディアン)と同じ計算 (zlib の crc32() と同じ値になる)
+*/
+#pragma once
+
+#include    <stdint.h>
+
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
@@ -0,0 +1,11 @@
+/*
+   ホストでのユニットテスト用 (pio test -e native)
+   app_param.h の宣言に必要な型だけを定義する
+*/
+#pragma once
+
+#include    <stdint.h>
+#include    <stdbool.h>
+
+typedef void*   QueueHandle_t;
+typedef void*   TaskHandle_t;
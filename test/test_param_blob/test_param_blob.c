@@ -0,0 +1,195 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- パラメータブロブのテスト (pio test -e native) ------
+    エンコード→デコードで元に戻ること、
+    不正なブロブは拒否され、その場合は設定値が変更されないことを確認する
+   ------------------------------------------------------- */
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    <unity.h>
+
+#include    "esp_err.h"
+#include    "app_param.h"
+#include    "param_blob.h"
+
+// ==== static 変数 ===========================================================================================
+static struct app_param     src_param;                  // エンコード元
+static struct app_param     dst_param;                  // デコード先
+static uint8_t              blob[PARAM_BLOB_MAX_LEN];
+static int                  blob_len;
+
+// ================================================================================================
+// テスト毎の初期化
+// ================================================================================================
+void setUp(void)
+{
+    memset(&src_param, 0x00, sizeof(src_param));
+    strcpy(src_param.ssid_name, "test-ssid");
+    strcpy(src_param.ssid_pass, "test-pass");
+    src_param.loop_interval = 0x12345678;
+    strcpy(src_param.ap_profile[2].ssid_name, "sub-ssid");
+    strcpy(src_param.ap_profile[2].ssid_pass, "sub-pass");
+    src_param.ap_profile[2].priority = 200;
+
+    memset(&dst_param, 0x00, sizeof(dst_param));
+    blob_len = param_blob_encode(&src_param, blob, sizeof(blob));
+}
+
+void tearDown(void)
+{
+}
+
+// ================================================================================================
+// デコード先が変更されていないか
+// ================================================================================================
+static void assert_untouched(void)
+{
+    struct app_param    zero;
+    memset(&zero, 0x00, sizeof(zero));
+    TEST_ASSERT_EQUAL_MEMORY(&zero, &dst_param, sizeof(dst_param));
+}
+
+// ================================================================================================
+// エンコード→デコードで元に戻る
+// ================================================================================================
+static void test_round_trip(void)
+{
+    TEST_ASSERT_GREATER_THAN(0, blob_len);
+    TEST_ASSERT_EQUAL_HEX8(PARAM_BLOB_VERSION, blob[0]);
+    TEST_ASSERT_EQUAL(ESP_OK, param_blob_decode(blob, blob_len, &dst_param));
+    TEST_ASSERT_EQUAL_STRING(src_param.ssid_name, dst_param.ssid_name);
+    TEST_ASSERT_EQUAL_STRING(src_param.ssid_pass, dst_param.ssid_pass);
+    TEST_ASSERT_EQUAL_HEX32(src_param.loop_interval, dst_param.loop_interval);
+    TEST_ASSERT_EQUAL_MEMORY(src_param.ap_profile, dst_param.ap_profile, sizeof(src_param.ap_profile));
+}
+
+// ================================================================================================
+// 全項目を最大長にしてもバッファに収まる
+// ================================================================================================
+static void test_round_trip_max_len(void)
+{
+    memset(src_param.ssid_name, 'n', sizeof(src_param.ssid_name) - 1);
+    memset(src_param.ssid_pass, 'p', sizeof(src_param.ssid_pass) - 1);
+    for (int i = 0; i < AP_PROFILE_NUM; i++) {
+        memset(src_param.ap_profile[i].ssid_name, 'N', sizeof(src_param.ap_profile[i].ssid_name) - 1);
+        memset(src_param.ap_profile[i].ssid_pass, 'P', sizeof(src_param.ap_profile[i].ssid_pass) - 1);
+        src_param.ap_profile[i].priority = i;
+    }
+    blob_len = param_blob_encode(&src_param, blob, sizeof(blob));
+    TEST_ASSERT_EQUAL(PARAM_BLOB_MAX_LEN, blob_len);
+    TEST_ASSERT_EQUAL(ESP_OK, param_blob_decode(blob, blob_len, &dst_param));
+    TEST_ASSERT_EQUAL_MEMORY(&src_param, &dst_param, sizeof(src_param));
+
+    // 1byteでも足りなければエンコードしない
+    TEST_ASSERT_EQUAL(-1, param_blob_encode(&src_param, blob, PARAM_BLOB_MAX_LEN - 1));
+}
+
+// ================================================================================================
+// TLVの途中で切れたブロブは、どの位置で切れても拒否する
+// (TLVの区切りで切れたものは一部の項目だけの書き込みとして有効)
+// ================================================================================================
+static void test_reject_truncated(void)
+{
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, param_blob_decode(blob, 0, &dst_param));
+    assert_untouched();
+
+    for (int pos = 1; pos < blob_len; pos += 2 + blob[pos + 1]) {
+        for (int len = pos + 1; len < pos + 2 + blob[pos + 1]; len++) {
+            TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, param_blob_decode(blob, len, &dst_param));
+            assert_untouched();
+        }
+    }
+}
+
+// ================================================================================================
+// 格納先より長い値は拒否する
+// ================================================================================================
+static void test_reject_overlong(void)
+{
+    uint8_t     buf[8 + SSID_PASS_SIZE];
+    int         pos = 0;
+
+    // SSID名 : NULL文字の分が入らない長さ
+    buf[pos++] = PARAM_BLOB_VERSION;
+    buf[pos++] = PARAM_BLOB_TAG_SSID_NAME;
+    buf[pos++] = SSID_NAME_SIZE;
+    memset(&buf[pos], 'n', SSID_NAME_SIZE);
+    pos += SSID_NAME_SIZE;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, param_blob_decode(buf, pos, &dst_param));
+    assert_untouched();
+
+    // ループインターバル : 4byte以外
+    pos = 0;
+    buf[pos++] = PARAM_BLOB_VERSION;
+    buf[pos++] = PARAM_BLOB_TAG_LOOP_IVAL;
+    buf[pos++] = sizeof(uint32_t) + 1;
+    memset(&buf[pos], 0x01, sizeof(uint32_t) + 1);
+    pos += sizeof(uint32_t) + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, param_blob_decode(buf, pos, &dst_param));
+    assert_untouched();
+
+    // TLVの長さがブロブの残りより長い
+    memcpy(buf, blob, 4);
+    buf[2] = 0xff;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, param_blob_decode(buf, 4, &dst_param));
+    assert_untouched();
+}
+
+// ================================================================================================
+// 未知のバージョンは拒否する
+// ================================================================================================
+static void test_reject_unknown_version(void)
+{
+    blob[0] = PARAM_BLOB_VERSION + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, param_blob_decode(blob, blob_len, &dst_param));
+    assert_untouched();
+}
+
+// ================================================================================================
+// 未知のtagは読み飛ばす
+// ================================================================================================
+static void test_skip_unknown_tag(void)
+{
+    uint8_t     buf[PARAM_BLOB_MAX_LEN + 4];
+    memcpy(buf, blob, blob_len);
+    buf[blob_len + 0] = 0x7f;
+    buf[blob_len + 1] = 2;
+    buf[blob_len + 2] = 0xaa;
+    buf[blob_len + 3] = 0x55;
+    TEST_ASSERT_EQUAL(ESP_OK, param_blob_decode(buf, blob_len + 4, &dst_param));
+    TEST_ASSERT_EQUAL_STRING(src_param.ssid_name, dst_param.ssid_name);
+}
+
+// ================================================================================================
+// 必須項目が空になる場合は拒否する
+// ================================================================================================
+static void test_reject_empty_required(void)
+{
+    src_param.loop_interval = 0;
+    blob_len = param_blob_encode(&src_param, blob, sizeof(blob));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, param_blob_decode(blob, blob_len, &dst_param));
+    assert_untouched();
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_round_trip_max_len);
+    RUN_TEST(test_reject_truncated);
+    RUN_TEST(test_reject_overlong);
+    RUN_TEST(test_reject_unknown_version);
+    RUN_TEST(test_skip_unknown_tag);
+    RUN_TEST(test_reject_empty_required);
+    return UNITY_END();
+}
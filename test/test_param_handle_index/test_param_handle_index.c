@@ -0,0 +1,175 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- ハンドル→インデックス変換のテスト (pio test -e native) --
+    連番のハンドルテーブルから正しくインデックスを引けること、範囲外/未登録を弾くことを確認する。
+    あわせて characteristic 数 3〜64 で1イベントあたりの変換時間を計測して表示する
+    (比較のため、テーブルを先頭から探す方法の時間も表示する)
+   ------------------------------------------------------- */
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+#include    <time.h>
+
+#include    <unity.h>
+
+#include    "param_handle_index.h"
+
+// ==== マクロ定義 ===========================================================================================
+#define HANDLE_BASE         0x0028          // サービス宣言のハンドル
+#define ATTR_MAX            (64 * 3 + 1)    // characteristic 64個 (宣言/値/CCC) + サービス宣言
+#define BENCH_NUM           (4096 * 1024)   // 計測時の変換回数 (イベント列の長さの倍数)
+
+// ==== static 変数 ===========================================================================================
+static struct param_handle_index    hidx;
+static uint16_t                     handles[ATTR_MAX];
+static uint16_t                     events[1024];           // 計測で変換するハンドル (イベント列)
+static volatile int                 sink;                   // 最適化で計測ループが消えないように
+
+// ================================================================================================
+// 連番のハンドルテーブルを作る
+// ================================================================================================
+static void make_handles(int num)
+{
+    for (int i = 0; i < num; i++) {
+        handles[i] = HANDLE_BASE + i;
+    }
+}
+
+// ================================================================================================
+// 比較用: テーブルを先頭から探す
+// ================================================================================================
+static int linear_lookup(const uint16_t* table, int num, uint16_t handle)
+{
+    for (int i = 0; i < num; i++) {
+        if (table[i] == handle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// ================================================================================================
+// 経過時間 [ns]
+// ================================================================================================
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// ================================================================================================
+// テスト毎の初期化
+// ================================================================================================
+void setUp(void)
+{
+    param_handle_index_reset(&hidx);
+    make_handles(ATTR_MAX);
+}
+
+void tearDown(void)
+{
+}
+
+// ================================================================================================
+// 全ハンドルが自分のインデックスに変換される
+// ================================================================================================
+static void test_lookup(void)
+{
+    TEST_ASSERT_TRUE(param_handle_index_build(&hidx, handles, 16));
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_EQUAL(i, param_handle_index_lookup(&hidx, handles[i]));
+    }
+}
+
+// ================================================================================================
+// 範囲外のハンドルは見つからない
+// ================================================================================================
+static void test_out_of_range(void)
+{
+    TEST_ASSERT_TRUE(param_handle_index_build(&hidx, handles, 16));
+    TEST_ASSERT_EQUAL(-1, param_handle_index_lookup(&hidx, HANDLE_BASE - 1));
+    TEST_ASSERT_EQUAL(-1, param_handle_index_lookup(&hidx, HANDLE_BASE + 16));
+    TEST_ASSERT_EQUAL(-1, param_handle_index_lookup(&hidx, 0x0000));
+    TEST_ASSERT_EQUAL(-1, param_handle_index_lookup(&hidx, 0xffff));
+}
+
+// ================================================================================================
+// 未登録/連番でないテーブルでは何も見つからない
+// ================================================================================================
+static void test_not_built(void)
+{
+    TEST_ASSERT_EQUAL(-1, param_handle_index_lookup(&hidx, HANDLE_BASE));
+
+    handles[5]++;           // 途中で飛んでいる
+    TEST_ASSERT_FALSE(param_handle_index_build(&hidx, handles, 16));
+    TEST_ASSERT_EQUAL(-1, param_handle_index_lookup(&hidx, HANDLE_BASE));
+
+    // 作り直せば引ける
+    make_handles(16);
+    TEST_ASSERT_TRUE(param_handle_index_build(&hidx, handles, 16));
+    TEST_ASSERT_EQUAL(5, param_handle_index_lookup(&hidx, HANDLE_BASE + 5));
+    param_handle_index_reset(&hidx);
+    TEST_ASSERT_EQUAL(-1, param_handle_index_lookup(&hidx, HANDLE_BASE + 5));
+}
+
+// ================================================================================================
+// 1イベントあたりの変換時間の計測 (characteristic 数 3〜64)
+// ================================================================================================
+static void test_bench_lookup(void)
+{
+    static const int    char_num[] = {3, 8, 16, 32, 64};
+    struct timespec     start, end;
+    uint32_t            rnd = 1;
+    int                 sum, expect;
+
+    for (int n = 0; n < sizeof(char_num) / sizeof(char_num[0]); n++) {
+        int     num = char_num[n] * 3 + 1;          // attribute数
+
+        TEST_ASSERT_TRUE(param_handle_index_build(&hidx, handles, num));
+        expect = 0;
+        for (int i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+            rnd = rnd * 1103515245 + 12345;
+            events[i] = HANDLE_BASE + (rnd >> 16) % num;
+            expect += events[i] - HANDLE_BASE;
+        }
+
+        sum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCH_NUM; i++) {
+            sum += param_handle_index_lookup(&hidx, events[i % 1024]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        sink = sum;
+        TEST_ASSERT_EQUAL(expect * (BENCH_NUM / 1024), sum);
+        double  index_ns = elapsed_ns(&start, &end) / BENCH_NUM;
+
+        sum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCH_NUM; i++) {
+            sum += linear_lookup(handles, num, events[i % 1024]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        sink = sum;
+        TEST_ASSERT_EQUAL(expect * (BENCH_NUM / 1024), sum);
+        double  linear_ns = elapsed_ns(&start, &end) / BENCH_NUM;
+
+        printf("    %2d characteristics : index %5.1f ns/op   linear %6.1f ns/op\n", char_num[n], index_ns, linear_ns);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_lookup);
+    RUN_TEST(test_out_of_range);
+    RUN_TEST(test_not_built);
+    RUN_TEST(test_bench_lookup);
+    return UNITY_END();
+}
@@ -0,0 +1,354 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- 設定パラメータレコード(A/Bスロット)のテスト (pio test -e native) --
+    新しい方のスロットがどの位置で切れても/壊れても、古い方のスロットが選ばれること、
+    不正なレコードは拒否され、その場合は設定値が変更されないこと、
+    確認前に何回セーブしても確認済みのスロットにロールバックできることを確認する。
+    あわせて LoadParam() でのレコードのデコード/スロット選択にかかる時間を計測して表示する
+   ------------------------------------------------------- */
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+#include    <stddef.h>
+#include    <time.h>
+
+#include    <unity.h>
+
+#include    "esp_err.h"
+#include    "esp_rom_crc.h"
+#include    "app_param.h"
+#include    "param_blob.h"
+#include    "param_rec.h"
+
+// ==== マクロ定義 ===========================================================================================
+#define BENCH_NUM           100000          // 計測時のロード回数
+
+// ==== static 変数 ===========================================================================================
+static struct app_param     old_param;                  // スロットA (古い方)
+static struct app_param     new_param;                  // スロットB (新しい方)
+static uint8_t              rec[PARAM_SLOT_NUM][PARAM_REC_MAX_LEN + 1];
+static int                  rec_len[PARAM_SLOT_NUM];
+
+static struct app_param     slot_param[PARAM_SLOT_NUM]; // デコード結果
+static struct param_rec_hdr hdr[PARAM_SLOT_NUM];
+static bool                 valid[PARAM_SLOT_NUM];
+
+// ================================================================================================
+// テスト毎の初期化
+// ================================================================================================
+void setUp(void)
+{
+    memset(&old_param, 0x00, sizeof(old_param));
+    strcpy(old_param.ssid_name, "old-ssid");
+    strcpy(old_param.ssid_pass, "old-pass");
+    old_param.loop_interval = 10;
+    old_param.generation    = 7;
+
+    memset(&new_param, 0x00, sizeof(new_param));
+    strcpy(new_param.ssid_name, "new-ssid");
+    strcpy(new_param.ssid_pass, "new-pass");
+    new_param.loop_interval = 20;
+    strcpy(new_param.ap_profile[0].ssid_name, "sub-ssid");
+    strcpy(new_param.ap_profile[0].ssid_pass, "sub-pass");
+    new_param.ap_profile[0].priority = 1;
+    new_param.generation    = 8;
+
+    rec_len[0] = param_rec_encode(&old_param, 1, PARAM_REC_STATE_CONFIRMED, rec[0], PARAM_REC_MAX_LEN);
+    rec_len[1] = param_rec_encode(&new_param, 2, PARAM_REC_STATE_PENDING,   rec[1], PARAM_REC_MAX_LEN);
+}
+
+void tearDown(void)
+{
+}
+
+// ================================================================================================
+// LoadParam() と同じ手順で両方のスロットをデコードして選択
+// return : 選択されたスロット
+// ================================================================================================
+static int load_slots(void)
+{
+    for (int i = 0; i < PARAM_SLOT_NUM; i++) {
+        memset(&slot_param[i], 0x00, sizeof(slot_param[i]));
+        valid[i] = (param_rec_decode(rec[i], rec_len[i], &slot_param[i], &hdr[i]) == ESP_OK);
+    }
+    return param_rec_select(valid, hdr);
+}
+
+// ================================================================================================
+// スロットの中身が param と一致するか
+// ================================================================================================
+static void assert_slot(int slot, const struct app_param* param)
+{
+    TEST_ASSERT_EQUAL_STRING(param->ssid_name, slot_param[slot].ssid_name);
+    TEST_ASSERT_EQUAL_STRING(param->ssid_pass, slot_param[slot].ssid_pass);
+    TEST_ASSERT_EQUAL_UINT32(param->loop_interval, slot_param[slot].loop_interval);
+    TEST_ASSERT_EQUAL_MEMORY(param->ap_profile, slot_param[slot].ap_profile, sizeof(param->ap_profile));
+    TEST_ASSERT_EQUAL_UINT32(param->generation, slot_param[slot].generation);
+}
+
+// ================================================================================================
+// デコードに失敗したスロットは変更されていないか
+// ================================================================================================
+static void assert_untouched(int slot)
+{
+    struct app_param    zero;
+    memset(&zero, 0x00, sizeof(zero));
+    TEST_ASSERT_EQUAL_MEMORY(&zero, &slot_param[slot], sizeof(zero));
+}
+
+// ================================================================================================
+// 両方有効なら新しい方
+// ================================================================================================
+static void test_select_newest(void)
+{
+    TEST_ASSERT_GREATER_THAN(0, rec_len[0]);
+    TEST_ASSERT_GREATER_THAN(0, rec_len[1]);
+    TEST_ASSERT_EQUAL(1, load_slots());
+    assert_slot(0, &old_param);
+    assert_slot(1, &new_param);
+    TEST_ASSERT_EQUAL(PARAM_REC_STATE_CONFIRMED, hdr[0].state);
+    TEST_ASSERT_EQUAL(PARAM_REC_STATE_PENDING,   hdr[1].state);
+}
+
+// ================================================================================================
+// シーケンス番号が一周しても新しい方を選ぶ
+// ================================================================================================
+static void test_select_seq_wrap(void)
+{
+    rec_len[0] = param_rec_encode(&old_param, 0xffffffff, PARAM_REC_STATE_CONFIRMED, rec[0], PARAM_REC_MAX_LEN);
+    rec_len[1] = param_rec_encode(&new_param, 0,          PARAM_REC_STATE_PENDING,   rec[1], PARAM_REC_MAX_LEN);
+    TEST_ASSERT_EQUAL(1, load_slots());
+
+    // 入れ替えても同じ結果
+    rec_len[0] = param_rec_encode(&new_param, 0,          PARAM_REC_STATE_PENDING,   rec[0], PARAM_REC_MAX_LEN);
+    rec_len[1] = param_rec_encode(&old_param, 0xffffffff, PARAM_REC_STATE_CONFIRMED, rec[1], PARAM_REC_MAX_LEN);
+    TEST_ASSERT_EQUAL(0, load_slots());
+}
+
+// ================================================================================================
+// 新しい方がどの位置で切れても古い方を選ぶ (書き込み中の電源断)
+// ================================================================================================
+static void test_truncated_falls_back(void)
+{
+    int     full_len = rec_len[1];
+
+    for (int len = 0; len < full_len; len++) {
+        rec_len[1] = len;
+        TEST_ASSERT_EQUAL(0, load_slots());
+        TEST_ASSERT_FALSE(valid[1]);
+        assert_untouched(1);
+        assert_slot(0, &old_param);
+    }
+}
+
+// ================================================================================================
+// 両方切れていれば選択できない
+// ================================================================================================
+static void test_both_truncated(void)
+{
+    int     full_len[PARAM_SLOT_NUM] = { rec_len[0], rec_len[1] };
+
+    for (int len = 0; len < full_len[0] && len < full_len[1]; len++) {
+        rec_len[0] = len;
+        rec_len[1] = len;
+        TEST_ASSERT_EQUAL(-1, load_slots());
+    }
+}
+
+// ================================================================================================
+// 余分なデータが付いたレコードは拒否する
+// ================================================================================================
+static void test_reject_overlong(void)
+{
+    rec[1][rec_len[1]++] = 0x00;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, param_rec_decode(rec[1], rec_len[1], &slot_param[1], &hdr[1]));
+    TEST_ASSERT_EQUAL(0, load_slots());
+    assert_untouched(1);
+}
+
+// ================================================================================================
+// 未知のバージョンは拒否する (レコード/ブロブとも)
+// ================================================================================================
+static void test_reject_unknown_version(void)
+{
+    rec[1][offsetof(struct param_rec_hdr, version)] = PARAM_REC_VERSION + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, param_rec_decode(rec[1], rec_len[1], &slot_param[1], &hdr[1]));
+    TEST_ASSERT_EQUAL(0, load_slots());
+    assert_untouched(1);
+
+    // ブロブのバージョンだけ違う (CRCは合わせる)
+    setUp();
+    struct param_rec_hdr    h;
+    memcpy(&h, rec[1], sizeof(h));
+    rec[1][sizeof(h)] = PARAM_BLOB_VERSION + 1;
+    uint32_t    crc = esp_rom_crc32_le(0, (const uint8_t*)&h, offsetof(struct param_rec_hdr, crc));
+    h.crc = esp_rom_crc32_le(crc, &rec[1][sizeof(h)], h.length);
+    memcpy(rec[1], &h, sizeof(h));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, param_rec_decode(rec[1], rec_len[1], &slot_param[1], &hdr[1]));
+    assert_untouched(1);
+}
+
+// ================================================================================================
+// 1bitでも化けていれば拒否して古い方を選ぶ
+// ================================================================================================
+static void test_reject_bad_crc(void)
+{
+    for (int pos = 0; pos < rec_len[1]; pos++) {
+        rec[1][pos] ^= 0x01;
+        TEST_ASSERT_EQUAL(0, load_slots());
+        TEST_ASSERT_FALSE(valid[1]);
+        assert_untouched(1);
+        rec[1][pos] ^= 0x01;
+    }
+
+    // 本体の化けはCRCで検出する
+    rec[1][rec_len[1] - 1] ^= 0x80;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, param_rec_decode(rec[1], rec_len[1], &slot_param[1], &hdr[1]));
+    assert_untouched(1);
+}
+
+// ================================================================================================
+// 確認前に2回セーブしてからロールバックすると、最後に確認済みになった設定に戻る
+// (2回目のセーブで確認済みのスロットを上書きしない)
+// ================================================================================================
+static void test_save_save_rollback(void)
+{
+    struct app_param    second_param;
+    int                 active  = 0;                    // スロットA(old_param)が確認済みで使用中
+    bool                pending = false;
+    uint32_t            seq     = 1;
+    int                 slot;
+
+    // 1回目のセーブ (new_param) → 使用中でない方
+    slot = param_rec_save_slot(active, pending);
+    TEST_ASSERT_EQUAL(1, slot);
+    rec_len[slot] = param_rec_encode(&new_param, ++seq, PARAM_REC_STATE_PENDING, rec[slot], PARAM_REC_MAX_LEN);
+    active  = slot;
+    pending = true;
+
+    // 2回目のセーブ (GOT_IP前) → 未確認のスロットを上書き
+    memcpy(&second_param, &new_param, sizeof(second_param));
+    strcpy(second_param.ssid_name, "second-ssid");
+    second_param.generation = 9;
+    slot = param_rec_save_slot(active, pending);
+    TEST_ASSERT_EQUAL(1, slot);
+    rec_len[slot] = param_rec_encode(&second_param, ++seq, PARAM_REC_STATE_PENDING, rec[slot], PARAM_REC_MAX_LEN);
+
+    // リブート : 新しい方(未確認)が選ばれ、規定回数まではそのまま使う
+    TEST_ASSERT_EQUAL(1, load_slots());
+    TEST_ASSERT_EQUAL(PARAM_REC_STATE_PENDING, hdr[1].state);
+    TEST_ASSERT_EQUAL_UINT32(seq, hdr[1].seq);
+    assert_slot(1, &second_param);
+    TEST_ASSERT_EQUAL(1, param_rec_boot_slot(1, valid, PARAM_BOOT_TRY_MAX - 1));
+
+    // 規定回数起動してもIPアドレスを取得できない → 確認済みのスロットAに戻る
+    slot = param_rec_boot_slot(1, valid, PARAM_BOOT_TRY_MAX);
+    TEST_ASSERT_EQUAL(0, slot);
+    TEST_ASSERT_EQUAL(PARAM_REC_STATE_CONFIRMED, hdr[slot].state);
+    assert_slot(slot, &old_param);
+}
+
+// ================================================================================================
+// もう一方のスロットが無効ならロールバックしない
+// ================================================================================================
+static void test_no_rollback_without_other(void)
+{
+    rec_len[0] = 0;
+    TEST_ASSERT_EQUAL(1, load_slots());
+    TEST_ASSERT_EQUAL(1, param_rec_boot_slot(1, valid, PARAM_BOOT_TRY_MAX));
+
+    // スロットがなければ A から書く
+    TEST_ASSERT_EQUAL(0, param_rec_save_slot(-1, false));
+}
+
+// ================================================================================================
+// バッファが足りなければエンコードしない
+// ================================================================================================
+static void test_encode_short_buffer(void)
+{
+    TEST_ASSERT_EQUAL(-1, param_rec_encode(&new_param, 3, PARAM_REC_STATE_PENDING, rec[1], rec_len[1] - 1));
+    TEST_ASSERT_EQUAL(-1, param_rec_encode(&new_param, 3, PARAM_REC_STATE_PENDING, rec[1], sizeof(struct param_rec_hdr) - 1));
+}
+
+// ================================================================================================
+// 経過時間 [ns]
+// ================================================================================================
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// ================================================================================================
+// 文字列を最大長まで埋める
+// ================================================================================================
+static void fill_str(char* str, int size, char c)
+{
+    memset(str, c, size - 1);
+    str[size - 1] = '\0';
+}
+
+// ================================================================================================
+// ロード時間の計測 (LoadParam() の load_record() 以降と同じ処理。NVSの読み出し時間は含まない)
+// 追加の接続先の数を増やしながら(項目が増えた場合に相当)、両スロットのデコード+選択の時間を測る
+// ================================================================================================
+static void test_bench_load(void)
+{
+    struct timespec     start, end;
+    int                 sel = -1;
+
+    fill_str(new_param.ssid_name, SSID_NAME_SIZE, 'n');
+    fill_str(new_param.ssid_pass, SSID_PASS_SIZE, 'p');
+    for (int num = 0; num <= AP_PROFILE_NUM; num++) {
+        memset(new_param.ap_profile, 0x00, sizeof(new_param.ap_profile));
+        for (int i = 0; i < num; i++) {
+            fill_str(new_param.ap_profile[i].ssid_name, SSID_NAME_SIZE, 'a' + i);
+            fill_str(new_param.ap_profile[i].ssid_pass, SSID_PASS_SIZE, 'A' + i);
+            new_param.ap_profile[i].priority = i;
+        }
+        rec_len[0] = param_rec_encode(&new_param, 1, PARAM_REC_STATE_CONFIRMED, rec[0], PARAM_REC_MAX_LEN);
+        rec_len[1] = param_rec_encode(&new_param, 2, PARAM_REC_STATE_PENDING,   rec[1], PARAM_REC_MAX_LEN);
+        TEST_ASSERT_TRUE(rec_len[0] > 0);
+        TEST_ASSERT_TRUE(rec_len[1] > 0);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int n = 0; n < BENCH_NUM; n++) {
+            for (int i = 0; i < PARAM_SLOT_NUM; i++) {
+                memset(&slot_param[i], 0x00, sizeof(slot_param[i]));
+                valid[i] = (param_rec_decode(rec[i], rec_len[i], &slot_param[i], &hdr[i]) == ESP_OK);
+            }
+            sel = param_rec_select(valid, hdr);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        TEST_ASSERT_EQUAL(1, sel);
+        new_param.crc = slot_param[1].crc;
+        TEST_ASSERT_EQUAL_MEMORY(&new_param, &slot_param[1], sizeof(new_param));
+        printf("    ap_profile %d : record %4d bytes x %d   %7.1f ns/load\n",
+               num, rec_len[1], PARAM_SLOT_NUM, elapsed_ns(&start, &end) / BENCH_NUM);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_select_newest);
+    RUN_TEST(test_select_seq_wrap);
+    RUN_TEST(test_truncated_falls_back);
+    RUN_TEST(test_both_truncated);
+    RUN_TEST(test_reject_overlong);
+    RUN_TEST(test_reject_unknown_version);
+    RUN_TEST(test_reject_bad_crc);
+    RUN_TEST(test_encode_short_buffer);
+    RUN_TEST(test_save_save_rollback);
+    RUN_TEST(test_no_rollback_without_other);
+    RUN_TEST(test_bench_load);
+    return UNITY_END();
+}
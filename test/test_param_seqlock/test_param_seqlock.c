@@ -0,0 +1,218 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- 設定パラメータ seqlock のテスト (pio test -e native) --
+    書き込みスレッドが確定を繰り返している間に読み出しスレッドでコピーしても、
+    書き込み途中の値(一部だけ新しい値)を読まないことを確認する。
+    あわせて1回の読み出しにかかる時間を計測して表示する(書き込みなし/あり)
+   ------------------------------------------------------- */
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <stddef.h>
+#include    <string.h>
+#include    <time.h>
+#include    <pthread.h>
+
+#include    <unity.h>
+
+#include    "esp_err.h"
+#include    "app_param.h"
+#include    "param_seqlock.h"
+
+// ==== マクロ定義 ===========================================================================================
+#define READ_NUM            200000          // 読み出しスレッドの読み出し回数
+#define BENCH_NUM           1000000         // 計測時の読み出し回数
+
+// ==== static 変数 ===========================================================================================
+static struct param_seqlock lock;
+static struct app_param     shared;                     // AppParam 相当
+static volatile bool        writer_stop;
+static uint32_t             write_count;
+
+// ================================================================================================
+// k 回目の書き込み内容 (全バイトが k の下位8bit、generation = k、crc = ~k)
+// ================================================================================================
+static void make_param(struct app_param* pParam, uint32_t k)
+{
+    memset(pParam, (uint8_t)k, sizeof(*pParam));
+    pParam->generation = k;
+    pParam->crc        = ~k;
+}
+
+// ================================================================================================
+// 読み出した内容が、ある1回の書き込み内容と一致するか
+// ================================================================================================
+static bool is_consistent(const struct app_param* pParam)
+{
+    struct app_param    expect;
+    make_param(&expect, pParam->generation);
+    return memcmp(&expect, pParam, sizeof(expect)) == 0;
+}
+
+// ================================================================================================
+// 書き込みスレッド (CommitParam() 相当。書き込み側は1つだけなので排他は不要)
+// ================================================================================================
+static void* writer_thread(void* arg)
+{
+    struct app_param    stage;
+    uint32_t            k = 0;
+
+    while (!writer_stop) {
+        make_param(&stage, ++k);
+        param_seqlock_write_begin(&lock);
+        memcpy(&shared, &stage, sizeof(shared));
+        param_seqlock_write_end(&lock);
+    }
+    write_count = k;
+    return NULL;
+}
+
+// ================================================================================================
+// 経過時間 [ns]
+// ================================================================================================
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// ================================================================================================
+// 書き込みスレッドの開始/停止
+// ================================================================================================
+static pthread_t    writer;
+
+static void start_writer(void)
+{
+    writer_stop = false;
+    TEST_ASSERT_EQUAL(0, pthread_create(&writer, NULL, writer_thread, NULL));
+}
+
+static void stop_writer(void)
+{
+    writer_stop = true;
+    pthread_join(writer, NULL);
+}
+
+// ================================================================================================
+// テスト毎の初期化
+// ================================================================================================
+void setUp(void)
+{
+    lock.seq = 0;
+    make_param(&shared, 0);
+    write_count = 0;
+}
+
+void tearDown(void)
+{
+}
+
+// ================================================================================================
+// 書き込みなしなら1回で読める
+// ================================================================================================
+static void test_read_idle(void)
+{
+    struct app_param    param;
+
+    uint32_t    seq = param_seqlock_read_begin(&lock);
+    memcpy(&param, &shared, sizeof(param));
+    TEST_ASSERT_FALSE(param_seqlock_read_retry(&lock, seq));
+    TEST_ASSERT_TRUE(is_consistent(&param));
+    TEST_ASSERT_EQUAL_UINT32(0, lock.seq & 1);
+}
+
+// ================================================================================================
+// 読み出し中に書き込みがあればやり直しになる
+// ================================================================================================
+static void test_retry_on_write(void)
+{
+    uint32_t    seq = param_seqlock_read_begin(&lock);
+    param_seqlock_write_begin(&lock);
+    TEST_ASSERT_EQUAL_UINT32(1, lock.seq & 1);
+    param_seqlock_write_end(&lock);
+    TEST_ASSERT_TRUE(param_seqlock_read_retry(&lock, seq));
+}
+
+// ================================================================================================
+// 書き込みと並行して読んでも、書き込み途中の値を読まない
+// ================================================================================================
+static void test_no_torn_read(void)
+{
+    struct app_param    param;
+    uint32_t            torn  = 0;
+    uint32_t            last  = 0;
+    uint32_t            older = 0;
+
+    start_writer();
+    for (int i = 0; i < READ_NUM; i++) {
+        param_seqlock_read(&lock, &param, &shared, sizeof(param));
+        if (!is_consistent(&param)) {
+            torn++;
+        }
+        if (param.generation < last) {
+            older++;                // 前回より古い値 (起きてはいけない)
+        }
+        last = param.generation;
+    }
+    stop_writer();
+
+    printf("    reads %d, writes %u, last generation %u\n", READ_NUM, write_count, last);
+    TEST_ASSERT_EQUAL_UINT32(0, torn);
+    TEST_ASSERT_EQUAL_UINT32(0, older);
+    TEST_ASSERT_TRUE(last > 0);                   // 書き込みと実際に並行して読めている
+}
+
+// ================================================================================================
+// 読み出し時間の計測 (書き込みなし/あり)
+// ================================================================================================
+static void test_bench_read(void)
+{
+    struct app_param    param;
+    struct timespec     start, end;
+    uint32_t            retry;
+    uint32_t            seq;
+
+    // 書き込みなし
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_NUM; i++) {
+        param_seqlock_read(&lock, &param, &shared, sizeof(param));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("    read (idle)        : %6.1f ns/op\n", elapsed_ns(&start, &end) / BENCH_NUM);
+
+    // 書き込みあり (やり直し回数も数える)
+    retry = 0;
+    start_writer();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_NUM; i++) {
+        while (1) {
+            seq = param_seqlock_read_begin(&lock);
+            memcpy(&param, &shared, sizeof(param));
+            if (!param_seqlock_read_retry(&lock, seq)) {
+                break;
+            }
+            retry++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stop_writer();
+    printf("    read (with writer) : %6.1f ns/op  (retry %u / %d, writes %u)\n",
+           elapsed_ns(&start, &end) / BENCH_NUM, retry, BENCH_NUM, write_count);
+    TEST_ASSERT_TRUE(is_consistent(&param));
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_read_idle);
+    RUN_TEST(test_retry_on_write);
+    RUN_TEST(test_no_torn_read);
+    RUN_TEST(test_bench_read);
+    return UNITY_END();
+}
@@ -0,0 +1,137 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- 設定パラメータ変更通知先テーブルのテスト (pio test -e native) --
+    登録/登録解除、変更項目による通知先の選択、テーブルが一杯の場合を確認する
+   ------------------------------------------------------- */
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    <unity.h>
+
+#include    "freertos/FreeRTOS.h"
+#include    "freertos/task.h"
+#include    "freertos/queue.h"
+#include    "esp_err.h"
+#include    "app_param.h"
+#include    "param_subscriber.h"
+
+// ==== static 変数 ===========================================================================================
+static struct param_subscriber  table[PARAM_SUBSCRIBER_MAX];
+static struct param_subscriber  out[PARAM_SUBSCRIBER_MAX];
+static int                      dummy[PARAM_SUBSCRIBER_MAX + 1];    // キュー/タスクハンドルの代わり (アドレスだけ使う)
+
+#define QUEUE(n)    ((QueueHandle_t)&dummy[n])
+#define TASK(n)     ((TaskHandle_t)&dummy[n])
+
+// ================================================================================================
+// テスト毎の初期化
+// ================================================================================================
+void setUp(void)
+{
+    memset(table, 0x00, sizeof(table));
+    memset(out, 0x00, sizeof(out));
+}
+
+void tearDown(void)
+{
+}
+
+// ================================================================================================
+// 登録すると空きの先頭から使い、登録解除した所は再利用される
+// ================================================================================================
+static void test_subscribe_unsubscribe(void)
+{
+    TEST_ASSERT_EQUAL(0, param_subscriber_add(table, PARAM_FIELD_ALL, QUEUE(0), NULL));
+    TEST_ASSERT_EQUAL(1, param_subscriber_add(table, PARAM_FIELD_SSID_NAME, NULL, TASK(1)));
+    TEST_ASSERT_EQUAL(2, param_subscriber_add(table, PARAM_FIELD_LOOP_INTERVAL, QUEUE(2), NULL));
+
+    param_subscriber_remove(table, 1);
+    TEST_ASSERT_NULL(table[1].queue);
+    TEST_ASSERT_NULL(table[1].task);
+
+    // 解除した通知先には通知しない
+    TEST_ASSERT_EQUAL(1, param_subscriber_collect(table, PARAM_FIELD_SSID_NAME, out));
+    TEST_ASSERT_EQUAL_PTR(QUEUE(0), out[0].queue);
+
+    // 空いた所を再利用
+    TEST_ASSERT_EQUAL(1, param_subscriber_add(table, PARAM_FIELD_AP_PROFILE, NULL, TASK(3)));
+}
+
+// ================================================================================================
+// 通知先がない登録/範囲外の登録解除は無視する
+// ================================================================================================
+static void test_invalid_args(void)
+{
+    struct param_subscriber     zero[PARAM_SUBSCRIBER_MAX];
+    memset(zero, 0x00, sizeof(zero));
+
+    TEST_ASSERT_EQUAL(-1, param_subscriber_add(table, PARAM_FIELD_ALL, NULL, NULL));
+    param_subscriber_remove(table, -1);
+    param_subscriber_remove(table, PARAM_SUBSCRIBER_MAX);
+    TEST_ASSERT_EQUAL_MEMORY(zero, table, sizeof(zero));
+}
+
+// ================================================================================================
+// 通知対象の項目が変わったときだけ、変わった項目を通知する
+// ================================================================================================
+static void test_field_filter(void)
+{
+    param_subscriber_add(table, PARAM_FIELD_SSID_NAME | PARAM_FIELD_SSID_PASS, QUEUE(0), NULL);
+    param_subscriber_add(table, PARAM_FIELD_LOOP_INTERVAL, NULL, TASK(1));
+    param_subscriber_add(table, PARAM_FIELD_ALL, NULL, TASK(2));
+
+    // ループインターバルだけ変更 → [1][2] に PARAM_FIELD_LOOP_INTERVAL
+    TEST_ASSERT_EQUAL(2, param_subscriber_collect(table, PARAM_FIELD_LOOP_INTERVAL, out));
+    TEST_ASSERT_EQUAL_PTR(TASK(1), out[0].task);
+    TEST_ASSERT_EQUAL_HEX32(PARAM_FIELD_LOOP_INTERVAL, out[0].fields);
+    TEST_ASSERT_EQUAL_PTR(TASK(2), out[1].task);
+    TEST_ASSERT_EQUAL_HEX32(PARAM_FIELD_LOOP_INTERVAL, out[1].fields);
+
+    // SSID名と接続先プロファイルを変更 → [0] には SSID名だけ、[2] には両方
+    TEST_ASSERT_EQUAL(2, param_subscriber_collect(table, PARAM_FIELD_SSID_NAME | PARAM_FIELD_AP_PROFILE, out));
+    TEST_ASSERT_EQUAL_PTR(QUEUE(0), out[0].queue);
+    TEST_ASSERT_EQUAL_HEX32(PARAM_FIELD_SSID_NAME, out[0].fields);
+    TEST_ASSERT_EQUAL_PTR(TASK(2), out[1].task);
+    TEST_ASSERT_EQUAL_HEX32(PARAM_FIELD_SSID_NAME | PARAM_FIELD_AP_PROFILE, out[1].fields);
+
+    // 変更なし → 通知しない
+    TEST_ASSERT_EQUAL(0, param_subscriber_collect(table, 0, out));
+}
+
+// ================================================================================================
+// テーブルが一杯なら登録できない (既存の登録はそのまま)
+// ================================================================================================
+static void test_table_full(void)
+{
+    for (int i = 0; i < PARAM_SUBSCRIBER_MAX; i++) {
+        TEST_ASSERT_EQUAL(i, param_subscriber_add(table, PARAM_FIELD_ALL, QUEUE(i), NULL));
+    }
+    TEST_ASSERT_EQUAL(-1, param_subscriber_add(table, PARAM_FIELD_ALL, QUEUE(PARAM_SUBSCRIBER_MAX), NULL));
+    TEST_ASSERT_EQUAL(PARAM_SUBSCRIBER_MAX, param_subscriber_collect(table, PARAM_FIELD_ALL, out));
+    for (int i = 0; i < PARAM_SUBSCRIBER_MAX; i++) {
+        TEST_ASSERT_EQUAL_PTR(QUEUE(i), out[i].queue);
+    }
+
+    // 1つ解除すれば登録できる
+    param_subscriber_remove(table, 3);
+    TEST_ASSERT_EQUAL(3, param_subscriber_add(table, PARAM_FIELD_ALL, QUEUE(PARAM_SUBSCRIBER_MAX), NULL));
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_subscribe_unsubscribe);
+    RUN_TEST(test_invalid_args);
+    RUN_TEST(test_field_filter);
+    RUN_TEST(test_table_full);
+    return UNITY_END();
+}
@@ -0,0 +1,205 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/* ---- Prepare Write キューのテスト (pio test -e native) --
+    フラグメントの順番が入れ替わったり重なったりしても正しく連結できること、
+    キュー/プールが溢れたら拒否することを確認する
+   ------------------------------------------------------- */
+
+#include    <stdio.h>
+#include    <stdbool.h>
+#include    <stdint.h>
+#include    <string.h>
+
+#include    <unity.h>
+
+#include    "esp_err.h"
+#include    "prep_queue.h"
+
+// ==== マクロ定義 ===========================================================================================
+#define HANDLE_A        0x002a
+#define HANDLE_B        0x002d
+
+// ==== static 変数 ===========================================================================================
+static struct prep_queue    queue;
+static uint8_t              data[PREP_QUEUE_POOL_SIZE];     // 書き込むデータ (位置が分かるように連番)
+static uint8_t              buf[PREP_QUEUE_POOL_SIZE];      // 連結結果
+
+// ================================================================================================
+// テスト毎の初期化
+// ================================================================================================
+void setUp(void)
+{
+    prep_queue_reset(&queue);
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7 + 1);
+    }
+    memset(buf, 0x00, sizeof(buf));
+}
+
+void tearDown(void)
+{
+}
+
+// ================================================================================================
+// data の offset から len byte を登録
+// ================================================================================================
+static esp_err_t push(uint16_t handle, uint16_t offset, uint16_t len)
+{
+    return prep_queue_push(&queue, handle, offset, &data[offset], len);
+}
+
+// ================================================================================================
+// 順番通りのフラグメント
+// ================================================================================================
+static void test_in_order(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A,  0, 18));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 18, 18));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 36,  5));
+    TEST_ASSERT_EQUAL(41, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buf, 41);
+}
+
+// ================================================================================================
+// 順番が入れ替わったフラグメント
+// ================================================================================================
+static void test_out_of_order(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 36,  5));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A,  0, 18));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 18, 18));
+    TEST_ASSERT_EQUAL(41, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buf, 41);
+}
+
+// ================================================================================================
+// 重なったフラグメント (重なった部分は後から来た値が有効)
+// ================================================================================================
+static void test_overlapping(void)
+{
+    static const uint8_t    patch[4] = { 0xde, 0xad, 0xbe, 0xef };
+
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A,  0, 20));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 10, 20));          // 10～19 が重なる
+    TEST_ASSERT_EQUAL(ESP_OK, prep_queue_push(&queue, HANDLE_A, 12, patch, sizeof(patch)));
+    TEST_ASSERT_EQUAL(30, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buf, 12);
+    TEST_ASSERT_EQUAL_MEMORY(patch, &buf[12], sizeof(patch));
+    TEST_ASSERT_EQUAL_MEMORY(&data[16], &buf[16], 30 - 16);
+
+    // 先に来たフラグメントに完全に含まれるフラグメント
+    prep_queue_reset(&queue);
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 0, 30));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 5, 10));
+    TEST_ASSERT_EQUAL(30, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buf, 30);
+}
+
+// ================================================================================================
+// 隙間があれば連結しない
+// ================================================================================================
+static void test_gap(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A,  0, 10));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 11, 10));
+    TEST_ASSERT_EQUAL(-1, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+
+    // 先頭が欠けている
+    prep_queue_reset(&queue);
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 1, 10));
+    TEST_ASSERT_EQUAL(-1, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+}
+
+// ================================================================================================
+// 複数ハンドルの混在
+// ================================================================================================
+static void test_multiple_handles(void)
+{
+    uint16_t    handles[PREP_QUEUE_ENTRY_NUM];
+
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_B,  0, 8));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A,  8, 8));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_B,  8, 4));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A,  0, 8));
+
+    TEST_ASSERT_EQUAL(2, prep_queue_handles(&queue, handles, PREP_QUEUE_ENTRY_NUM));
+    TEST_ASSERT_EQUAL_HEX16(HANDLE_B, handles[0]);              // 最初に書き込まれた順
+    TEST_ASSERT_EQUAL_HEX16(HANDLE_A, handles[1]);
+
+    TEST_ASSERT_EQUAL(16, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buf, 16);
+    TEST_ASSERT_EQUAL(12, prep_queue_assemble(&queue, HANDLE_B, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buf, 12);
+}
+
+// ================================================================================================
+// フラグメント数が上限を超える
+// ================================================================================================
+static void test_overflow_entry(void)
+{
+    for (int i = 0; i < PREP_QUEUE_ENTRY_NUM; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, i, 1));
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, push(HANDLE_A, PREP_QUEUE_ENTRY_NUM, 1));
+    // 溢れた分は登録されていない
+    TEST_ASSERT_EQUAL(PREP_QUEUE_ENTRY_NUM, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buf, PREP_QUEUE_ENTRY_NUM);
+}
+
+// ================================================================================================
+// データ量がプールを超える
+// ================================================================================================
+static void test_overflow_pool(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 0, PREP_QUEUE_POOL_SIZE - 1));
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, push(HANDLE_A, PREP_QUEUE_POOL_SIZE - 1, 2));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, PREP_QUEUE_POOL_SIZE - 1, 1));
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, push(HANDLE_B, 0, 1));
+    TEST_ASSERT_EQUAL(PREP_QUEUE_POOL_SIZE, prep_queue_assemble(&queue, HANDLE_A, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buf, PREP_QUEUE_POOL_SIZE);
+}
+
+// ================================================================================================
+// 連結結果がバッファに入らない
+// ================================================================================================
+static void test_overflow_buffer(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A,  0, 20));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 20, 20));
+    TEST_ASSERT_EQUAL(-1, prep_queue_assemble(&queue, HANDLE_A, buf, 39));
+    TEST_ASSERT_EQUAL(40, prep_queue_assemble(&queue, HANDLE_A, buf, 40));
+}
+
+// ================================================================================================
+// クリア後は空
+// ================================================================================================
+static void test_reset(void)
+{
+    uint16_t    handles[PREP_QUEUE_ENTRY_NUM];
+
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_A, 0, PREP_QUEUE_POOL_SIZE));
+    prep_queue_reset(&queue);
+    TEST_ASSERT_EQUAL(0, prep_queue_handles(&queue, handles, PREP_QUEUE_ENTRY_NUM));
+    TEST_ASSERT_EQUAL(ESP_OK, push(HANDLE_B, 0, PREP_QUEUE_POOL_SIZE));
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_in_order);
+    RUN_TEST(test_out_of_order);
+    RUN_TEST(test_overlapping);
+    RUN_TEST(test_gap);
+    RUN_TEST(test_multiple_handles);
+    RUN_TEST(test_overflow_entry);
+    RUN_TEST(test_overflow_pool);
+    RUN_TEST(test_overflow_buffer);
+    RUN_TEST(test_reset);
+    return UNITY_END();
+}